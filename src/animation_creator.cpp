@@ -33,6 +33,7 @@
 #include "raster.hpp"
 #include "slider.hpp"
 #include "surface_cache.hpp"
+#include "variant_hash_map.hpp"
  
 namespace gui {
 
@@ -58,11 +59,11 @@ int slider_transform(double d)
 // don't already exist in v1.
 void variant_map_merge(variant& v1, const variant& v2)
 {
-	std::map<variant, variant>::const_iterator v2it = v2.as_map().begin();
-	std::map<variant, variant>::const_iterator v2end = v2.as_map().end();
+	const std::map<variant, variant> v2_map = v2.as_map();
+	std::map<variant, variant>::const_iterator v2it = v2_map.begin();
+	std::map<variant, variant>::const_iterator v2end = v2_map.end();
 	while(v2it != v2end) {
-		std::map<variant, variant>::const_iterator v1it = v1.as_map().find(v2it->first);
-		if(v1it == v1.as_map().end()) {
+		if(v1.as_hash_map().find(v2it->first) == NULL) {
 			v1.add_attr(v2it->first, v2it->second);
 		}
 		v2it++;
@@ -525,8 +526,9 @@ void animation_creator_dialog::anim_save(dialog* d)
 			current_.add_attr(variant("image"), variant(rel_path_));
 
 			// erase any properties still as defaults.
-			std::map<variant, variant>::const_iterator vit = current_.as_map().begin();
-			std::map<variant, variant>::const_iterator end = current_.as_map().end();
+			const std::map<variant, variant> current_map = current_.as_map();
+			std::map<variant, variant>::const_iterator vit = current_map.begin();
+			std::map<variant, variant>::const_iterator end = current_map.end();
 			while(vit != end) {
 				std::map<variant, variant>::const_iterator dit = get_default_properties().find(vit->first);
 				if(dit != get_default_properties().end()) {
@@ -14,12 +14,19 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <climits>
+
+#include <boost/random/mersenne_twister.hpp>
+
 #include "asserts.hpp"
 #include "collision_utils.hpp"
+#include "custom_object.hpp"
 #include "foreach.hpp"
 #include "geometry.hpp"
 #include "level.hpp"
 #include "object_events.hpp"
+#include "unit_test.hpp"
 
 namespace {
 std::map<std::string, int> solid_dimensions;
@@ -58,6 +65,125 @@ int get_solid_dimension_id(const std::string& key)
 	return solid_dimensions.size()-1;
 }
 
+namespace {
+//the tests below for the entity moved by offset pixels from where it is,
+//so positions it's moving through can be tested without moving it.
+bool entity_collides_with_entity_at(const entity& e, const point& offset, const entity& other, collision_info* info)
+{
+	if((e.solid_dimensions()&other.weak_solid_dimensions()) == 0 &&
+	   (e.weak_solid_dimensions()&other.solid_dimensions()) == 0) {
+		return false;
+	}
+
+	const rect& solid_rect = e.solid_rect();
+	const rect our_rect(solid_rect.x() + offset.x, solid_rect.y() + offset.y, solid_rect.w(), solid_rect.h());
+	const rect& other_rect = other.solid_rect();
+
+	if(!rects_intersect(our_rect, other_rect)) {
+		return false;
+	}
+
+	if(other.destroyed()) {
+		return false;
+	}
+
+	const rect area = intersection_rect(our_rect, other_rect);
+
+	const solid_info* our_solid = e.solid();
+	const solid_info* other_solid = other.solid();
+	assert(our_solid && other_solid);
+
+	const frame& our_frame = e.current_frame();
+	const frame& other_frame = other.current_frame();
+
+	const int ex = e.x() + offset.x, ey = e.y() + offset.y;
+	for(int y = area.y(); y <= area.y2(); ++y) {
+		for(int x = area.x(); x < area.x2(); ++x) {
+			const int our_x = e.face_right() ? x - ex : (ex + our_frame.width()-1) - x;
+			const int our_y = y - ey;
+			if(our_solid->solid_at(our_x, our_y, info ? &info->area_id : NULL)) {
+				const int other_x = other.face_right() ? x - other.x() : (other.x() + other_frame.width()-1) - x;
+				const int other_y = y - other.y();
+				if(other_solid->solid_at(other_x, other_y, info ? &info->collide_with_area_id : NULL)) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+bool entity_collides_with_level_at(const level& lvl, const entity& e, const point& offset, MOVE_DIRECTION dir, collision_info* info)
+{
+	const solid_info* s = e.solid();
+	if(!s) {
+		return false;
+	}
+
+	if(e.face_right() == false) {
+		if(dir == MOVE_RIGHT) {
+			dir = MOVE_LEFT;
+		} else if(dir == MOVE_LEFT) {
+			dir = MOVE_RIGHT;
+		}
+	}
+
+	const frame& f = e.current_frame();
+	const point pos(e.x() + offset.x, e.y() + offset.y);
+
+	const rect& area = s->area();
+	if(e.face_right()) {
+		rect solid_area(pos.x + area.x(), pos.y + area.y(), area.w(), area.h());
+		if(!lvl.may_be_solid_in_rect(solid_area)) {
+			return false;
+		}
+	} else {
+		rect solid_area(pos.x + f.width() - area.x() - area.w(), pos.y + area.y(), area.w(), area.h());
+		if(!lvl.may_be_solid_in_rect(solid_area)) {
+			return false;
+		}
+	}
+
+	foreach(const const_solid_map_ptr& m, s->solid()) {
+		if(lvl.solid(e, pos, m->dir_spans(dir), info ? &info->surf_info : NULL)) {
+			if(info) {
+				info->read_surf_info();
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool entity_collides_at(level& lvl, const entity& e, const point& offset, MOVE_DIRECTION dir, collision_info* info)
+{
+	if(!e.solid()) {
+		return false;
+	}
+
+	if(!e.allow_level_collisions() && entity_collides_with_level_at(lvl, e, offset, dir, info)) {
+		return true;
+	}
+
+	const rect& area = e.solid_rect();
+	std::vector<entity*> solid_chars;
+	lvl.get_solid_chars_in_rect(rect(area.x() + offset.x, area.y() + offset.y, area.w(), area.h()), &solid_chars);
+	for(std::vector<entity*>::const_iterator obj = solid_chars.begin(); obj != solid_chars.end(); ++obj) {
+		if(*obj != &e && entity_collides_with_entity_at(e, offset, **obj, info)) {
+			if(info) {
+				info->collide_with = entity_ptr(*obj);
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+}
+
 bool point_standable(const level& lvl, const entity& e, int x, int y, collision_info* info, ALLOW_PLATFORM allow_platform)
 {
 	if(allow_platform == SOLID_AND_PLATFORMS  && lvl.standable(x, y, info ? &info->surf_info : NULL) ||
@@ -74,11 +200,12 @@ bool point_standable(const level& lvl, const entity& e, int x, int y, collision_
 
 	const point pt(x, y);
 
-	const std::vector<entity_ptr>& chars = lvl.get_solid_chars();
+	std::vector<entity*> chars;
+	lvl.get_solid_chars_in_rect(rect(x, y, 1, 1), &chars);
 
-	for(std::vector<entity_ptr>::const_iterator i = chars.begin();
+	for(std::vector<entity*>::const_iterator i = chars.begin();
 	    i != chars.end(); ++i) {
-		const entity_ptr& obj = *i;
+		const entity_ptr obj(*i);
 		if(&e == obj.get()) {
 			continue;
 		}
@@ -128,25 +255,52 @@ bool point_standable(const level& lvl, const entity& e, int x, int y, collision_
 
 bool entity_collides(level& lvl, const entity& e, MOVE_DIRECTION dir, collision_info* info)
 {
-	if(!e.solid()) {
-		return false;
+	return entity_collides_at(lvl, e, point(0, 0), dir, info);
+}
+
+int entity_free_distance(level& lvl, const entity& e, MOVE_DIRECTION dir, int max_distance, collision_info* info)
+{
+	ASSERT_LOG(dir != MOVE_NONE, "entity_free_distance needs a direction to move in");
+	if(!e.solid() || max_distance <= 0) {
+		return std::max(max_distance, 0);
 	}
 
-	if(!e.allow_level_collisions() && entity_collides_with_level(lvl, e, dir, info)) {
-		return true;
+	const int dx = dir == MOVE_LEFT ? -1 : (dir == MOVE_RIGHT ? 1 : 0);
+	const int dy = dir == MOVE_UP ? -1 : (dir == MOVE_DOWN ? 1 : 0);
+
+	//nothing can collide with the entity until something solid is inside
+	//its solid rect, so it can move at least that far.
+	const rect& area = e.solid_rect();
+	int safe_distance = max_distance;
+	if(!e.allow_level_collisions()) {
+		safe_distance = lvl.solid_free_distance(area, dir, max_distance);
 	}
 
-	const std::vector<entity_ptr>& solid_chars = lvl.get_solid_chars();
-	for(std::vector<entity_ptr>::const_iterator obj = solid_chars.begin(); obj != solid_chars.end(); ++obj) {
-		if(obj->get() != &e && entity_collides_with_entity(e, **obj, info)) {
-			if(info) {
-				info->collide_with = *obj;
+	const rect swept_area = rect_union(area, rect(area.x() + dx*max_distance, area.y() + dy*max_distance, area.w(), area.h()));
+	std::vector<entity*> solid_chars;
+	lvl.get_solid_chars_in_rect(swept_area, &solid_chars);
+	foreach(const entity* obj, solid_chars) {
+		if(obj == &e) {
+			continue;
+		}
+
+		const rect& obj_area = obj->solid_rect();
+		for(int n = 1; n <= safe_distance; ++n) {
+			if(rects_intersect(rect(area.x() + dx*n, area.y() + dy*n, area.w(), area.h()), obj_area)) {
+				safe_distance = n - 1;
+				break;
 			}
-			return true;
 		}
 	}
 
-	return false;
+	//beyond that, test each position the entity would step through.
+	for(int n = safe_distance + 1; n <= max_distance; ++n) {
+		if(entity_collides_at(lvl, e, point(dx*n, dy*n), dir, info)) {
+			return n - 1;
+		}
+	}
+
+	return max_distance;
 }
 
 void debug_check_entity_solidity(const level& lvl, const entity& e)
@@ -212,89 +366,12 @@ void debug_check_entity_solidity(const level& lvl, const entity& e)
 
 bool entity_collides_with_entity(const entity& e, const entity& other, collision_info* info)
 {
-	if((e.solid_dimensions()&other.weak_solid_dimensions()) == 0 &&
-	   (e.weak_solid_dimensions()&other.solid_dimensions()) == 0) {
-		return false;
-	}
-
-	const rect& our_rect = e.solid_rect();
-	const rect& other_rect = other.solid_rect();
-
-	if(!rects_intersect(our_rect, other_rect)) {
-		return false;
-	}
-
-	if(other.destroyed()) {
-		return false;
-	}
-
-	const rect area = intersection_rect(our_rect, other_rect);
-
-	const solid_info* our_solid = e.solid();
-	const solid_info* other_solid = other.solid();
-	assert(our_solid && other_solid);
-
-	const frame& our_frame = e.current_frame();
-	const frame& other_frame = other.current_frame();
-
-	for(int y = area.y(); y <= area.y2(); ++y) {
-		for(int x = area.x(); x < area.x2(); ++x) {
-			const int our_x = e.face_right() ? x - e.x() : (e.x() + our_frame.width()-1) - x;
-			const int our_y = y - e.y();
-			if(our_solid->solid_at(our_x, our_y, info ? &info->area_id : NULL)) {
-				const int other_x = other.face_right() ? x - other.x() : (other.x() + other_frame.width()-1) - x;
-				const int other_y = y - other.y();
-				if(other_solid->solid_at(other_x, other_y, info ? &info->collide_with_area_id : NULL)) {
-					return true;
-				}
-			}
-		}
-	}
-
-	return false;
+	return entity_collides_with_entity_at(e, point(0, 0), other, info);
 }
 
 bool entity_collides_with_level(const level& lvl, const entity& e, MOVE_DIRECTION dir, collision_info* info)
 {
-	const solid_info* s = e.solid();
-	if(!s) {
-		return false;
-	}
-
-	if(e.face_right() == false) {
-		if(dir == MOVE_RIGHT) {
-			dir = MOVE_LEFT;
-		} else if(dir == MOVE_LEFT) {
-			dir = MOVE_RIGHT;
-		}
-	}
-
-	const frame& f = e.current_frame();
-
-	const rect& area = s->area();
-	if(e.face_right()) {
-		rect solid_area(e.x() + area.x(), e.y() + area.y(), area.w(), area.h());
-		if(!lvl.may_be_solid_in_rect(solid_area)) {
-			return false;
-		}
-	} else {
-		rect solid_area(e.x() + f.width() - area.x() - area.w(), e.y() + area.y(), area.w(), area.h());
-		if(!lvl.may_be_solid_in_rect(solid_area)) {
-			return false;
-		}
-	}
-
-	foreach(const const_solid_map_ptr& m, s->solid()) {
-		if(lvl.solid(e, m->dir(dir), info ? &info->surf_info : NULL)) {
-			if(info) {
-				info->read_surf_info();
-			}
-
-			return true;
-		}
-	}
-
-	return false;
+	return entity_collides_with_level_at(lvl, e, point(0, 0), dir, info);
 }
 
 int entity_collides_with_level_count(const level& lvl, const entity& e, MOVE_DIRECTION dir)
@@ -604,6 +681,96 @@ int get_collision_event_id(const std::string& area)
 	return cache[area];
 }
 
+//the area covered by all of an object's collision areas along with its
+//collide dimensions, used to find which objects might collide.
+struct user_collision_bounds {
+	int x1, y1, x2, y2;
+	unsigned int collide_dimensions, weak_collide_dimensions;
+};
+
+user_collision_bounds get_user_collision_bounds(const entity& e)
+{
+	const frame& f = e.current_frame();
+
+	user_collision_bounds result;
+	result.x1 = result.y1 = INT_MAX;
+	result.x2 = result.y2 = INT_MIN;
+	result.collide_dimensions = e.collide_dimensions();
+	result.weak_collide_dimensions = e.weak_collide_dimensions();
+
+	//calculated the same way as the areas in entity_user_collision().
+	foreach(const frame::collision_area& area, f.collision_areas()) {
+		const int x = e.face_right() ? e.x() + area.area.x() : e.x() + f.width() - area.area.x() - area.area.w();
+		const int y = e.y() + area.area.y();
+		result.x1 = std::min(result.x1, x);
+		result.y1 = std::min(result.y1, y);
+		result.x2 = std::max(result.x2, x + area.area.w());
+		result.y2 = std::max(result.y2, y + area.area.h());
+	}
+
+	return result;
+}
+
+struct user_collision_bounds_x_less {
+	explicit user_collision_bounds_x_less(const std::vector<user_collision_bounds>& bounds) : bounds_(bounds)
+	{}
+
+	bool operator()(int a, int b) const {
+		return bounds_[a].x1 < bounds_[b].x1;
+	}
+
+	const std::vector<user_collision_bounds>& bounds_;
+};
+
+//finds every pair of bounds which overlap and share a collide dimension
+//using sweep and prune along the x axis. Pairs are given as (i, j) with
+//i < j, sorted so they're in the order a loop over all pairs visits them.
+void find_user_collision_candidates(const std::vector<user_collision_bounds>& bounds, std::vector<std::pair<int, int> >* pairs)
+{
+	pairs->clear();
+
+	std::vector<int> order(bounds.size());
+	for(int n = 0; n != order.size(); ++n) {
+		order[n] = n;
+	}
+
+	std::stable_sort(order.begin(), order.end(), user_collision_bounds_x_less(bounds));
+
+	//bounds which start to the left of the current one and may still
+	//overlap it.
+	std::vector<int> active;
+	foreach(int i, order) {
+		const user_collision_bounds& a = bounds[i];
+
+		int nactive = 0;
+		foreach(int j, active) {
+			if(bounds[j].x2 <= a.x1) {
+				continue;
+			}
+
+			active[nactive++] = j;
+
+			const user_collision_bounds& b = bounds[j];
+			if(a.y2 <= b.y1 || b.y2 <= a.y1) {
+				continue;
+			}
+
+			if((a.weak_collide_dimensions&b.collide_dimensions) == 0 &&
+			   (a.collide_dimensions&b.weak_collide_dimensions) == 0) {
+				//the objects do not share a dimension, and so can't collide.
+				continue;
+			}
+
+			pairs->push_back(std::pair<int, int>(std::min(i, j), std::max(i, j)));
+		}
+
+		active.resize(nactive);
+		active.push_back(i);
+	}
+
+	std::sort(pairs->begin(), pairs->end());
+}
+
 }
 
 void detect_user_collisions(level& lvl)
@@ -621,32 +788,38 @@ void detect_user_collisions(level& lvl)
 
 	static const int CollideObjectID = get_object_event_id("collide_object");
 
+	std::vector<user_collision_bounds> bounds;
+	bounds.reserve(chars.size());
+	foreach(const entity_ptr& a, chars) {
+		bounds.push_back(get_user_collision_bounds(*a));
+	}
+
+	//only pairs whose collision areas overlap are checked, in the same
+	//order as checking every pair, so events are fired in the same order.
+	std::vector<std::pair<int, int> > candidates;
+	find_user_collision_candidates(bounds, &candidates);
+
 	const int MaxCollisions = 16;
 	collision_pair collision_buf[MaxCollisions];
-	for(std::vector<entity_ptr>::const_iterator i = chars.begin(); i != chars.end(); ++i) {
-		for(std::vector<entity_ptr>::const_iterator j = i + 1; j != chars.end(); ++j) {
-			const entity_ptr& a = *i;
-			const entity_ptr& b = *j;
-			if(a == b ||
-			   (a->weak_collide_dimensions()&b->collide_dimensions()) == 0 &&
-			   (a->collide_dimensions()&b->weak_collide_dimensions()) == 0) {
-				//the objects do not share a dimension, and so can't collide.
-				continue;
-			}
+	for(std::vector<std::pair<int, int> >::const_iterator i = candidates.begin(); i != candidates.end(); ++i) {
+		const entity_ptr& a = chars[i->first];
+		const entity_ptr& b = chars[i->second];
+		if(a == b) {
+			continue;
+		}
 
-			int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
-			if(ncollisions > MaxCollisions) {
-				ncollisions = MaxCollisions;
-			}
+		int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
+		if(ncollisions > MaxCollisions) {
+			ncollisions = MaxCollisions;
+		}
 
-			for(int n = 0; n != ncollisions; ++n) {
-				{
-					collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
-				}
+		for(int n = 0; n != ncollisions; ++n) {
+			{
+				collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
+			}
 
-				{
-					collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
-				}
+			{
+				collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
 			}
 		}
 	}
@@ -685,10 +858,11 @@ bool is_flightpath_clear(const level& lvl, const entity& e, const rect& area)
 		return false;
 	}
 
-	const std::vector<entity_ptr>& v = lvl.get_solid_chars();
-	for(std::vector<entity_ptr>::const_iterator obj = v.begin();
+	std::vector<entity*> v;
+	lvl.get_solid_chars_in_rect(area, &v);
+	for(std::vector<entity*>::const_iterator obj = v.begin();
 	    obj != v.end(); ++obj) {
-		if(obj->get() == &e) {
+		if(*obj == &e) {
 			continue;
 		}
 
@@ -699,3 +873,139 @@ bool is_flightpath_clear(const level& lvl, const entity& e, const rect& area)
 
 	return true;
 }
+
+namespace {
+//a set of bounds scattered over an area, and velocities to move them by.
+//moves the entity one pixel at a time, as entity_free_distance() used to.
+int stepped_free_distance(level& lvl, entity& e, MOVE_DIRECTION dir, int max_distance, collision_info* info)
+{
+	const int start_centi_x = e.centi_x();
+	const int start_centi_y = e.centi_y();
+	int result = max_distance;
+	for(int n = 1; n <= max_distance; ++n) {
+		switch(dir) {
+		case MOVE_LEFT: e.set_centi_x(start_centi_x - n*100); break;
+		case MOVE_RIGHT: e.set_centi_x(start_centi_x + n*100); break;
+		case MOVE_UP: e.set_centi_y(start_centi_y - n*100); break;
+		default: e.set_centi_y(start_centi_y + n*100); break;
+		}
+
+		if(entity_collides(lvl, e, dir, info)) {
+			result = n - 1;
+			break;
+		}
+	}
+
+	e.set_centi_x(start_centi_x);
+	e.set_centi_y(start_centi_y);
+	return result;
+}
+
+void create_test_colliders(int ncolliders, std::vector<user_collision_bounds>* bounds, std::vector<std::pair<int, int> >* velocities)
+{
+	//a fixed seed, so a failure can be reproduced.
+	boost::random::mt19937 gen(5489);
+	for(int n = 0; n != ncolliders; ++n) {
+		user_collision_bounds b;
+		b.x1 = int(gen()%2000);
+		b.y1 = int(gen()%1200);
+		b.x2 = b.x1 + 8 + n%24;
+		b.y2 = b.y1 + 8 + n%16;
+		b.collide_dimensions = b.weak_collide_dimensions = 1 << (n%3);
+		bounds->push_back(b);
+		velocities->push_back(std::pair<int, int>(n%7 - 3, n%5 - 2));
+	}
+}
+
+void move_test_colliders(std::vector<user_collision_bounds>* bounds, const std::vector<std::pair<int, int> >& velocities)
+{
+	for(int n = 0; n != bounds->size(); ++n) {
+		user_collision_bounds& b = (*bounds)[n];
+		const int w = b.x2 - b.x1, h = b.y2 - b.y1;
+		b.x1 = (b.x1 + velocities[n].first + 2000)%2000;
+		b.y1 = (b.y1 + velocities[n].second + 1200)%1200;
+		b.x2 = b.x1 + w;
+		b.y2 = b.y1 + h;
+	}
+}
+}
+
+UNIT_TEST(user_collision_broadphase)
+{
+	std::vector<user_collision_bounds> bounds;
+	std::vector<std::pair<int, int> > velocities;
+	create_test_colliders(500, &bounds, &velocities);
+
+	for(int step = 0; step != 10; ++step) {
+		std::vector<std::pair<int, int> > expected;
+		for(int i = 0; i != bounds.size(); ++i) {
+			for(int j = i + 1; j != bounds.size(); ++j) {
+				const user_collision_bounds& a = bounds[i];
+				const user_collision_bounds& b = bounds[j];
+				if(a.x2 > b.x1 && b.x2 > a.x1 && a.y2 > b.y1 && b.y2 > a.y1 &&
+				   ((a.weak_collide_dimensions&b.collide_dimensions) || (a.collide_dimensions&b.weak_collide_dimensions))) {
+					expected.push_back(std::pair<int, int>(i, j));
+				}
+			}
+		}
+
+		std::vector<std::pair<int, int> > pairs;
+		find_user_collision_candidates(bounds, &pairs);
+		CHECK_EQ(pairs.size(), expected.size());
+		CHECK_EQ(pairs == expected, true);
+
+		move_test_colliders(&bounds, velocities);
+	}
+}
+
+BENCHMARK_ARG(user_collision_broadphase, int ncolliders)
+{
+	std::vector<user_collision_bounds> bounds;
+	std::vector<std::pair<int, int> > velocities;
+	create_test_colliders(ncolliders, &bounds, &velocities);
+
+	std::vector<std::pair<int, int> > pairs;
+	BENCHMARK_LOOP {
+		move_test_colliders(&bounds, velocities);
+		find_user_collision_candidates(bounds, &pairs);
+	}
+}
+
+BENCHMARK_ARG_CALL(user_collision_broadphase, colliders_100, 100);
+BENCHMARK_ARG_CALL(user_collision_broadphase, colliders_400, 400);
+BENCHMARK_ARG_CALL(user_collision_broadphase, colliders_2000, 2000);
+
+UNIT_TEST(entity_free_distance)
+{
+	boost::intrusive_ptr<level> lvl(new level("empty.cfg"));
+	lvl->set_solid_area(rect(200, 100, 32, 32), true);
+	lvl->set_solid_area(rect(100, 260, 64, 8), true);
+	lvl->set_solid_area(rect(40, 40, 8, 200), true);
+
+	const point blocks[] = { point(150, 150), point(260, 220), point(120, 200), point(280, 60) };
+	foreach(const point& p, blocks) {
+		lvl->add_character(entity_ptr(new custom_object("benchmark_solid_block", p.x, p.y, true)));
+	}
+
+	boost::intrusive_ptr<custom_object> mover(new custom_object("benchmark_solid_block", 0, 0, true));
+
+	const MOVE_DIRECTION dirs[] = { MOVE_LEFT, MOVE_RIGHT, MOVE_UP, MOVE_DOWN };
+	for(int y = 50; y < 320; y += 19) {
+		for(int x = 50; x < 320; x += 23) {
+			//fractional starting positions must move exactly as whole ones.
+			mover->set_centi_x(x*100 + (x%3)*37);
+			mover->set_centi_y(y*100 + (y%2)*71);
+			const rect start_rect = mover->solid_rect();
+
+			foreach(MOVE_DIRECTION dir, dirs) {
+				collision_info info, expected_info;
+				const int distance = entity_free_distance(*lvl, *mover, dir, 40, &info);
+				CHECK_EQ(mover->solid_rect(), start_rect);
+
+				const int expected = stepped_free_distance(*lvl, *mover, dir, 40, &expected_info);
+				CHECK_EQ(distance, expected);
+				CHECK_EQ(info.collide_with.get(), expected_info.collide_with.get());
+			}
+		}
+	}
+}
@@ -74,6 +74,12 @@ bool point_standable(const level& lvl, const entity& e, int x, int y, collision_
 //'dir' is MOVE_NONE, then all pixels will be checked.
 bool entity_collides(level& lvl, const entity& e, MOVE_DIRECTION dir, collision_info* info=NULL);
 
+//function which finds how many pixels an entity can move in the direction
+//given by 'dir', one pixel at a time, before entity_collides() finds it
+//colliding, up to max_distance. 'info' is updated as entity_collides()
+//would update it while moving. The entity isn't moved.
+int entity_free_distance(level& lvl, const entity& e, MOVE_DIRECTION dir, int max_distance, collision_info* info=NULL);
+
 void debug_check_entity_solidity(const level& lvl, const entity& e);
 
 //function which finds if one entity collides with another given entity.
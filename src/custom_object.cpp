@@ -23,8 +23,11 @@
 
 #include <stdio.h>
 
+#include <algorithm>
 #include <cassert>
+#include <deque>
 #include <iostream>
+#include <typeinfo>
 
 #include "asserts.hpp"
 #include "code_editor_dialog.hpp"
@@ -168,8 +171,8 @@ custom_object::custom_object(variant node)
 	properties_requiring_dynamic_initialization_ = type_->properties_requiring_dynamic_initialization();
 	properties_requiring_dynamic_initialization_.insert(properties_requiring_dynamic_initialization_.end(), type_->properties_requiring_initialization().begin(), type_->properties_requiring_initialization().end());
 
-	vars_->disallow_new_keys(type_->is_strict());
-	tmp_vars_->disallow_new_keys(type_->is_strict());
+	vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+	tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 	get_all().insert(this);
 	get_all(base_type_->id()).insert(this);
@@ -243,6 +246,7 @@ custom_object::custom_object(variant node)
 	if(node.has_key("variations")) {
 		current_variation_ = util::split(node["variations"].as_string());
 		type_ = base_type_->get_variation(current_variation_);
+		clear_property_caches();
 	}
 
 	if(node.has_key("parallax_scale_x") || node.has_key("parallax_scale_y")) {
@@ -462,8 +466,8 @@ custom_object::custom_object(const std::string& type, int x, int y, bool face_ri
 	vertex_location_(-1), texcoord_location_(-1),
 	paused_(false)
 {
-	vars_->disallow_new_keys(type_->is_strict());
-	tmp_vars_->disallow_new_keys(type_->is_strict());
+	vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+	tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 	for(std::map<std::string, custom_object_type::property_entry>::const_iterator i = type_->properties().begin(); i != type_->properties().end(); ++i) {
 		if(i->second.storage_slot < 0) {
@@ -595,8 +599,8 @@ custom_object::custom_object(const custom_object& o) :
 	vertex_location_(o.vertex_location_), texcoord_location_(o.texcoord_location_),
 	paused_(o.paused_)
 {
-	vars_->disallow_new_keys(type_->is_strict());
-	tmp_vars_->disallow_new_keys(type_->is_strict());
+	vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+	tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 	get_all().insert(this);
 	get_all(base_type_->id()).insert(this);
@@ -657,6 +661,9 @@ void custom_object::init_properties()
 
 		get_property_data(i->second.storage_slot) = i->second.init->execute(*this);
 	}
+
+	//initializers may have read cached properties before setting data.
+	clear_property_caches();
 }
 
 bool custom_object::is_a(const std::string& type) const
@@ -1687,8 +1694,20 @@ void custom_object::process(level& lvl)
 	bool is_stuck = false;
 
 	collide = false;
-	int move_left;
-	for(move_left = std::abs(effective_velocity_y); move_left > 0 && !collide && !type_->ignore_collide(); move_left -= 100) {
+	int move_left = std::abs(effective_velocity_y);
+
+	//pixels we can move through without colliding have no effect other
+	//than moving us, so they're skipped in one go. The rest of the move
+	//is made a pixel at a time. Moving down with feet checks for landing
+	//at each pixel, so isn't skipped.
+	if(move_left >= 100 && !type_->ignore_collide() && !type_->object_level_collisions() && (effective_velocity_y < 0 || !has_feet())) {
+		const int dir = effective_velocity_y > 0 ? 1 : -1;
+		const int free_pixels = entity_free_distance(lvl, *this, dir > 0 ? MOVE_DOWN : MOVE_UP, move_left/100, &collide_info);
+		move_centipixels(0, free_pixels*100*dir);
+		move_left -= free_pixels*100;
+	}
+
+	for(; move_left > 0 && !collide && !type_->ignore_collide(); move_left -= 100) {
 		const int dir = effective_velocity_y > 0 ? 1 : -1;
 		int damage = 0;
 
@@ -1841,8 +1860,18 @@ void custom_object::process(level& lvl)
 		const int backup_centi_x = centi_x();
 		const int backup_centi_y = centi_y();
 
+		move_left = std::abs(effective_velocity_x);
 
-		for(move_left = std::abs(effective_velocity_x); move_left > 0 && !collide && !type_->ignore_collide(); move_left -= 100) {
+		//objects without feet don't do anything but move and look for
+		//collisions at each pixel, so skip the pixels they can't collide in.
+		if(detect_collisions && move_left >= 100 && !type_->ignore_collide() && !type_->object_level_collisions() && !has_feet() && !standing_on_) {
+			const int dir = effective_velocity_x > 0 ? 1 : -1;
+			const int free_pixels = entity_free_distance(lvl, *this, dir > 0 ? MOVE_RIGHT : MOVE_LEFT, move_left/100, &collide_info);
+			move_centipixels(free_pixels*100*dir, 0);
+			move_left -= free_pixels*100;
+		}
+
+		for(; move_left > 0 && !collide && !type_->ignore_collide(); move_left -= 100) {
 			if(type_->object_level_collisions() && non_solid_entity_collides_with_level(lvl, *this)) {
 				handle_event(OBJECT_EVENT_COLLIDE_LEVEL);
 			}
@@ -2586,6 +2615,10 @@ variant two_element_variant_list(const variant& a, const variant&b)
 
 variant custom_object::get_value_by_slot(int slot) const
 {
+	if(property_cache_recording_) {
+		note_slot_read(slot);
+	}
+
 	switch(slot) {
 	case CUSTOM_OBJECT_VALUE: {
 		ASSERT_LOG(value_stack_.empty() == false, "Query of value in illegal context");
@@ -3014,6 +3047,11 @@ variant custom_object::get_value_by_slot(int slot) const
 				if(std::find(properties_requiring_dynamic_initialization_.begin(), properties_requiring_dynamic_initialization_.end(), e.storage_slot) != properties_requiring_dynamic_initialization_.end()) {
 					ASSERT_LOG(false, "Read of uninitialized property " << debug_description() << "." << e.id);
 				}
+
+				if(e.cache_slot >= 0) {
+					return get_cached_property(e);
+				}
+
 				active_property_scope scope(*this, e.storage_slot);
 				return e.getter->execute(*this);
 			} else if(e.const_value) {
@@ -3038,6 +3076,24 @@ variant custom_object::get_value_by_slot(int slot) const
 	return variant();
 }
 
+const game_logic::formula_callable_definition* custom_object::get_slot_definition() const
+{
+	//built-in values and properties are both looked up through the type's
+	//definition in get_value(), so its slots can be used directly. That
+	//doesn't hold for subclasses which override get_value(), unless they
+	//override this as well.
+	if(typeid(*this) != typeid(custom_object)) {
+		return NULL;
+	}
+
+	return type_slot_definition();
+}
+
+const game_logic::formula_callable_definition* custom_object::type_slot_definition() const
+{
+	return type_->callable_definition().get();
+}
+
 variant custom_object::get_value(const std::string& key) const
 {
 	const int slot = type_->callable_definition()->get_slot(key);
@@ -3045,16 +3101,29 @@ variant custom_object::get_value(const std::string& key) const
 		return get_value_by_slot(slot);
 	}
 
-	std::map<std::string, custom_object_type::property_entry>::const_iterator property_itor = type_->properties().find(key);
-	if(property_itor != type_->properties().end()) {
-		if(property_itor->second.getter) {
-			active_property_scope scope(*this, property_itor->second.storage_slot);
-			return property_itor->second.getter->execute(*this);
-		} else if(property_itor->second.const_value) {
-			return *property_itor->second.const_value;
-		} else if(property_itor->second.storage_slot >= 0) {
-			return get_property_data(property_itor->second.storage_slot);
+	const custom_object_type::property_entry* property = type_->find_property(key);
+	if(property) {
+		if(property_cache_recording_) {
+			note_slot_read(slot);
 		}
+
+		if(property->getter) {
+			if(property->cache_slot >= 0) {
+				return get_cached_property(*property);
+			}
+
+			active_property_scope scope(*this, property->storage_slot);
+			return property->getter->execute(*this);
+		} else if(property->const_value) {
+			return *property->const_value;
+		} else if(property->storage_slot >= 0) {
+			return get_property_data(property->storage_slot);
+		}
+	}
+
+	//other values looked up by name aren't tracked by cached properties.
+	if(property_cache_recording_) {
+		property_cache_recording_->cacheable = false;
 	}
 
 	if(!type_->is_strict()) {
@@ -3090,6 +3159,144 @@ variant custom_object::get_value(const std::string& key) const
 	return variant();
 }
 
+variant custom_object::get_cached_property(const custom_object_type::property_entry& e) const
+{
+	if(property_cache_.empty()) {
+		property_cache_.resize(type_->cached_properties().size());
+		property_cache_dependents_.resize(type_->slot_properties().size());
+	}
+
+	const property_cache_entry& cached = property_cache_[e.cache_slot];
+	if(cached.valid && (!cached.reads_vars || cached.vars_version == vars_->version()) && (!cached.reads_tmp_vars || cached.tmp_vars_version == tmp_vars_->version())) {
+		if(property_cache_recording_ && property_cache_recording_->owner == this) {
+			property_cache_recording_->reads_vars = property_cache_recording_->reads_vars || cached.reads_vars;
+			property_cache_recording_->reads_tmp_vars = property_cache_recording_->reads_tmp_vars || cached.reads_tmp_vars;
+		}
+
+		return cached.value;
+	}
+
+	variant result;
+	property_cache_recording recording(this, property_cache_recording_);
+	{
+		active_property_scope scope(*this, e.storage_slot);
+		result = e.getter->execute(*this);
+	}
+
+	if(recording.cacheable) {
+		property_cache_entry& cache = property_cache_[e.cache_slot];
+		cache.value = result;
+		cache.valid = true;
+		cache.reads_vars = recording.reads_vars;
+		cache.reads_tmp_vars = recording.reads_tmp_vars;
+		cache.vars_version = vars_->version();
+		cache.tmp_vars_version = tmp_vars_->version();
+
+		foreach(int index, recording.reads) {
+			std::vector<int>& dependents = property_cache_dependents_[index];
+			if(std::find(dependents.begin(), dependents.end(), e.cache_slot) == dependents.end()) {
+				dependents.push_back(e.cache_slot);
+			}
+		}
+	}
+
+	//a property reading this one depends on everything this one read.
+	if(recording.parent) {
+		recording.parent->cacheable = recording.parent->cacheable && recording.cacheable;
+		recording.parent->reads_vars = recording.parent->reads_vars || recording.reads_vars;
+		recording.parent->reads_tmp_vars = recording.parent->reads_tmp_vars || recording.reads_tmp_vars;
+	}
+
+	return result;
+}
+
+void custom_object::note_slot_read(int slot) const
+{
+	if(property_cache_recording_->owner != this) {
+		//a getter reading through another object.
+		property_cache_recording_->cacheable = false;
+		return;
+	}
+
+	switch(slot) {
+	//values which don't change, or which are tracked another way.
+	case CUSTOM_OBJECT_VALUE:
+	case CUSTOM_OBJECT_DATA:
+	case CUSTOM_OBJECT_CONSTS:
+	case CUSTOM_OBJECT_TYPE:
+	case CUSTOM_OBJECT_LIB:
+	case CUSTOM_OBJECT_ME:
+	case CUSTOM_OBJECT_SELF:
+		return;
+	case CUSTOM_OBJECT_VARS:
+		property_cache_recording_->reads_vars = true;
+		return;
+	case CUSTOM_OBJECT_TMP:
+		property_cache_recording_->reads_tmp_vars = true;
+		return;
+	default:
+		break;
+	}
+
+	const int index = slot - type_->slot_properties_base();
+	if(slot >= NUM_CUSTOM_OBJECT_PROPERTIES && index >= 0 && size_t(index) < type_->slot_properties().size()) {
+		property_cache_recording_->reads.push_back(index);
+
+		//objects held in properties can change without this one knowing.
+		const custom_object_type::property_entry& e = type_->slot_properties()[index];
+		if(!e.getter && e.storage_slot >= 0 && get_property_data(e.storage_slot).is_callable()) {
+			property_cache_recording_->cacheable = false;
+		}
+	} else {
+		//built-in values change without going through set_value_by_slot().
+		property_cache_recording_->cacheable = false;
+	}
+}
+
+void custom_object::note_uncacheable_read() const
+{
+	if(property_cache_recording_) {
+		property_cache_recording_->cacheable = false;
+	}
+}
+
+void custom_object::clear_property_caches()
+{
+	property_cache_.clear();
+	property_cache_dependents_.clear();
+}
+
+void custom_object::invalidate_property_caches(int property_index)
+{
+	if(property_cache_.empty()) {
+		return;
+	}
+
+	const int cache_slot = type_->slot_properties()[property_index].cache_slot;
+	if(cache_slot >= 0) {
+		invalidate_cached_property(cache_slot);
+	}
+
+	foreach(int dependent, property_cache_dependents_[property_index]) {
+		invalidate_cached_property(dependent);
+	}
+}
+
+void custom_object::invalidate_cached_property(int cache_slot)
+{
+	property_cache_entry& cache = property_cache_[cache_slot];
+	if(!cache.valid) {
+		return;
+	}
+
+	cache.valid = false;
+	cache.value = variant();
+
+	foreach(int dependent, property_cache_dependents_[type_->cached_properties()[cache_slot]]) {
+		invalidate_cached_property(dependent);
+	}
+}
+
 void custom_object::get_inputs(std::vector<game_logic::formula_input>* inputs) const
 {
 	for(int n = 0; n != NUM_CUSTOM_OBJECT_PROPERTIES; ++n) {
@@ -3103,27 +3310,39 @@ void custom_object::get_inputs(std::vector<game_logic::formula_input>* inputs) c
 
 void custom_object::set_value(const std::string& key, const variant& value)
 {
+	//many values written here change where the object may be active.
+	index_area_changed();
+
 	const int slot = custom_object_callable::get_key_slot(key);
 	if(slot != -1) {
 		set_value_by_slot(slot, value);
 		return;
 	}
 
-	std::map<std::string, custom_object_type::property_entry>::const_iterator property_itor = type_->properties().find(key);
-	if(property_itor != type_->properties().end() && property_itor->second.setter) {
+	const custom_object_type::property_entry* property = type_->find_property(key);
+	if(property && property->setter) {
 		game_logic::map_formula_callable_ptr callable(new game_logic::map_formula_callable(this));
 		callable->add("value", value);
 
-		active_property_scope scope(*this, property_itor->second.storage_slot, &value);
-		variant value = property_itor->second.setter->execute(*callable);
-		execute_command(value);
+		{
+			active_property_scope scope(*this, property->storage_slot, &value);
+			variant value = property->setter->execute(*callable);
+			execute_command(value);
+		}
+
+		if(!property_cache_.empty()) {
+			invalidate_property_caches(type_->callable_definition()->get_slot(key) - type_->slot_properties_base());
+		}
 		return;
-	} else if(property_itor != type_->properties().end() && property_itor->second.storage_slot >= 0) {
-		get_property_data(property_itor->second.storage_slot) = value;
+	} else if(property && property->storage_slot >= 0) {
+		get_property_data(property->storage_slot) = value;
+		if(!property_cache_.empty()) {
+			invalidate_property_caches(type_->callable_definition()->get_slot(key) - type_->slot_properties_base());
+		}
 		return;
 	}
 
-	ASSERT_LOG(property_itor == type_->properties().end(), "Illegal write to non-writable property " << property_itor->first << " in " << debug_description());
+	ASSERT_LOG(property == NULL, "Illegal write to non-writable property " << key << " in " << debug_description());
 
 	if(key == "animation") {
 		set_frame(value.as_string());
@@ -3289,6 +3508,7 @@ void custom_object::set_value(const std::string& key, const variant& value)
 		} else {
 			type_ = base_type_->get_variation(current_variation_);
 		}
+		clear_property_caches();
 
 		calculate_solid_rect();
 
@@ -3365,6 +3585,7 @@ void custom_object::set_value(const std::string& key, const variant& value)
 
 			get_all(base_type_->id()).erase(this);
 			base_type_ = type_ = p;
+			clear_property_caches();
 			get_all(base_type_->id()).insert(this);
 			has_feet_ = type_->has_feet();
 			vars_.reset(new game_logic::formula_variable_storage(type_->variables())),
@@ -3373,8 +3594,8 @@ void custom_object::set_value(const std::string& key, const variant& value)
 			vars_->add(*old_vars);
 			tmp_vars_->add(*old_tmp_vars_);
 
-			vars_->disallow_new_keys(type_->is_strict());
-			tmp_vars_->disallow_new_keys(type_->is_strict());
+			vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+			tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 			//set the animation to the default animation for the new type.
 			set_frame(type_->default_frame().id());
@@ -3416,6 +3637,8 @@ void custom_object::set_value(const std::string& key, const variant& value)
 
 void custom_object::set_value_by_slot(int slot, const variant& value)
 {
+	index_area_changed();
+
 	switch(slot) {
 	case CUSTOM_OBJECT_DATA: {
 		ASSERT_LOG(active_property_ >= 0, "Illegal access of 'data' in object when not in writable property");
@@ -3429,6 +3652,7 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 			get_all(base_type_->id()).erase(this);
 			base_type_ = type_ = p;
+			clear_property_caches();
 			get_all(base_type_->id()).insert(this);
 			has_feet_ = type_->has_feet();
 			vars_.reset(new game_logic::formula_variable_storage(type_->variables())),
@@ -3437,8 +3661,8 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 			vars_->add(*old_vars);
 			tmp_vars_->add(*old_tmp_vars_);
 
-			vars_->disallow_new_keys(type_->is_strict());
-			tmp_vars_->disallow_new_keys(type_->is_strict());
+			vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+			tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 			//set the animation to the default animation for the new type.
 			set_frame(type_->default_frame().id());
@@ -3932,6 +4156,7 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 		} else {
 			type_ = base_type_->get_variation(current_variation_);
 		}
+		clear_property_caches();
 
 		calculate_solid_rect();
 		handle_event("set_variations");
@@ -4313,6 +4538,10 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 				get_property_data(e.storage_slot) = value;
 			}
 
+			if(!property_cache_.empty()) {
+				invalidate_property_caches(slot - type_->slot_properties_base());
+			}
+
 			if(!properties_requiring_dynamic_initialization_.empty()) {
 				std::vector<int>::iterator itor = std::find(properties_requiring_dynamic_initialization_.begin(), properties_requiring_dynamic_initialization_.end(), e.storage_slot);
 				if(itor != properties_requiring_dynamic_initialization_.end()) {
@@ -4495,6 +4724,58 @@ bool custom_object::is_active(const rect& screen_area) const
 	return false;
 }
 
+bool custom_object::get_index_area(rect* area) const
+{
+	//objects whose activation doesn't just depend on where they are, or
+	//which must be checked every cycle to see if they die.
+	if(always_active() || dies_on_inactive() ||
+	   type_->goes_inactive_only_when_standing() || use_absolute_screen_coordinates_) {
+		return false;
+	}
+
+	if(parallax_scale_millis_.get() != NULL && (parallax_scale_millis_->first != 1000 || parallax_scale_millis_->second != 1000)) {
+		return false;
+	}
+
+	//the union of every area is_active() checks against the screen.
+	const rect& frame_area = frame_rect();
+	rect result = frame_area;
+	if(activation_border_ > 0) {
+		result = rect(frame_area.x() - activation_border_, frame_area.y() - activation_border_, frame_area.w() + activation_border_*2, frame_area.h() + activation_border_*2);
+	}
+
+	if(draw_area_) {
+		result = rect_union(result, rect(frame_area.x(), frame_area.y(), draw_area_->w()*2, draw_area_->h()*2));
+	}
+
+	if(text_) {
+		result = rect_union(result, rect(x(), y(), text_->dimensions.w(), text_->dimensions.h()));
+	}
+
+	if(activation_area_) {
+		result = rect_union(result, *activation_area_);
+	}
+
+	const point mid = midpoint();
+	*area = rect_union(result, rect(mid.x, mid.y, 1, 1));
+	return true;
+}
+
+bool custom_object::get_solid_index_area(rect* area) const
+{
+	entity::get_solid_index_area(area);
+
+	//platform_rect_at() moves the platform up or down by its offsets.
+	const rect& platform = platform_rect();
+	if(!platform_offsets_.empty() && !platform.empty()) {
+		const int min_offset = std::min(0, *std::min_element(platform_offsets_.begin(), platform_offsets_.end()));
+		const int max_offset = std::max(0, *std::max_element(platform_offsets_.begin(), platform_offsets_.end()));
+		*area = rect_union(*area, rect(platform.x(), platform.y() + min_offset, platform.w(), platform.h() + max_offset - min_offset));
+	}
+
+	return true;
+}
+
 bool custom_object::move_to_standing(level& lvl, int max_displace)
 {
 	int start_y = y();
@@ -4780,41 +5061,81 @@ void custom_object::resolve_delayed_events()
 	delayed_commands_.clear();
 }
 
-bool custom_object::execute_command(const variant& var)
+namespace {
+typedef std::vector<const game_logic::formula_callable*> command_buffer;
+
+//buffers which nested lists of commands are flattened into. Running a
+//command may fire events which execute more commands, so each level of
+//nesting gets its own buffer. A deque is used so that adding a level
+//doesn't move the buffers of the levels below it.
+std::deque<command_buffer> command_buffers;
+int command_buffer_depth = 0;
+
+struct command_buffer_scope {
+	command_buffer_scope() : buffer(NULL) {
+		if(command_buffer_depth == static_cast<int>(command_buffers.size())) {
+			command_buffers.push_back(command_buffer());
+		}
+
+		buffer = &command_buffers[command_buffer_depth++];
+		buffer->clear();
+	}
+
+	~command_buffer_scope() {
+		--command_buffer_depth;
+	}
+
+	command_buffer* buffer;
+};
+
+void flatten_commands(const variant& var, command_buffer& buffer)
 {
-	bool result = true;
-	if(var.is_null()) { return result; }
 	if(var.is_list()) {
 		const int num_elements = var.num_elements();
 		for(int n = 0; n != num_elements; ++n) {
-			result = execute_command(var[n]) && result;
+			flatten_commands(var[n], buffer);
 		}
+	} else if(var.is_callable() && var.as_callable()->command_type() != game_logic::formula_callable::NOT_COMMAND) {
+		buffer.push_back(var.as_callable());
 	} else {
-		game_logic::command_callable* cmd = var.try_convert<game_logic::command_callable>();
-		if(cmd != NULL) {
-			cmd->run_command(*this);
-		} else {
-			custom_object_command_callable* cmd = var.try_convert<custom_object_command_callable>();
-			if(cmd != NULL) {
-				cmd->run_command(level::current(), *this);
-			} else {
-				entity_command_callable* cmd = var.try_convert<entity_command_callable>();
-				if(cmd != NULL) {
-					cmd->run_command(level::current(), *this);
-				} else {
-					swallow_object_command_callable* cmd = var.try_convert<swallow_object_command_callable>();
-					if(cmd) {
-						result = false;
-					} else {
-						swallow_mouse_command_callable* cmd = var.try_convert<swallow_mouse_command_callable>();
-						if(cmd) {
-							swallow_mouse_event_ = true;
-						} else {
-							ASSERT_LOG(false, "COMMAND WAS EXPECTED, BUT FOUND: " << var.to_debug_string() << "\nFORMULA INFO: " << output_formula_error_info() << "\n");
-						}
-					}
-				}
-			}
+		ASSERT_LOG(var.is_null(), "COMMAND WAS EXPECTED, BUT FOUND: " << var.to_debug_string() << "\nFORMULA INFO: " << output_formula_error_info() << "\n");
+	}
+}
+}
+
+bool custom_object::execute_command(const variant& var)
+{
+	bool result = true;
+	if(var.is_null()) { return result; }
+
+	//keeps the commands alive while they run. Lists can't be modified, so
+	//the pointers in the buffer stay valid.
+	const variant holder = var;
+
+	const command_buffer_scope scope;
+	command_buffer& buffer = *scope.buffer;
+	flatten_commands(holder, buffer);
+
+	for(command_buffer::const_iterator i = buffer.begin(); i != buffer.end(); ++i) {
+		const game_logic::formula_callable* cmd = *i;
+		switch(cmd->command_type()) {
+		case game_logic::formula_callable::FORMULA_COMMAND:
+			static_cast<const game_logic::command_callable*>(cmd)->run_command(*this);
+			break;
+		case game_logic::formula_callable::CUSTOM_OBJECT_COMMAND:
+			static_cast<const custom_object_command_callable*>(cmd)->run_command(level::current(), *this);
+			break;
+		case game_logic::formula_callable::ENTITY_COMMAND:
+			static_cast<const entity_command_callable*>(cmd)->run_command(level::current(), *this);
+			break;
+		case game_logic::formula_callable::SWALLOW_OBJECT_COMMAND:
+			result = false;
+			break;
+		case game_logic::formula_callable::SWALLOW_MOUSE_COMMAND:
+			swallow_mouse_event_ = true;
+			break;
+		default:
+			ASSERT_LOG(false, "UNKNOWN COMMAND TYPE: " << cmd->command_type());
 		}
 	}
 
@@ -5014,6 +5335,10 @@ void custom_object::extract_gc_object_references(std::vector<gc_object_reference
 		extract_gc_object_references(var, v);
 	}
 
+	//cached values are recalculated rather than having their references
+	//tracked.
+	clear_property_caches();
+
 	gc_object_reference visitor;
 	visitor.owner = this;
 	visitor.target = NULL;
@@ -5106,6 +5431,7 @@ void custom_object::set_text(const std::string& text, const std::string& font, i
 	text_->alpha = 255;
 	ASSERT_LOG(text_->font, "UNKNOWN FONT: " << font);
 	text_->dimensions = text_->font->dimensions(text_->text, size);
+	index_area_changed();
 }
 
 bool custom_object::boardable_vehicle() const
@@ -5353,6 +5679,7 @@ void custom_object::update_type(const_custom_object_type_ptr old_type,
 	} else {
 		type_ = base_type_->get_variation(current_variation_);
 	}
+	clear_property_caches();
 
 	game_logic::formula_variable_storage_ptr old_vars = vars_;
 
@@ -5380,8 +5707,8 @@ void custom_object::update_type(const_custom_object_type_ptr old_type,
 		}
 	}
 
-	vars_->disallow_new_keys(type_->is_strict());
-	tmp_vars_->disallow_new_keys(type_->is_strict());
+	vars_->disallow_new_keys(type_->is_strict(), type_->variables_hash());
+	tmp_vars_->disallow_new_keys(type_->is_strict(), type_->tmp_variables_hash());
 
 	frame_.reset(&type_->get_frame(frame_name_));
 
@@ -5508,6 +5835,45 @@ void custom_object::add_to_level()
 #endif
 }
 
+UNIT_TEST(custom_object_cached_properties) {
+	custom_object* obj = new custom_object("cached_property_test", 0, 0, true);
+	variant obj_ref(obj);
+	CHECK_EQ(obj->query_value("quadrupled"), variant(4));
+	CHECK_EQ(obj->query_value("doubled"), variant(2));
+
+	//writing a property invalidates properties which read it, and those
+	//which read them.
+	obj->mutate_value("base", variant(5));
+	CHECK_EQ(obj->query_value("quadrupled"), variant(20));
+	CHECK_EQ(obj->query_value("doubled"), variant(10));
+
+	CHECK_EQ(obj->query_value("from_vars"), variant(1));
+	CHECK_EQ(obj->query_value("from_tmp"), variant(1));
+	obj->query_value("vars").mutable_callable()->mutate_value("amount", variant(4));
+	CHECK_EQ(obj->query_value("from_vars"), variant(5));
+	CHECK_EQ(obj->query_value("from_tmp"), variant(1));
+	obj->query_value("tmp").mutable_callable()->mutate_value("amount", variant(6));
+	CHECK_EQ(obj->query_value("from_tmp"), variant(7));
+
+	//other objects can be moved without this one knowing.
+	custom_object* other = new custom_object("cached_property_test", 30, 0, true);
+	variant other_ref(other);
+	obj->mutate_value("target", other_ref);
+	CHECK_EQ(obj->query_value("target_x"), variant(30));
+	other->set_pos(40, 0);
+	CHECK_EQ(obj->query_value("target_x"), variant(40));
+
+	std::vector<variant> targets(1, other_ref);
+	obj->mutate_value("targets", variant(&targets));
+	CHECK_EQ(obj->query_value("targets_x")[0], variant(40));
+	other->set_pos(50, 0);
+	CHECK_EQ(obj->query_value("targets_x")[0], variant(50));
+
+	//cached values belong to the type they were calculated with.
+	obj->mutate_value("type", variant("cached_property_test_alt"));
+	CHECK_EQ(obj->query_value("doubled"), variant(obj->query_value("base").as_int()*3));
+}
+
 BENCHMARK(custom_object_spike) {
 	static level* lvl = NULL;
 	if(!lvl) {	
@@ -5525,6 +5891,8 @@ BENCHMARK(custom_object_spike) {
 
 int custom_object::events_handled_per_second = 0;
 
+custom_object::property_cache_recording* custom_object::property_cache_recording_ = NULL;
+
 BENCHMARK_ARG(custom_object_get_attr, const std::string& attr)
 {
 	static custom_object* obj = new custom_object("ant_black", 0, 0, false);
@@ -5535,6 +5903,20 @@ BENCHMARK_ARG(custom_object_get_attr, const std::string& attr)
 
 BENCHMARK_ARG_CALL(custom_object_get_attr, easy_lookup, "x");
 BENCHMARK_ARG_CALL(custom_object_get_attr, hard_lookup, "xxxx");
+BENCHMARK_ARG_CALL(custom_object_get_attr, late_builtin_lookup, "ctrl_tongue");
+BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_get_attr);
+
+BENCHMARK_ARG(custom_object_set_attr, const std::string& attr)
+{
+	static custom_object* obj = new custom_object("ant_black", 0, 0, false);
+	const variant value = obj->query_value(attr);
+	BENCHMARK_LOOP {
+		obj->mutate_value(attr, value);
+	}
+}
+
+BENCHMARK_ARG_CALL(custom_object_set_attr, set_builtin, "x");
+BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_set_attr);
 
 BENCHMARK_ARG(custom_object_handle_event, const std::string& object_event)
 {
@@ -138,6 +138,8 @@ public:
 	virtual bool is_active(const rect& screen_area) const;
 	bool dies_on_inactive() const;
 	bool always_active() const;
+	virtual bool get_index_area(rect* area) const;
+	virtual bool get_solid_index_area(rect* area) const;
 	bool move_to_standing(level& lvl, int max_displace=10000);
 
 	bool body_harmful() const;
@@ -265,7 +267,15 @@ protected:
 	virtual void control(const level& lvl);
 	variant get_value(const std::string& key) const;
 	variant get_value_by_slot(int slot) const;
+	const game_logic::formula_callable_definition* get_slot_definition() const;
 	void set_value(const std::string& key, const variant& value);
+
+	//the definition of the object's type, giving the slots used by
+	//get_value_by_slot().
+	const game_logic::formula_callable_definition* type_slot_definition() const;
+
+	//called when a value is read which cached properties can't track.
+	void note_uncacheable_read() const;
 	void set_value_by_slot(int slot, const variant& value);
 
 	//function which indicates if the object wants to walk up or down stairs.
@@ -371,6 +381,56 @@ private:
 	std::vector<variant> property_data_;
 	mutable int active_property_;
 
+	//values of properties declared as cached. Each remembers what it read
+	//from this object while being calculated: the properties it read, and
+	//whether it read vars or tmp. It stays valid until one of those is
+	//written. Reading any other built-in value, another object, or a
+	//property holding an object makes a result uncacheable, since writes
+	//to other objects aren't tracked.
+	struct property_cache_entry {
+		property_cache_entry() : valid(false), reads_vars(false), reads_tmp_vars(false), vars_version(0), tmp_vars_version(0) {}
+		variant value;
+		bool valid, reads_vars, reads_tmp_vars;
+		unsigned int vars_version, tmp_vars_version;
+	};
+
+	//what a cached property of owner read while it was being calculated.
+	//while in scope, it's made the current recording.
+	struct property_cache_recording {
+		property_cache_recording(const custom_object* owner, property_cache_recording*& current) : owner(owner), parent(current), cacheable(true), reads_vars(false), reads_tmp_vars(false), current_(current) {
+			current_ = this;
+		}
+
+		~property_cache_recording() {
+			current_ = parent;
+		}
+
+		const custom_object* owner;
+		property_cache_recording* parent;
+		std::vector<int> reads;
+		bool cacheable, reads_vars, reads_tmp_vars;
+	private:
+		property_cache_recording*& current_;
+	};
+
+	variant get_cached_property(const custom_object_type::property_entry& e) const;
+	void note_slot_read(int slot) const;
+	void invalidate_property_caches(int property_index);
+	void invalidate_cached_property(int cache_slot);
+
+	//drops all cached values, which must be done whenever type_ changes
+	//since the cache slots belong to the type.
+	void clear_property_caches();
+
+	mutable std::vector<property_cache_entry> property_cache_;
+
+	//for each property, the cache slots of cached properties which read it.
+	mutable std::vector<std::vector<int> > property_cache_dependents_;
+
+	//the recording for the cached property currently being calculated,
+	//shared by all objects so reads of other objects are seen.
+	static property_cache_recording* property_cache_recording_;
+
 	//a stack of items that serve as the 'value' parameter, used in
 	//property setters.
 	mutable std::stack<variant> value_stack_;
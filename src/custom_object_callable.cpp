@@ -31,6 +31,24 @@ std::map<std::string, int>& keys_to_slots() {
 	return instance;
 }
 
+//the same contents as keys_to_slots(), for fast lookups.
+perfect_hash& builtin_key_hash() {
+	static perfect_hash instance;
+	return instance;
+}
+
+void build_key_hash(const std::map<std::string, int>& m, perfect_hash* hash)
+{
+	std::vector<std::string> keys;
+	std::vector<int> slots;
+	for(std::map<std::string, int>::const_iterator i = m.begin(); i != m.end(); ++i) {
+		keys.push_back(i->first);
+		slots.push_back(i->second);
+	}
+
+	hash->build(keys, slots);
+}
+
 const custom_object_callable* instance_ptr = NULL;
 
 }
@@ -274,6 +292,8 @@ custom_object_callable::custom_object_callable(bool is_singleton)
 			keys_to_slots()[global_entries()[n].id] = n;
 		}
 
+		build_key_hash(keys_to_slots(), &builtin_key_hash());
+
 		global_entries()[CUSTOM_OBJECT_ME].set_variant_type(variant_type::get_custom_object());
 		global_entries()[CUSTOM_OBJECT_SELF].set_variant_type(variant_type::get_custom_object());
 
@@ -295,6 +315,10 @@ void custom_object_callable::set_object_type(variant_type_ptr type)
 
 int custom_object_callable::get_key_slot(const std::string& key)
 {
+	if(builtin_key_hash().empty() == false) {
+		return builtin_key_hash().find(key);
+	}
+
 	std::map<std::string, int>::const_iterator itor = keys_to_slots().find(key);
 	if(itor == keys_to_slots().end()) {
 		return -1;
@@ -305,6 +329,10 @@ int custom_object_callable::get_key_slot(const std::string& key)
 
 int custom_object_callable::get_slot(const std::string& key) const
 {
+	if(key_hash_.empty() == false) {
+		return key_hash_.find(key);
+	}
+
 	std::map<std::string, int>::const_iterator itor = properties_.find(key);
 	if(itor == properties_.end()) {
 		return get_key_slot(key);
@@ -334,6 +362,7 @@ const game_logic::formula_callable_definition::entry* custom_object_callable::ge
 void custom_object_callable::add_property(const std::string& id, variant_type_ptr type, variant_type_ptr write_type, bool requires_initialization, bool is_private)
 {
 	if(properties_.count(id) == 0) {
+		key_hash_.clear();
 		properties_[id] = entries_.size();
 		entries_.push_back(entry(id));
 	}
@@ -358,6 +387,14 @@ void custom_object_callable::finalize_properties()
 	foreach(entry& e, entries_) {
 		e.set_variant_type(e.variant_type);
 	}
+
+	//properties take precedence over built-in values with the same name.
+	std::map<std::string, int> slots = keys_to_slots();
+	for(std::map<std::string, int>::const_iterator i = properties_.begin(); i != properties_.end(); ++i) {
+		slots[i->first] = i->second;
+	}
+
+	build_key_hash(slots, &key_hash_);
 }
 
 void custom_object_callable::push_private_access()
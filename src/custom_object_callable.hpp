@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "formula_callable_definition.hpp"
+#include "perfect_hash.hpp"
 
 enum CUSTOM_OBJECT_PROPERTY {
 	CUSTOM_OBJECT_VALUE,
@@ -210,6 +211,9 @@ private:
 
 	std::map<std::string, int> properties_;
 
+	//all our keys, built once the properties are finalized.
+	perfect_hash key_hash_;
+
 	std::vector<int> slots_requiring_initialization_;
 };
 
@@ -3271,8 +3271,15 @@ function_symbol_table& get_custom_object_functions_symbol_table()
 	return table;
 }
 
+namespace {
+//memoized functions keep this many results unless they give a number.
+const int DefaultMemoEntries = 1024;
+}
+
 void init_custom_object_functions(variant node)
 {
+	game_logic::clear_memo_caches();
+
 	foreach(variant fn, node.as_list()) {
 		const std::string& name = fn["name"].as_string();
 		std::vector<std::string> args = util::split(fn["args"].as_string());
@@ -3289,9 +3296,21 @@ void init_custom_object_functions(variant node)
 		std::vector<variant> default_args;
 		std::vector<variant_type_ptr> variant_types;
 		recursive_function_symbol_table recursive_symbols(name, args, default_args, &get_custom_object_functions_symbol_table(), NULL, variant_types);
+
+		const variant memoize = fn["memoize"];
+		variant memo_cache;
+		if(memoize.is_int() || (memoize.is_bool() && memoize.as_bool())) {
+			memo_cache = game_logic::create_memo_cache(memoize.is_int() ? memoize.as_int() : DefaultMemoEntries);
+			recursive_symbols.set_memo_cache(memo_cache);
+		}
+
 		const_formula_ptr fml(new formula(fn["formula"], &recursive_symbols, args_definition.get()));
 		get_custom_object_functions_symbol_table().add_formula_function(
 		    name, fml, const_formula_ptr(), args, default_args, variant_types);
+		if(memo_cache.is_callable()) {
+			get_custom_object_functions_symbol_table().set_memo_cache(name, memo_cache);
+		}
+
 		recursive_symbols.resolve_recursive_calls(fml);
 		std::vector<std::string> names = get_custom_object_functions_symbol_table().get_function_names();
 		assert(std::count(names.begin(), names.end(), fn["name"].as_string()));
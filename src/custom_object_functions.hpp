@@ -38,7 +38,7 @@ void init_custom_object_functions(variant node);
 
 class entity_command_callable : public game_logic::formula_callable {
 public:
-	entity_command_callable() : expr_(NULL) {}
+	entity_command_callable() : expr_(NULL) { set_command_type(ENTITY_COMMAND); }
 	void run_command(level& lvl, entity& obj) const;
 
 	void set_expression(const game_logic::formula_expression* expr);
@@ -58,7 +58,7 @@ private:
 
 class custom_object_command_callable : public game_logic::formula_callable {
 public:
-	custom_object_command_callable() : expr_(NULL) {}
+	custom_object_command_callable() : expr_(NULL) { set_command_type(CUSTOM_OBJECT_COMMAND); }
 	void run_command(level& lvl, custom_object& ob) const;
 
 	void set_expression(const game_logic::formula_expression* expr);
@@ -78,6 +78,7 @@ private:
 
 class swallow_object_command_callable : public game_logic::formula_callable {
 public:
+	swallow_object_command_callable() { set_command_type(SWALLOW_OBJECT_COMMAND); }
 	bool is_command() const { return true; }
 private:
 	variant get_value(const std::string& key) const { return variant(); }
@@ -86,6 +87,7 @@ private:
 
 class swallow_mouse_command_callable : public game_logic::formula_callable {
 public:
+	swallow_mouse_command_callable() { set_command_type(SWALLOW_MOUSE_COMMAND); }
 	bool is_command() const { return true; }
 private:
 	variant get_value(const std::string& key) const { return variant(); }
@@ -28,6 +28,7 @@
 #include "filesystem.hpp"
 #include "formula.hpp"
 #include "formula_constants.hpp"
+#include "formula_variable_storage.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
 #include "load_level.hpp"
@@ -1020,6 +1021,11 @@ custom_object_type::custom_object_type(const std::string& id, variant node, cons
 
 	//std::cerr << "TMP_VARIABLES: '" << id_ << "' -> " << tmp_variables_.size() << "\n";
 
+	if(is_strict_) {
+		variables_hash_ = game_logic::formula_variable_storage::create_key_hash(variables_);
+		tmp_variables_hash_ = game_logic::formula_variable_storage::create_key_hash(tmp_variables_);
+	}
+
 	consts_.reset(new game_logic::map_formula_callable);
 	variant consts = node["consts"];
 	if(consts.is_null() == false) {
@@ -1339,6 +1345,18 @@ custom_object_type::custom_object_type(const std::string& id, variant node, cons
 				property_to_slot[k] = nslot;
 			}
 
+			//cached properties keep their value until something they read
+			//is written. A redefinition keeps the slot it was given before.
+			if(value.is_map() && value["cached"].as_bool(false) && entry.getter) {
+				if(entry.cache_slot == -1) {
+					entry.cache_slot = cached_properties_.size();
+					cached_properties_.push_back(nslot);
+				}
+			} else {
+				ASSERT_LOG(!value.is_map() || !value["cached"].as_bool(false) || entry.const_value, "Property " << id_ << "." << k << " is cached but has no getter");
+				entry.cache_slot = -1;
+			}
+
 			if(entry.init) {
 				properties_with_init_.push_back(nslot);
 			}
@@ -1421,6 +1439,17 @@ custom_object_type::custom_object_type(const std::string& id, variant node, cons
 		blend_mode_->sfactor = get_blend_mode(node["blend_mode_source"]);
 		blend_mode_->dfactor = get_blend_mode(node["blend_mode_dest"]);
 	}
+
+	std::vector<std::string> property_names;
+	std::vector<int> property_indexes;
+	for(std::map<std::string, property_entry>::const_iterator i = properties_.begin(); i != properties_.end(); ++i) {
+		property_names.push_back(i->first);
+		property_indexes.push_back(property_hash_entries_.size());
+		property_hash_entries_.push_back(&i->second);
+	}
+
+	property_hash_.build(property_names, property_indexes);
+
 	std::cerr << "DONE CREATE OBJ: " << id << "\n";
 }
 
@@ -30,6 +30,7 @@
 #include "formula_function.hpp"
 #include "frame.hpp"
 #include "particle_system.hpp"
+#include "perfect_hash.hpp"
 #include "raster.hpp"
 #include "solid_map_fwd.hpp"
 #include "variant.hpp"
@@ -188,27 +189,46 @@ public:
 
 	const std::map<std::string, variant>& variables() const { return variables_; }
 	const std::map<std::string, variant>& tmp_variables() const { return tmp_variables_; }
+
+	//perfect hashes of the keys of variables() and tmp_variables(), shared
+	//by the variable storage of strict objects of this type.
+	const boost::shared_ptr<const perfect_hash>& variables_hash() const { return variables_hash_; }
+	const boost::shared_ptr<const perfect_hash>& tmp_variables_hash() const { return tmp_variables_hash_; }
 	game_logic::const_map_formula_callable_ptr consts() const { return consts_; }
 	const std::map<std::string, variant>& tags() const { return tags_; }
 
 	struct property_entry {
-		property_entry() : storage_slot(-1), persistent(true), requires_initialization(false) {}
+		property_entry() : storage_slot(-1), cache_slot(-1), persistent(true), requires_initialization(false) {}
 		std::string id;
 		game_logic::const_formula_ptr getter, setter, init;
 		boost::shared_ptr<variant> const_value;
 		variant default_value;
 		variant_type_ptr type, set_type;
 		int storage_slot;
+
+		//for properties declared with 'cached: true', the slot in each
+		//object's property cache, otherwise -1.
+		int cache_slot;
 		bool persistent;
 		bool requires_initialization;
 	};
 
 	const std::map<std::string, property_entry>& properties() const { return properties_; }
+
+	//finds a property by name, returning NULL if there is no such property.
+	const property_entry* find_property(const std::string& key) const {
+		const int index = property_hash_.find(key);
+		return index == -1 ? NULL : property_hash_entries_[index];
+	}
+
 	const std::vector<property_entry>& slot_properties() const { return slot_properties_; }
 	const std::vector<int>& properties_with_init() const { return properties_with_init_; }
 	const std::vector<int>& properties_requiring_initialization() const { return properties_requiring_initialization_; }
 	const std::vector<int>& properties_requiring_dynamic_initialization() const { return properties_requiring_dynamic_initialization_; }
 
+	//the index in slot_properties() of the property using each cache slot.
+	const std::vector<int>& cached_properties() const { return cached_properties_; }
+
 	//this is the last required initialization property that should be
 	//initialized. It's the only such property that has a custom setter.
 	const std::string& last_initialization_property() const { return last_initialization_property_; }
@@ -337,12 +357,19 @@ private:
 	bool adjust_feet_on_animation_change_;
 
 	std::map<std::string, variant> variables_, tmp_variables_;
+	boost::shared_ptr<const perfect_hash> variables_hash_, tmp_variables_hash_;
 	game_logic::map_formula_callable_ptr consts_;
 	std::map<std::string, variant> tags_;
 
 	std::map<std::string, property_entry> properties_;
 	std::vector<property_entry> slot_properties_;
+
+	//a perfect hash over the names in properties_, built once they're all
+	//known, giving indexes into property_hash_entries_.
+	perfect_hash property_hash_;
+	std::vector<const property_entry*> property_hash_entries_;
 	std::vector<int> properties_with_init_, properties_requiring_initialization_, properties_requiring_dynamic_initialization_;
+	std::vector<int> cached_properties_;
 	std::string last_initialization_property_;
 	int slot_properties_base_;
 
@@ -573,6 +573,8 @@ variant performance_data::get_value(const std::string& key) const
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(allocations);
+	PERF_ATTR(heap_allocations);
 #undef PERF_ATTR
 
 	return variant();
@@ -589,6 +591,8 @@ void performance_data::get_inputs(std::vector<game_logic::formula_input>* inputs
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(allocations);
+	PERF_ATTR(heap_allocations);
 #undef PERF_ATTR
 }
 
@@ -613,7 +617,7 @@ void draw_fps(const level& lvl, const performance_data& data)
 		return;
 	}
 	std::ostringstream s;
-	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events";
+	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events; " << data.allocations << "/" << data.heap_allocations << " allocs/heap";
 
 	rect area = font->draw(10, 60, s.str());
 
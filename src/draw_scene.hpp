@@ -83,12 +83,18 @@ struct performance_data : public game_logic::formula_callable {
 	int cycle;
 	int nevents;
 
+	//objects created through formula_pool in the last frame, and how many
+	//of those needed a heap allocation.
+	int allocations;
+	int heap_allocations;
+
 	std::string profiling_info;
 
 	performance_data(int fps_, int cycles_per_second_, int delay_, int draw_, int process_, int flip_, int cycle_, int nevents_, const std::string& profiling_info_)
 	  : fps(fps_), cycles_per_second(cycles_per_second_), delay(delay_),
 	    draw(draw_), process(process_), flip(flip_), cycle(cycle_),
-		nevents(nevents_), profiling_info(profiling_info_)
+		nevents(nevents_), allocations(0), heap_allocations(0),
+		profiling_info(profiling_info_)
 	{}
 
 	variant get_value(const std::string& key) const;
@@ -14,6 +14,7 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <iostream>
 #include <limits.h>
 
@@ -170,6 +171,34 @@ void entity::set_upside_down(bool facing)
 	upside_down_ = facing;
 }
 
+entity::~entity()
+{
+	foreach(const entity_spatial_index_record& record, spatial_index_records_) {
+		if(record.index) {
+			record.index->erase(this);
+		}
+	}
+}
+
+void entity::index_area_changed()
+{
+	foreach(const entity_spatial_index_record& record, spatial_index_records_) {
+		if(record.index) {
+			record.index->mark_dirty(this);
+		}
+	}
+}
+
+bool entity::get_solid_index_area(rect* area) const
+{
+	//collision tests treat even an empty solid rect as being at its
+	//position, so it's always given some area.
+	const rect& solid = solid_rect();
+	*area = rect(solid.x(), solid.y(), std::max(solid.w(), 1), std::max(solid.h(), 1));
+	*area = rect_union(*area, platform_rect());
+	return true;
+}
+
 void entity::calculate_solid_rect()
 {
 	const frame& f = current_frame();
@@ -206,6 +235,8 @@ void entity::calculate_solid_rect()
 	} else {
 		platform_rect_ = rect();
 	}
+
+	index_area_changed();
 }
 
 rect entity::body_rect() const
@@ -25,6 +25,7 @@
 #include "current_generator.hpp"
 #include "editor_variable_info.hpp"
 #include "entity_fwd.hpp"
+#include "entity_spatial_index.hpp"
 #include "formula_callable.hpp"
 #include "formula_callable_definition_fwd.hpp"
 #include "formula_fwd.hpp"
@@ -48,7 +49,7 @@ public:
 	static entity_ptr build(variant node);
 	explicit entity(variant node);
 	entity(int x, int y, bool face_right);
-	virtual ~entity() {}
+	virtual ~entity();
 
 	virtual void validate_properties() {}
 	virtual void add_to_level();
@@ -163,6 +164,15 @@ public:
 	virtual bool is_active(const rect& screen_area) const = 0;
 	virtual bool dies_on_inactive() const { return false; } 
 	virtual bool always_active() const { return false; } 
+
+	//gives an area the entity is in, for level spatial indexes. It must
+	//contain the frame and midpoint, and any area where is_active() may be
+	//true. Returns false if there is no such area.
+	virtual bool get_index_area(rect* area) const { return false; }
+
+	//gives an area containing everything collisions with the entity's
+	//solid and platform areas test, for the level's solid index.
+	virtual bool get_solid_index_area(rect* area) const;
 	
 	virtual formula_callable* vars() { return NULL; }
 	virtual const formula_callable* vars() const { return NULL; }
@@ -316,6 +326,9 @@ protected:
 	virtual const_solid_info_ptr calculate_platform() const = 0;
 	void calculate_solid_rect();
 
+	//tells any spatial index the entity is in that its area may change.
+	void index_area_changed();
+
 	bool control_status(controls::CONTROL_ITEM ctrl) const { return controls_[ctrl]; }
 	void read_controls(int cycle);
 
@@ -391,6 +404,9 @@ private:
 
 	bool true_z_;
 	double tx_, ty_, tz_;
+
+	friend class entity_spatial_index;
+	entity_spatial_index_record spatial_index_records_[entity_spatial_index::NUM_AREA_TYPES];
 };
 
 bool zorder_compare(const entity_ptr& e1, const entity_ptr& e2);	
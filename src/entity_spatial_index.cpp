@@ -0,0 +1,232 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "entity.hpp"
+#include "entity_spatial_index.hpp"
+#include "foreach.hpp"
+
+namespace {
+const int CellSize = 512;
+
+//entities covering more cells than this aren't worth putting in cells.
+const int MaxCellsPerEntity = 64;
+
+int cell_coord(int n)
+{
+	return n >= 0 ? n/CellSize : -((-n - 1)/CellSize) - 1;
+}
+
+bool areas_overlap(const rect& a, const rect& b)
+{
+	//inclusive of the edges, so the index never misses an entity which
+	//a test with a different idea of the edges would accept.
+	return a.x() <= b.x2() && b.x() <= a.x2() && a.y() <= b.y2() && b.y() <= a.y2();
+}
+}
+
+entity_spatial_index::entity_spatial_index(AREA_TYPE type) : next_seq_(0), type_(type)
+{}
+
+entity_spatial_index::entity_spatial_index(const entity_spatial_index& o) : next_seq_(0), type_(o.type_)
+{}
+
+entity_spatial_index& entity_spatial_index::operator=(const entity_spatial_index& o)
+{
+	if(&o != this) {
+		clear();
+		type_ = o.type_;
+	}
+
+	return *this;
+}
+
+entity_spatial_index::~entity_spatial_index()
+{
+	clear();
+}
+
+void entity_spatial_index::insert(entity* e)
+{
+	entity_spatial_index_record& record = this->record(e);
+	if(record.index == this) {
+		return;
+	} else if(record.index) {
+		record.index->erase(e);
+	}
+
+	record.index = this;
+	record.seq = next_seq_++;
+	record.slot = entities_.size();
+	record.dirty = false;
+	entities_.push_back(e);
+	add_to_cells(e);
+}
+
+void entity_spatial_index::erase(entity* e)
+{
+	entity_spatial_index_record& record = this->record(e);
+	if(record.index != this) {
+		return;
+	}
+
+	remove_from_cells(e);
+
+	if(record.dirty) {
+		dirty_.erase(std::remove(dirty_.begin(), dirty_.end(), e), dirty_.end());
+	}
+
+	entities_[record.slot] = entities_.back();
+	this->record(entities_[record.slot]).slot = record.slot;
+	entities_.pop_back();
+
+	record = entity_spatial_index_record();
+}
+
+void entity_spatial_index::clear()
+{
+	foreach(entity* e, entities_) {
+		record(e) = entity_spatial_index_record();
+	}
+
+	entities_.clear();
+	everywhere_.clear();
+	dirty_.clear();
+	cells_.clear();
+	next_seq_ = 0;
+}
+
+void entity_spatial_index::mark_dirty(entity* e)
+{
+	entity_spatial_index_record& record = this->record(e);
+	ASSERT_LOG(record.index == this, "Entity marked dirty in an index it isn't in");
+	if(!record.dirty) {
+		record.dirty = true;
+		dirty_.push_back(e);
+	}
+}
+
+void entity_spatial_index::query(const rect& area, std::vector<entity*>* result)
+{
+	update();
+
+	result->clear();
+	result->insert(result->end(), everywhere_.begin(), everywhere_.end());
+
+	const int x1 = cell_coord(area.x()), x2 = cell_coord(area.x2());
+	const int y1 = cell_coord(area.y()), y2 = cell_coord(area.y2());
+	for(int y = y1; y <= y2; ++y) {
+		for(int x = x1; x <= x2; ++x) {
+			boost::unordered_map<cell_key, std::vector<entity*> >::const_iterator itor = cells_.find(cell_key(x, y));
+			if(itor == cells_.end()) {
+				continue;
+			}
+
+			foreach(entity* e, itor->second) {
+				if(areas_overlap(record(e).area, area)) {
+					result->push_back(e);
+				}
+			}
+		}
+	}
+
+	//entities in several cells are found more than once.
+	std::sort(result->begin(), result->end(), seq_compare(*this));
+	result->erase(std::unique(result->begin(), result->end()), result->end());
+}
+
+void entity_spatial_index::add_to_cells(entity* e)
+{
+	entity_spatial_index_record& record = this->record(e);
+	record.everywhere = !get_area(e, &record.area);
+
+	if(!record.everywhere) {
+		const int x1 = cell_coord(record.area.x()), x2 = cell_coord(record.area.x2());
+		const int y1 = cell_coord(record.area.y()), y2 = cell_coord(record.area.y2());
+		record.everywhere = (x2 - x1 + 1)*(y2 - y1 + 1) > MaxCellsPerEntity;
+		if(!record.everywhere) {
+			for(int y = y1; y <= y2; ++y) {
+				for(int x = x1; x <= x2; ++x) {
+					cells_[cell_key(x, y)].push_back(e);
+				}
+			}
+
+			return;
+		}
+	}
+
+	everywhere_.push_back(e);
+}
+
+void entity_spatial_index::remove_from_cells(entity* e)
+{
+	const entity_spatial_index_record& record = this->record(e);
+	if(record.everywhere) {
+		everywhere_.erase(std::remove(everywhere_.begin(), everywhere_.end(), e), everywhere_.end());
+		return;
+	}
+
+	const int x1 = cell_coord(record.area.x()), x2 = cell_coord(record.area.x2());
+	const int y1 = cell_coord(record.area.y()), y2 = cell_coord(record.area.y2());
+	for(int y = y1; y <= y2; ++y) {
+		for(int x = x1; x <= x2; ++x) {
+			boost::unordered_map<cell_key, std::vector<entity*> >::iterator itor = cells_.find(cell_key(x, y));
+			ASSERT_LOG(itor != cells_.end(), "Entity missing from spatial index cell");
+
+			std::vector<entity*>& cell = itor->second;
+			std::vector<entity*>::iterator i = std::find(cell.begin(), cell.end(), e);
+			ASSERT_LOG(i != cell.end(), "Entity missing from spatial index cell");
+			*i = cell.back();
+			cell.pop_back();
+
+			if(cell.empty()) {
+				cells_.erase(itor);
+			}
+		}
+	}
+}
+
+void entity_spatial_index::update()
+{
+	foreach(entity* e, dirty_) {
+		remove_from_cells(e);
+		add_to_cells(e);
+		record(e).dirty = false;
+	}
+
+	dirty_.clear();
+}
+
+entity_spatial_index_record& entity_spatial_index::record(entity* e) const
+{
+	return e->spatial_index_records_[type_];
+}
+
+bool entity_spatial_index::get_area(const entity* e, rect* area) const
+{
+	if(type_ == SOLID_AREA) {
+		return e->get_solid_index_area(area);
+	}
+
+	return e->get_index_area(area);
+}
+
+bool entity_spatial_index::seq_compare::operator()(entity* a, entity* b) const
+{
+	return index->record(a).seq < index->record(b).seq;
+}
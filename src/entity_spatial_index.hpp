@@ -0,0 +1,111 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ENTITY_SPATIAL_INDEX_HPP_INCLUDED
+#define ENTITY_SPATIAL_INDEX_HPP_INCLUDED
+
+#include <boost/unordered_map.hpp>
+
+#include <utility>
+#include <vector>
+
+#include "geometry.hpp"
+
+class entity;
+class entity_spatial_index;
+
+//what an entity_spatial_index knows about an entity in it. It's kept in
+//the entity, and isn't copied when the entity is copied.
+struct entity_spatial_index_record {
+	entity_spatial_index_record() : index(NULL), seq(0), slot(-1), dirty(false), everywhere(false)
+	{}
+
+	entity_spatial_index_record(const entity_spatial_index_record&) : index(NULL), seq(0), slot(-1), dirty(false), everywhere(false)
+	{}
+
+	entity_spatial_index_record& operator=(const entity_spatial_index_record&) { return *this; }
+
+	entity_spatial_index* index;
+
+	//the area the entity was indexed under.
+	rect area;
+
+	//the order entities were added in, and where in the index's list of
+	//entities this one is.
+	unsigned int seq;
+	int slot;
+
+	//set when the entity changes in a way which may move its area.
+	bool dirty;
+
+	//set for entities which don't have an area, and are returned from
+	//every query.
+	bool everywhere;
+};
+
+//A uniform grid of the entities in a level, keyed on either
+//entity::get_index_area() or entity::get_solid_index_area(). Entities mark
+//themselves dirty when they move or change in a way which might change
+//their area, and are re-indexed before the next query.
+class entity_spatial_index
+{
+public:
+	//which of an entity's areas it's indexed under. An entity can be in
+	//one index of each type.
+	enum AREA_TYPE { ACTIVATION_AREA, SOLID_AREA, NUM_AREA_TYPES };
+
+	explicit entity_spatial_index(AREA_TYPE type=ACTIVATION_AREA);
+	~entity_spatial_index();
+
+	//entities can only be in one index of a type, so copies start out empty.
+	entity_spatial_index(const entity_spatial_index&);
+	entity_spatial_index& operator=(const entity_spatial_index&);
+
+	void insert(entity* e);
+	void erase(entity* e);
+	void clear();
+
+	int size() const { return entities_.size(); }
+
+	void mark_dirty(entity* e);
+
+	//finds the entities whose area overlaps the given area, along with all
+	//those without an area, in the order they were inserted.
+	void query(const rect& area, std::vector<entity*>* result);
+
+private:
+	void add_to_cells(entity* e);
+	void remove_from_cells(entity* e);
+	void update();
+
+	entity_spatial_index_record& record(entity* e) const;
+	bool get_area(const entity* e, rect* area) const;
+
+	struct seq_compare {
+		explicit seq_compare(const entity_spatial_index& index) : index(&index) {}
+		bool operator()(entity* a, entity* b) const;
+		const entity_spatial_index* index;
+	};
+
+	typedef std::pair<int, int> cell_key;
+	boost::unordered_map<cell_key, std::vector<entity*> > cells_;
+
+	std::vector<entity*> entities_, everywhere_, dirty_;
+	unsigned int next_seq_;
+	AREA_TYPE type_;
+};
+
+#endif
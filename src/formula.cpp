@@ -35,13 +35,16 @@
 #include "formula_function.hpp"
 #include "formula_interface.hpp"
 #include "formula_object.hpp"
+#include "formula_pool.hpp"
 #include "formula_tokenizer.hpp"
+#include "formula_vm.hpp"
 #include "i18n.hpp"
 #include "map_utils.hpp"
 #include "preferences.hpp"
 #include "random.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant_hash_map.hpp"
 #include "variant_type.hpp"
 #include "variant_utils.hpp"
 
@@ -132,6 +135,7 @@ namespace game_logic
 
 	command_callable::command_callable() : expr_(NULL)
 	{
+		set_command_type(FORMULA_COMMAND);
 	}
 
 	void command_callable::run_command(formula_callable& context) const
@@ -161,7 +165,7 @@ namespace game_logic
 	map_formula_callable::map_formula_callable(variant node)
 	  : formula_callable(false), fallback_(NULL)
 	{
-		foreach(const variant_pair& value, node.as_map()) {
+		foreach(const variant_hash_map::value_type& value, node.as_hash_map()) {
 			values_[value.first.as_string()] = value.second;
 		}
 	}
@@ -285,6 +289,21 @@ private:
 		return static_evaluate(variables);
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		//items are evaluated into consecutive registers.
+		const int first = builder.register_mark();
+		for(int n = 0; n != items_.size(); ++n) {
+			builder.allocate_register();
+		}
+
+		for(int n = 0; n != items_.size(); ++n) {
+			builder.lower(*items_[n], first + n);
+		}
+
+		builder.emit(formula_vm::OP_LIST, dst, first, items_.size());
+		return true;
+	}
+
 	std::vector<const_expression_ptr> get_children() const {
 		return std::vector<const_expression_ptr>(items_.begin(), items_.end());
 	}
@@ -300,6 +319,13 @@ public:
 		for(std::map<std::string,expression_ptr>::const_iterator i = generators.begin(); i != generators.end(); ++i) {
 			generator_names_.push_back(i->first);
 		}
+
+		//the body and filters run once per element, so they are worth
+		//compiling to bytecode.
+		expr_program_ = formula_vm::compile(expr_.get());
+		foreach(const expression_ptr& filter, filters_) {
+			filter_programs_.push_back(formula_vm::compile(filter.get()));
+		}
 	}
 	
 private:
@@ -308,19 +334,45 @@ private:
 	}
 
 	variant execute(const formula_callable& variables) const {
+		std::vector<variant> result;
+		list_element_collector collector(&result);
+		variant unused;
+		execute_list_elements(variables, collector, &unused);
+		return variant(&result);
+	}
+
+	//visits the body of the comprehension with the generator taking the
+	//value of each element, for comprehensions with a single generator.
+	class generator_visitor : public list_element_visitor {
+	public:
+		generator_visitor(const list_comprehension_expression& expr, const formula_callable& callable, variant* arg, list_element_visitor& next)
+		  : expr_(expr), callable_(callable), arg_(arg), next_(next)
+		{}
+
+		void visit(const variant& v) {
+			*arg_ = v;
+			expr_.visit_body(callable_, next_);
+		}
+	private:
+		const list_comprehension_expression& expr_;
+		const formula_callable& callable_;
+		variant* arg_;
+		list_element_visitor& next_;
+	};
+
+	bool execute_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
 		std::vector<int> nelements;
 		std::vector<variant> lists;
-		for(std::map<std::string, expression_ptr>::const_iterator i = generators_.begin(); i != generators_.end(); ++i) {
-			lists.push_back(i->second->evaluate(variables));
-			nelements.push_back(lists.back().num_elements());
-			if(nelements.back() == 0) {
-				std::vector<variant> items;
-				return variant(&items);
+		if(generators_.size() > 1) {
+			for(std::map<std::string, expression_ptr>::const_iterator i = generators_.begin(); i != generators_.end(); ++i) {
+				lists.push_back(i->second->evaluate(variables));
+				nelements.push_back(lists.back().num_elements());
+				if(nelements.back() == 0) {
+					return true;
+				}
 			}
 		}
 
-		std::vector<variant> result;
-
 		boost::intrusive_ptr<slot_formula_callable> callable(new slot_formula_callable);
 		callable->set_fallback(&variables);
 		callable->set_base_slot(base_slot_);
@@ -331,30 +383,49 @@ private:
 			args.push_back(&callable->back_direct_access());
 		}
 
+		if(generators_.size() == 1) {
+			//a single generator is consumed element by element, so it
+			//doesn't need to be built as a list.
+			generator_visitor generator(*this, *callable, args.front(), visitor);
+			variant items;
+			if(generators_.begin()->second->evaluate_list_elements(variables, generator, &items)) {
+				return true;
+			}
+
+			for(size_t n = 0; n != items.num_elements(); ++n) {
+				generator.visit(items[n]);
+			}
+
+			return true;
+		}
+
 		std::vector<int> indexes(lists.size());
 		for(;;) {
 			for(int n = 0; n != indexes.size(); ++n) {
 				*args[n] = lists[n][indexes[n]];
 			}
 
-			bool passes = true;
-			foreach(const expression_ptr& filter, filters_) {
-				if(filter->evaluate(*callable).as_bool() == false) {
-					passes = false;
-					break;
-				}
-			}
-
-			if(passes) {
-				result.push_back(expr_->evaluate(*callable));
-			}
+			visit_body(*callable, visitor);
 
 			if(!increment_vec(indexes, nelements)) {
 				break;
 			}
 		}
 		
-		return variant(&result);
+		return true;
+	}
+
+	//runs the filters and, if they pass, the body with the generators'
+	//current values.
+	void visit_body(const formula_callable& callable, list_element_visitor& visitor) const {
+		for(int n = 0; n != filters_.size(); ++n) {
+			const variant filter_result = filter_programs_[n] ? filter_programs_[n]->execute(callable) : filters_[n]->evaluate(callable);
+			if(filter_result.as_bool() == false) {
+				return;
+			}
+		}
+
+		visitor.visit(expr_program_ ? expr_program_->execute(callable) : expr_->evaluate(callable));
 	}
 
 	static bool increment_vec(std::vector<int>& v, const std::vector<int>& max_values) {
@@ -387,6 +458,9 @@ private:
 	std::vector<std::string> generator_names_;
 	std::vector<expression_ptr> filters_;
 	int base_slot_;
+
+	formula_vm::const_program_ptr expr_program_;
+	std::vector<formula_vm::const_program_ptr> filter_programs_;
 };
 
 class map_expression : public formula_expression {
@@ -467,6 +541,10 @@ private:
 		std::map<variant,variant> res;
 		for(std::vector<expression_ptr>::const_iterator i = items_.begin(); ( i != items_.end() ) && ( i+1 != items_.end() ) ; i+=2) {
 			variant key = (*i)->evaluate(variables);
+			if(key.is_string() && !key.is_interned_string()) {
+				key = variant::create_interned_string(key.as_string());
+			}
+
 			variant value = (*(i+1))->evaluate(variables);
 			res[ key ] = value;
 		}
@@ -522,6 +600,12 @@ private:
 		}
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		const int operand = builder.lower_operand(*operand_);
+		builder.emit(op_ == NOT ? formula_vm::OP_NOT : formula_vm::OP_NEG, dst, operand);
+		return true;
+	}
+
 	std::vector<const_expression_ptr> get_children() const {
 		std::vector<const_expression_ptr> result;
 		result.push_back(operand_);
@@ -583,6 +667,11 @@ private:
 		return v_;
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.emit(formula_vm::OP_MOVE, dst, builder.add_constant(v_));
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(v_.type());
 	}
@@ -631,6 +720,11 @@ private:
 		return variables.query_value_by_slot(slot_);
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.emit(formula_vm::OP_LOAD_SLOT, dst, slot_);
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return callable_def_->get_entry(slot_)->variant_type;
 	}
@@ -802,11 +896,13 @@ public:
 				t = variant_type::get_any();
 			}
 		}
+
+		return_type_proven_ = g_strict_formula_checking && variant_types_proven_match(return_type_, fml_->query_variant_type());
 	}
 	
 private:
 	variant execute(const formula_callable& variables) const {
-		variant v(fml_, args_, variables, base_slot_, default_args_, variant_types_, return_type_);
+		variant v(fml_, args_, variables, base_slot_, default_args_, variant_types_, return_type_, return_type_proven_);
 		return v;
 	}
 
@@ -826,6 +922,7 @@ private:
 	std::vector<variant> default_args_;
 	std::vector<variant_type_ptr> variant_types_;
 	variant_type_ptr return_type_;
+	bool return_type_proven_;
 };
 
 class function_call_expression : public formula_expression {
@@ -848,6 +945,13 @@ public:
 				}
 
 				interfaces_.push_back(interface_factory);
+
+				//under strict checking, arguments whose static type proves
+				//they match don't need checking again on every call.
+				if(g_strict_formula_checking && !interface_factory && variant_types_proven_match(arg_types[n], args[n]->query_variant_type())) {
+					proven_arg_types_.resize(n+1);
+					proven_arg_types_[n] = arg_types[n];
+				}
 			}
 		}
 	}
@@ -874,6 +978,10 @@ private:
 			}
 		}
 		
+		if(proven_arg_types_.empty() == false) {
+			return left.call_with_proven_types(args, proven_arg_types_);
+		}
+
 		return left(args);
 	}
 
@@ -927,13 +1035,20 @@ private:
 	expression_ptr left_;
 	std::vector<expression_ptr> args_;
 	std::vector<boost::intrusive_ptr<formula_interface_instance_factory> > interfaces_;
+	std::vector<variant_type_ptr> proven_arg_types_;
 };
 
 class dot_expression : public formula_expression {
 public:
 	dot_expression(expression_ptr left, expression_ptr right, const_formula_callable_definition_ptr right_def)
-	: formula_expression("_dot"), left_(left), right_(right), right_def_(right_def)
-	{}
+	: formula_expression("_dot"), left_(left), right_(right), right_def_(right_def), cached_slot_(-1)
+	{
+		//members found by name at runtime may be cached as slot lookups.
+		//'self' is answered by formula_callable itself, not by a slot.
+		if(dynamic_cast<const identifier_expression*>(right_.get()) == NULL || !right_->is_identifier(&member_) || member_ == "self") {
+			member_.clear();
+		}
+	}
 	const_formula_callable_definition_ptr get_type_definition() const {
 		return right_->get_type_definition();
 	}
@@ -953,8 +1068,26 @@ private:
 			
 			return left;
 		}
+
+		const formula_callable* obj = left.as_callable();
+		if(!member_.empty()) {
+			//an inline cache of the slot the member had in the definition
+			//of the last callable seen here. Objects reaching this expression
+			//are usually all of the same type, so this rarely misses.
+			const formula_callable_definition* def = obj->query_slot_definition();
+			if(def) {
+				if(def != cached_def_.get()) {
+					cached_def_.reset(def);
+					cached_slot_ = def->get_slot(member_);
+				}
+
+				if(cached_slot_ >= 0) {
+					return obj->query_value_by_slot(cached_slot_);
+				}
+			}
+		}
 		
-		return right_->evaluate(*left.as_callable());
+		return right_->evaluate(*obj);
 	}
 	
 	variant execute_member(const formula_callable& variables, std::string& id, variant* variant_id) const {
@@ -1007,6 +1140,13 @@ private:
 	//the definition used to evaluate right_. i.e. the type of the value
 	//returned from left_.
 	const_formula_callable_definition_ptr right_def_;
+
+	//if right_ is looked up by name, the name, and the definition and slot
+	//it was last found in. The definition is held so its address can't be
+	//reused by another definition.
+	std::string member_;
+	mutable const_formula_callable_definition_ptr cached_def_;
+	mutable int cached_slot_;
 };
 
 class square_bracket_expression : public formula_expression { //TODO
@@ -1179,6 +1319,14 @@ private:
 		return right_->evaluate(variables);
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.lower(*left_, dst);
+		const int jump = builder.emit(formula_vm::OP_JMP_IF_FALSE, dst);
+		builder.lower(*right_, dst);
+		builder.patch_jump(jump, builder.position());
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return get_variant_type_and_or(left_, right_);
 	}
@@ -1236,6 +1384,14 @@ private:
 		return right_->evaluate(variables);
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.lower(*left_, dst);
+		const int jump = builder.emit(formula_vm::OP_JMP_IF_TRUE, dst);
+		builder.lower(*right_, dst);
+		builder.patch_jump(jump, builder.position());
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return get_variant_type_and_or(left_, right_);
 	}
@@ -1276,6 +1432,11 @@ private:
 		return variant();
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.emit(formula_vm::OP_MOVE, dst, builder.add_constant(variant()));
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_NULL);
 	}
@@ -1380,6 +1541,34 @@ private:
 		}
 	}
 	
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		formula_vm::OPCODE code;
+		switch(op_) {
+			case OP_IN:  code = formula_vm::OP_IN; break;
+			case OP_NOT_IN: code = formula_vm::OP_NOT_IN; break;
+			case OP_ADD: code = formula_vm::OP_ADD; break;
+			case OP_SUB: code = formula_vm::OP_SUB; break;
+			case OP_MUL: code = formula_vm::OP_MUL; break;
+			case OP_DIV: code = formula_vm::OP_DIV; break;
+			case OP_POW: code = formula_vm::OP_POW; break;
+			case OP_MOD: code = formula_vm::OP_MOD; break;
+			case OP_EQ:  code = formula_vm::OP_EQ; break;
+			case OP_NEQ: code = formula_vm::OP_NEQ; break;
+			case OP_LTE: code = formula_vm::OP_LTE; break;
+			case OP_GTE: code = formula_vm::OP_GTE; break;
+			case OP_LT:  code = formula_vm::OP_LT; break;
+			case OP_GT:  code = formula_vm::OP_GT; break;
+
+			//dice rolls and eager and/or are left to the tree walker.
+			default: return false;
+		}
+
+		const int left = builder.lower_operand(*left_);
+		const int right = builder.lower_operand(*right_);
+		builder.emit(code, dst, left, right);
+		return true;
+	}
+
 	static int dice_roll(int num_rolls, int faces) {
 		int res = 0;
 		while(faces > 0 && num_rolls-- > 0) {
@@ -1627,6 +1816,8 @@ const_formula_callable_definition_ptr create_where_definition(expr_table_ptr tab
 
 class where_variables: public formula_callable {
 public:
+	FORMULA_POOL_ALLOCATED
+
 	where_variables(const formula_callable &base, where_variables_info_ptr info)
 	: formula_callable(false), base_(&base), info_(info)
 	{}
@@ -1688,6 +1879,10 @@ private:
 		return body_->evaluate(*wrapped_variables);
 	}
 
+	void get_tail_expressions(std::vector<const formula_expression*>* result) const {
+		result->push_back(body_.get());
+	}
+
 	std::vector<const_expression_ptr> get_children() const {
 		std::vector<const_expression_ptr> result;
 		result.push_back(body_);
@@ -1849,6 +2044,11 @@ private:
 		return i_;
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.emit(formula_vm::OP_MOVE, dst, builder.add_constant(i_));
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_INT);
 	}
@@ -1865,6 +2065,11 @@ private:
 		return v_;
 	}
 
+	bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		builder.emit(formula_vm::OP_MOVE, dst, builder.add_constant(v_));
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_DECIMAL);
 	}
@@ -1922,7 +2127,7 @@ public:
 			str = std::string("~") + str + std::string("~");
 		}
 		
-		str_ = variant(str);
+		str_ = subs_.empty() ? variant::create_interned_string(str) : variant(str);
 	}
 
 	bool is_literal(variant& result) const {
@@ -2220,7 +2425,7 @@ void parse_set_args(const variant& formula_str, const token* i1, const token* i2
 
 				if(i1 - beg == 1 && beg->type == TOKEN_IDENTIFIER) {
 					//make it so that {a: 4} is the same as {'a': 4}
-					res->push_back(expression_ptr(new variant_expression(variant(std::string(beg->begin, beg->end)))));
+					res->push_back(expression_ptr(new variant_expression(variant::create_interned_string(std::string(beg->begin, beg->end)))));
 				} else {
 					res->push_back(parse_expression(formula_str, beg,i1, symbols, callable_def));
 				}
@@ -2955,6 +3160,11 @@ formula::strict_check_scope::~strict_check_scope()
 	g_strict_formula_checking = old_value;
 }
 
+bool formula::strict_checking()
+{
+	return g_strict_formula_checking;
+}
+
 formula_ptr formula::create_optional_formula(const variant& val, function_symbol_table* symbols, const_formula_callable_definition_ptr callable_definition)
 {
 	if(val.is_null() || val.is_string() && val.as_string().empty()) {
@@ -3068,6 +3278,12 @@ formula::formula(const variant& val, function_symbol_table* symbols, const_formu
 		expr_ = expression_ptr(new null_expression());
 	}	
 
+	expr_program_ = formula_vm::compile(expr_.get());
+	foreach(BaseCase& base, base_expr_) {
+		base.guard_program = formula_vm::compile(base.guard.get());
+		base.expr_program = formula_vm::compile(base.expr.get());
+	}
+
 	str_.add_formula_using_this(this);
 
 #ifndef NO_EDITOR
@@ -3214,7 +3430,8 @@ int formula::guard_matches(const formula_callable& variables) const
 	if(base_expr_.empty() == false) {
 		int index = 0;
 		foreach(const BaseCase& b, base_expr_) {
-			if(b.guard->evaluate(variables).as_bool()) {
+			const variant result = b.guard_program ? b.guard_program->execute(variables) : b.guard->evaluate(variables);
+			if(result.as_bool()) {
 				return index;
 			}
 
@@ -3265,7 +3482,8 @@ variant formula::execute(const formula_callable& variables) const
 
 		const int nguard = guard_matches(variables);
 
-		variant result = (nguard == -1 ? expr_ : base_expr_[nguard].expr)->evaluate(variables);
+		const formula_vm::program* program = (nguard == -1 ? expr_program_ : base_expr_[nguard].expr_program).get();
+		variant result = program ? program->execute(variables) : (nguard == -1 ? expr_ : base_expr_[nguard].expr)->evaluate(variables);
 		--execution_stack;
 		if(prev_executed) {
 			last_executed_formula = prev_executed;
@@ -3339,6 +3557,57 @@ UNIT_TEST(dot_precedence) {
 	CHECK(result == variant(2), "test failed: " << result.to_debug_string());
 }
 
+namespace {
+//a callable which answers each key with its slot in a definition, and
+//counts lookups made by name.
+class slot_test_callable : public formula_callable {
+public:
+	explicit slot_test_callable(const_formula_callable_definition_ptr def) : def_(def), name_lookups_(0)
+	{}
+
+	int name_lookups() const { return name_lookups_; }
+private:
+	variant get_value(const std::string& key) const {
+		++name_lookups_;
+		return get_value_by_slot(def_->get_slot(key));
+	}
+
+	variant get_value_by_slot(int slot) const {
+		return variant(slot);
+	}
+
+	const formula_callable_definition* get_slot_definition() const {
+		return def_.get();
+	}
+
+	const_formula_callable_definition_ptr def_;
+	mutable int name_lookups_;
+};
+}
+
+UNIT_TEST(dot_expression_inline_cache) {
+	const std::string keys[] = {"a", "b"};
+	const std::string reversed_keys[] = {"b", "a"};
+
+	boost::intrusive_ptr<slot_test_callable> obj(new slot_test_callable(create_formula_callable_definition(keys, keys + 2)));
+	boost::intrusive_ptr<slot_test_callable> reversed_obj(new slot_test_callable(create_formula_callable_definition(reversed_keys, reversed_keys + 2)));
+
+	map_formula_callable* callable = new map_formula_callable;
+	variant ref(callable);
+	formula f(variant("obj.b"));
+
+	callable->add("obj", variant(obj.get()));
+	CHECK_EQ(f.execute(*callable), variant(1));
+	CHECK_EQ(f.execute(*callable), variant(1));
+
+	//an object with a different layout must miss the cache.
+	callable->add("obj", variant(reversed_obj.get()));
+	CHECK_EQ(f.execute(*callable), variant(0));
+
+	CHECK_EQ(obj->name_lookups(), 0);
+	CHECK_EQ(reversed_obj->name_lookups(), 0);
+}
+
 UNIT_TEST(short_circuit) {
 	map_formula_callable* callable = new map_formula_callable;
 	variant ref(callable);
@@ -3390,6 +3659,12 @@ UNIT_TEST(formula_where_map) {
 	CHECK_EQ(formula(variant("{'a': a} where a = 4")).execute()["a"], variant(4));
 }
 
+UNIT_TEST(formula_proven_argument_types) {
+	const formula::strict_check_scope strict_checking;
+	CHECK_EQ(formula(variant("def f([int] items) -> int size(items); f([1,2,3])")).execute(), variant(3));
+	CHECK_EQ(formula(variant("(def([int] items) -> int size(items))([1,2,3])")).execute(), variant(3));
+}
+
 UNIT_TEST(formula_function_default_args) {
 	CHECK_EQ(formula(variant("def f(x=5) x ; f() + f(1)")).execute(), variant(6));
 	CHECK_EQ(formula(variant("f(5) where f = def(x,y=2) x*y")).execute(), variant(10));
@@ -3444,6 +3719,35 @@ BENCHMARK(formula_map_bench) {
 	}
 }
 
+//looks up string keys in a map with many entries.
+BENCHMARK(formula_map_lookup_bench) {
+	formula f(variant("sum(map(range(input), lookup[keys[value%size(keys)]]))"));
+	static map_formula_callable* callable = new map_formula_callable;
+	std::map<variant,variant> lookup;
+	std::vector<variant> keys;
+	for(int n = 0; n != 200; ++n) {
+		keys.push_back(variant(formatter() << "key" << n));
+		lookup[keys.back()] = variant(n);
+	}
+
+	callable->add("input", variant(1000));
+	callable->add("keys", variant(&keys));
+	callable->add("lookup", variant(&lookup));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
+//builds a map one key at a time.
+BENCHMARK(formula_map_insert_bench) {
+	formula f(variant("fold(map(range(input), {(value): value}), a + b)"));
+	static map_formula_callable* callable = new map_formula_callable;
+	callable->add("input", variant(200));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
 BENCHMARK(formula_recurse_sort) {
 	formula f(variant(
 "def my_qsort(items) if(size(items) <= 1, items,"
@@ -3488,6 +3792,17 @@ BENCHMARK(formula_recursion) {
 	}
 }
 
+BENCHMARK(formula_tail_recursion) {
+	static formula f(variant(
+"def silly_add(a, b) if(b <= 0, a, silly_add(a+1, b-1));"
+"silly_add(0, pos)"));
+	static map_formula_callable* callable = new map_formula_callable;
+	callable->add("pos", variant(100000));
+	BENCHMARK_LOOP {
+		CHECK_EQ(f.execute(*callable), variant(100000));
+	}
+}
+
 BENCHMARK(formula_if) {
 	static map_formula_callable* callable = new map_formula_callable;
 	callable->add("x", variant(1));
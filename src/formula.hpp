@@ -24,6 +24,7 @@
 #include "formula_fwd.hpp"
 #include "formula_function.hpp"
 #include "formula_tokenizer.hpp"
+#include "formula_vm.hpp"
 #include "variant.hpp"
 #include "variant_type.hpp"
 
@@ -73,6 +74,9 @@ public:
 		bool old_value;
 	};
 
+	//whether formulas currently being parsed are statically type checked.
+	static bool strict_checking();
+
 	static const std::set<formula*>& get_all();
 
 	static formula_ptr create_optional_formula(const variant& str, function_symbol_table* symbols=NULL, const_formula_callable_definition_ptr def=NULL);
@@ -103,6 +107,9 @@ private:
 	variant str_;
 	expression_ptr expr_;
 
+	//bytecode versions of the expressions, NULL if not compiled.
+	formula_vm::const_program_ptr expr_program_;
+
 	const_formula_callable_definition_ptr def_;
 
 	//for recursive function formulae, we have base cases along with
@@ -110,6 +117,7 @@ private:
 	struct BaseCase {
 		//raw_guard is the guard without wrapping in the global where.
 		expression_ptr raw_guard, guard, expr;
+		formula_vm::const_program_ptr guard_program, expr_program;
 	};
 	std::vector<BaseCase> base_expr_;
 
@@ -0,0 +1,164 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef FORMULA_ALLOCATION_COUNTING
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include "formatter.hpp"
+#include "formula_allocation_counter.hpp"
+#include "formula_callable_definition.hpp"
+#include "formula_function.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+#include "variant.hpp"
+
+namespace formula_allocation_counter
+{
+
+namespace {
+struct site_stats {
+	site_stats() : allocations(0), bytes(0) {}
+	std::string location;
+	long long allocations, bytes;
+};
+
+//keyed on the expression. The location is worked out when an expression
+//first allocates, and its counts are moved to retired_sites, keyed on the
+//location, when it's destroyed.
+typedef boost::unordered_map<const game_logic::formula_expression*, site_stats> site_map;
+site_map sites;
+
+std::map<std::string, site_stats> retired_sites;
+
+//expressions may be destroyed on other threads.
+threading::mutex& sites_mutex() {
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
+
+site_stats engine_stats;
+
+int nframes = 0;
+
+bool site_more_allocations(const site_stats* a, const site_stats* b)
+{
+	return a->allocations > b->allocations;
+}
+}
+
+void record(size_t size)
+{
+	const std::vector<CallStackEntry>& stack = get_expression_call_stack();
+
+	threading::lock lck(sites_mutex());
+	site_stats* stats = &engine_stats;
+	if(stack.empty() == false) {
+		const game_logic::formula_expression* expr = stack.back().expression;
+		stats = &sites[expr];
+		if(stats->location.empty()) {
+			stats->location = formatter() << expr->debug_short_location() << " " << expr->name();
+		}
+	}
+
+	++stats->allocations;
+	stats->bytes += size;
+}
+
+void end_frame()
+{
+	++nframes;
+}
+
+void expression_destroyed(const game_logic::formula_expression* expr)
+{
+	threading::lock lck(sites_mutex());
+	site_map::iterator i = sites.find(expr);
+	if(i == sites.end()) {
+		return;
+	}
+
+	site_stats& s = retired_sites[i->second.location];
+	s.location = i->second.location;
+	s.allocations += i->second.allocations;
+	s.bytes += i->second.bytes;
+	sites.erase(i);
+}
+
+void reset()
+{
+	threading::lock lck(sites_mutex());
+	sites.clear();
+	retired_sites.clear();
+	engine_stats = site_stats();
+	nframes = 0;
+}
+
+std::string get_report(int max_sites)
+{
+	threading::lock lck(sites_mutex());
+
+	//expressions at the same location are merged, since a formula
+	//which is parsed more than once has an expression for each parse.
+	std::map<std::string, site_stats> by_location = retired_sites;
+	for(site_map::const_iterator i = sites.begin(); i != sites.end(); ++i) {
+		site_stats& s = by_location[i->second.location];
+		s.location = i->second.location;
+		s.allocations += i->second.allocations;
+		s.bytes += i->second.bytes;
+	}
+
+	std::vector<const site_stats*> sorted;
+	for(std::map<std::string, site_stats>::const_iterator i = by_location.begin(); i != by_location.end(); ++i) {
+		sorted.push_back(&i->second);
+	}
+
+	std::sort(sorted.begin(), sorted.end(), site_more_allocations);
+	if(static_cast<int>(sorted.size()) > max_sites) {
+		sorted.resize(max_sites);
+	}
+
+	const double frames = std::max(nframes, 1);
+
+	std::ostringstream s;
+	s << "FORMULA ALLOCATIONS OVER " << nframes << " FRAMES (ALLOCATIONS/FRAME, BYTES/FRAME, SITE):\n";
+	s << engine_stats.allocations/frames << " " << engine_stats.bytes/frames << " (outside FFL)\n";
+	for(std::vector<const site_stats*>::const_iterator i = sorted.begin(); i != sorted.end(); ++i) {
+		s << (*i)->allocations/frames << " " << (*i)->bytes/frames << " " << (*i)->location << "\n";
+	}
+
+	return s.str();
+}
+
+}
+
+UNIT_TEST(formula_allocation_counter) {
+	formula_allocation_counter::reset();
+	formula_allocation_counter::record(32);
+	formula_allocation_counter::end_frame();
+	formula_allocation_counter::end_frame();
+
+	const std::string report = formula_allocation_counter::get_report();
+	CHECK(report.find("0.5 16 (outside FFL)") != std::string::npos, "unexpected report: " << report);
+	formula_allocation_counter::reset();
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FORMULA_ALLOCATION_COUNTER_HPP_INCLUDED
+#define FORMULA_ALLOCATION_COUNTER_HPP_INCLUDED
+
+#ifdef FORMULA_ALLOCATION_COUNTING
+
+#include <stddef.h>
+
+#include <string>
+
+namespace game_logic {
+class formula_expression;
+}
+
+//Counts the objects allocated from the formula pool -- lists, maps,
+//strings and temporary callables -- by the FFL expression that was being
+//evaluated when they were allocated. Only compiled in when building with
+//FORMULA_ALLOCATION_COUNTING defined, since it adds a lookup to every
+//allocation.
+namespace formula_allocation_counter
+{
+
+//records an allocation of the given size by the current expression.
+//Called by the formula pool on the main thread.
+void record(size_t size);
+
+//called by the formula pool at the end of every frame.
+void end_frame();
+
+//called when an expression is destroyed, so its counts are kept under its
+//location rather than given to a new expression at the same address.
+void expression_destroyed(const game_logic::formula_expression* expr);
+
+void reset();
+
+//a report of the formula sites which allocate the most, ranked by
+//allocations per frame, listing at most max_sites sites.
+std::string get_report(int max_sites=50);
+
+}
+
+#endif
+
+#endif
@@ -21,6 +21,10 @@
 #include <map>
 #include <string>
 
+#include <boost/functional/hash.hpp>
+
+#include "formula_callable_definition_fwd.hpp"
+#include "formula_pool.hpp"
 #include "reference_counted_object.hpp"
 #include "variant.hpp"
 
@@ -41,9 +45,17 @@ class formula_callable_visitor;
 //interface for objects that can have formulae run on them
 class formula_callable : public reference_counted_object {
 public:
-	explicit formula_callable(bool has_self=false) : has_self_(has_self)
+	explicit formula_callable(bool has_self=false) : has_self_(has_self), command_type_(NOT_COMMAND)
 	{}
 
+	//identifies which kind of command a callable is, so commands can be
+	//run without trying a dynamic cast to each kind in turn. Command
+	//classes set their type in their constructor.
+	enum COMMAND_TYPE { NOT_COMMAND, FORMULA_COMMAND, ENTITY_COMMAND,
+	                    CUSTOM_OBJECT_COMMAND, SWALLOW_OBJECT_COMMAND,
+	                    SWALLOW_MOUSE_COMMAND };
+	COMMAND_TYPE command_type() const { return static_cast<COMMAND_TYPE>(command_type_); }
+
 	std::string query_id() const { return get_object_id(); }
 
 	variant query_value(const std::string& key) const {
@@ -57,6 +69,13 @@ public:
 		return get_value_by_slot(slot);
 	}
 
+	//the definition giving the slot of each of this callable's keys, if
+	//querying a key always gives the same value as querying its slot.
+	//Returns NULL otherwise.
+	const formula_callable_definition* query_slot_definition() const {
+		return get_slot_definition();
+	}
+
 	void mutate_value(const std::string& key, const variant& value) {
 		set_value(key, value);
 	}
@@ -79,6 +98,11 @@ public:
 		return do_compare(other) < 0;
 	}
 
+	//callables which are equal must have the same hash.
+	size_t hash() const {
+		return do_hash();
+	}
+
 	virtual void get_inputs(std::vector<formula_input>* /*inputs*/) const {};
 
 	void serialize(std::string& str) const {
@@ -107,12 +131,19 @@ public:
 protected:
 	virtual ~formula_callable() {}
 
+	void set_command_type(COMMAND_TYPE type) { command_type_ = type; }
+
 	virtual void set_value(const std::string& key, const variant& value);
 	virtual void set_value_by_slot(int slot, const variant& value);
 	virtual int do_compare(const formula_callable* callable) const {
 		return this < callable ? -1 : (this == callable ? 0 : 1);
 	}
 
+	//must be overridden along with do_compare().
+	virtual size_t do_hash() const {
+		return boost::hash<const void*>()(this);
+	}
+
 	virtual void serialize_to_string(std::string& str) const;
 
 	virtual void visit_values(formula_callable_visitor& visitor) {}
@@ -120,9 +151,12 @@ private:
 	virtual variant get_value(const std::string& key) const = 0;
 	virtual variant get_value_by_slot(int slot) const;
 
+	virtual const formula_callable_definition* get_slot_definition() const { return NULL; }
+
 	virtual std::string get_object_id() const { return "formula_callable"; }
 
 	bool has_self_;
+	unsigned char command_type_;
 };
 
 class formula_callable_no_ref_count : public formula_callable {
@@ -185,6 +219,8 @@ public:
 
 class map_formula_callable : public formula_callable {
 public:
+	FORMULA_POOL_ALLOCATED
+
 	explicit map_formula_callable(variant node);
 	explicit map_formula_callable(const formula_callable* fallback=NULL);
 	explicit map_formula_callable(const std::map<std::string, variant>& m);
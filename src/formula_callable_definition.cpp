@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <map>
+#include <set>
 #include <vector>
 
 #include <stdio.h>
@@ -22,6 +23,7 @@
 #include "foreach.hpp"
 #include "formula_callable_definition.hpp"
 #include "formula_object.hpp"
+#include "perfect_hash.hpp"
 
 namespace game_logic
 {
@@ -54,13 +56,20 @@ public:
 	{}
 
 	int get_slot(const std::string& key) const {
-		int index = 0;
-		foreach(const entry& e, entries_) {
-			if(e.id == key) {
+		if(key_hash_.empty() == false) {
+			const int index = key_hash_.find(key);
+			if(index != -1) {
 				return base_num_slots() + index;
 			}
+		} else {
+			int index = 0;
+			foreach(const entry& e, entries_) {
+				if(e.id == key) {
+					return base_num_slots() + index;
+				}
 
-			++index;
+				++index;
+			}
 		}
 
 		if(base_) {
@@ -104,10 +113,12 @@ public:
 	int num_slots() const { return base_num_slots() + entries_.size(); }
 
 	void add(const std::string& id) {
+		key_hash_.clear();
 		entries_.push_back(entry(id));
 	}
 
 	void add(const std::string& id, variant_type_ptr type) {
+		key_hash_.clear();
 		entries_.push_back(entry(id));
 
 		if(type) {
@@ -127,10 +138,27 @@ public:
 
 	const entry* get_default_entry() const { return default_entry_.get(); }
 
+	//builds a perfect hash of our keys, used by get_slot() until another
+	//key is added. If a key is repeated the first entry with it is found.
+	void build_key_hash() {
+		std::vector<std::string> keys;
+		std::vector<int> slots;
+		std::set<std::string> seen;
+		for(int n = 0; n != entries_.size(); ++n) {
+			if(seen.insert(entries_[n].id).second) {
+				keys.push_back(entries_[n].id);
+				slots.push_back(n);
+			}
+		}
+
+		key_hash_.build(keys, slots);
+	}
+
 private:
 	int base_num_slots() const { return base_ ? base_->num_slots() : 0; }
 	const_formula_callable_definition_ptr base_;
 	std::vector<entry> entries_;
+	perfect_hash key_hash_;
 
 	boost::shared_ptr<entry> default_entry_;
 };
@@ -214,6 +242,8 @@ formula_callable_definition_ptr create_formula_callable_definition(const std::st
 		++i1;
 	}
 
+	def->build_key_hash();
+
 	return formula_callable_definition_ptr(def);
 }
 
@@ -18,6 +18,7 @@
 #define FORMULA_CALLABLE_DEFINITION_HPP_INCLUDED
 
 #include <string>
+#include <typeinfo>
 #include <boost/function.hpp>
 
 #include "asserts.hpp"
@@ -103,6 +104,7 @@ public: \
 	virtual variant get_value_by_slot(int slot) const; \
 	virtual void set_value(const std::string& key, const variant& value); \
 	virtual void set_value_by_slot(int slot, const variant& value); \
+	virtual const game_logic::formula_callable_definition* get_slot_definition() const; \
 	virtual std::string get_object_id() const { return #classname; } \
 public: \
 	int callable_fields_op(int slot, const variant* set_value, variant* get_value, const char** fieldname=NULL, const char** type_str=NULL); \
@@ -192,6 +194,13 @@ void call_callable_fields_op(T* ptr, int slot, const variant* set_value, variant
 	void classname::set_value_by_slot(int slot, const variant& value) { \
 		callable_fields_op(slot, &value, NULL, NULL); \
 	} \
+	const game_logic::formula_callable_definition* classname::get_slot_definition() const { \
+		if(typeid(*this) != typeid(classname)) { \
+			return NULL; \
+		} \
+		static const game_logic::const_formula_callable_definition_ptr def = game_logic::get_formula_callable_definition(#classname); \
+		return def.get(); \
+	} \
 	variant classname::get_value(const std::string& key) const { \
 		std::map<std::string, int>::const_iterator itor = classname##_properties.find(key); \
 		if(itor != classname##_properties.end()) { \
@@ -243,6 +252,13 @@ void call_callable_fields_op(T* ptr, int slot, const variant* set_value, variant
 	void classname::set_value_by_slot(int slot, const variant& value) { \
 		callable_fields_op(slot, &value, NULL, NULL); \
 	} \
+	const game_logic::formula_callable_definition* classname::get_slot_definition() const { \
+		if(typeid(*this) != typeid(classname)) { \
+			return NULL; \
+		} \
+		static const game_logic::const_formula_callable_definition_ptr def = game_logic::get_formula_callable_definition(#classname); \
+		return def.get(); \
+	} \
 	variant classname::get_value(const std::string& key) const { \
 		std::map<std::string, int>::const_iterator itor = classname##_properties.find(key); \
 		if(itor != classname##_properties.end()) { \
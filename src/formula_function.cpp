@@ -15,10 +15,12 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <boost/bind.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/uuid/sha1.hpp>
 #include <boost/algorithm/string.hpp>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <iomanip>
 #include <stack>
 #include <math.h>
@@ -35,17 +37,20 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula.hpp"
+#include "formula_allocation_counter.hpp"
 #include "formula_callable.hpp"
 #include "formula_callable_definition.hpp"
 #include "formula_callable_utils.hpp"
 #include "formula_function.hpp"
 #include "formula_function_registry.hpp"
 #include "formula_object.hpp"
+#include "formula_vm.hpp"
 #include "geometry.hpp"
 #include "hex_map.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
 #include "variant_callable.hpp"
+#include "variant_hash_map.hpp"
 #include "controls.hpp"
 #include "pathfinding.hpp"
 #include "preferences.hpp"
@@ -80,6 +85,13 @@ namespace game_logic {
 formula_expression::formula_expression(const char* name) : name_(name), begin_str_(EmptyStr.begin()), end_str_(EmptyStr.end()), ntimes_called_(0)
 {}
 
+formula_expression::~formula_expression()
+{
+#ifdef FORMULA_ALLOCATION_COUNTING
+	formula_allocation_counter::expression_destroyed(this);
+#endif
+}
+
 std::vector<const_expression_ptr> formula_expression::query_children() const {
 	std::vector<const_expression_ptr> result = get_children();
 	result.erase(std::remove(result.begin(), result.end(), const_expression_ptr()), result.end());
@@ -223,6 +235,17 @@ std::pair<int,int> formula_expression::debug_loc_in_file() const
 	                          end_str_ - parent_formula_.as_string().begin());
 }
 
+std::string formula_expression::debug_short_location() const
+{
+	if(!has_debug_info() || !parent_formula_.get_debug_info()->filename) {
+		return "(unknown)";
+	}
+
+	const variant::debug_info* info = parent_formula_.get_debug_info();
+	const int line = info->line + std::count(parent_formula_.as_string().begin(), begin_str_, '\n');
+	return formatter() << *info->filename << ":" << line;
+}
+
 variant formula_expression::execute_member(const formula_callable& variables, std::string& id, variant* variant_id) const
 {
 	formula::fail_if_static_context();
@@ -248,36 +271,172 @@ variant split_variant_if_str(const variant& s)
 	return variant(&res);
 }
 
+namespace {
+struct variant_hasher {
+	size_t operator()(const variant& v) const { return v.hash(); }
+};
+
+//a rough count of the memory used by a value, not counting the contents
+//of any objects it refers to.
+size_t estimate_variant_bytes(const variant& v)
+{
+	size_t result = sizeof(variant);
+	if(v.is_string()) {
+		result += v.as_string().size();
+	} else if(v.is_list()) {
+		for(size_t n = 0; n != v.num_elements(); ++n) {
+			result += estimate_variant_bytes(v[n]);
+		}
+	} else if(v.is_map()) {
+		for(variant_hash_map::const_iterator i = v.as_hash_map().begin(); i != v.as_hash_map().end(); ++i) {
+			result += estimate_variant_bytes(i->first) + estimate_variant_bytes(i->second);
+		}
+	}
+
+	return result;
+}
+
+int current_cycle()
+{
+	const level* lvl = level::current_ptr();
+	return lvl ? lvl->cycle() : 0;
+}
+}
+
+//A least recently used cache. When it's full, storing a new entry evicts
+//the entry which was used least recently. Entries may also expire a
+//given number of cycles after they were stored.
 class ffl_cache : public formula_callable
 {
 public:
-	explicit ffl_cache(int max_entries) : max_entries_(max_entries)
+	ffl_cache(int max_entries, int ttl_cycles)
+	  : max_entries_(max_entries), ttl_cycles_(ttl_cycles),
+	    hits_(0), misses_(0), evictions_(0), bytes_(0)
 	{}
+
 	const variant* get(const variant& key) const {
-		std::map<variant, variant>::const_iterator i = cache_.find(key);
-		if(i != cache_.end()) {
-			return &i->second;
-		} else {
+		lookup_map::iterator i = lookup_.find(key);
+		if(i == lookup_.end()) {
+			++misses_;
 			return NULL;
 		}
+
+		entry_list::iterator e = i->second;
+		if(ttl_cycles_ > 0 && current_cycle() - e->cycle >= ttl_cycles_) {
+			erase(i);
+			++misses_;
+			return NULL;
+		}
+
+		//move the entry to the front, as the most recently used.
+		entries_.splice(entries_.begin(), entries_, e);
+		++hits_;
+		return &e->value;
+	}
+
+	void clear() const {
+		entries_.clear();
+		lookup_.clear();
+		bytes_ = 0;
 	}
 
 	void store(const variant& key, const variant& value) const {
-		if(cache_.size() == max_entries_) {
-			cache_.clear();
+		lookup_map::iterator i = lookup_.find(key);
+		if(i != lookup_.end()) {
+			erase(i);
+		}
+
+		while(!entries_.empty() && lookup_.size() >= max_entries_) {
+			erase(lookup_.find(entries_.back().key));
+			++evictions_;
 		}
 
-		cache_[key] = value;
+		entry e;
+		e.key = key;
+		e.value = value;
+		e.cycle = current_cycle();
+		e.bytes = estimate_variant_bytes(key) + estimate_variant_bytes(value);
+		bytes_ += e.bytes;
+
+		entries_.push_front(e);
+		lookup_[key] = entries_.begin();
 	}
 private:
+	struct entry {
+		variant key, value;
+		int cycle;
+		size_t bytes;
+	};
+
+	typedef std::list<entry> entry_list;
+	typedef boost::unordered_map<variant, entry_list::iterator, variant_hasher> lookup_map;
+
+	void erase(lookup_map::iterator i) const {
+		bytes_ -= i->second->bytes;
+		entries_.erase(i->second);
+		lookup_.erase(i);
+	}
+
 	variant get_value(const std::string& key) const {
+		if(key == "hits") {
+			return variant(hits_);
+		} else if(key == "misses") {
+			return variant(misses_);
+		} else if(key == "evictions") {
+			return variant(evictions_);
+		} else if(key == "bytes") {
+			return variant(static_cast<int>(bytes_));
+		} else if(key == "size") {
+			return variant(static_cast<int>(lookup_.size()));
+		} else if(key == "max_entries") {
+			return variant(max_entries_);
+		} else if(key == "ttl") {
+			return variant(ttl_cycles_);
+		}
+
 		return variant();
 	}
 
-	mutable std::map<variant, variant> cache_;
-	int max_entries_;
+	//entries ordered from most to least recently used.
+	mutable entry_list entries_;
+	mutable lookup_map lookup_;
+	int max_entries_, ttl_cycles_;
+
+	mutable int hits_, misses_, evictions_;
+	mutable size_t bytes_;
 };
 
+namespace {
+std::vector<variant>& memo_caches()
+{
+	static std::vector<variant> caches;
+	return caches;
+}
+}
+
+variant create_memo_cache(int max_entries)
+{
+	ASSERT_LOG(max_entries > 0, "Memo cache created with max_entries of " << max_entries);
+	variant result(new ffl_cache(max_entries, 0));
+	memo_caches().push_back(result);
+	return result;
+}
+
+void clear_memo_caches()
+{
+	std::vector<variant>& caches = memo_caches();
+	for(int n = 0; n < caches.size(); ++n) {
+		//caches which only the registry refers to belong to functions
+		//which have been replaced, so they are dropped.
+		if(caches[n].refcount() == 1) {
+			caches.erase(caches.begin() + n--);
+			continue;
+		}
+
+		static_cast<const ffl_cache*>(caches[n].as_callable())->clear();
+	}
+}
+
 FUNCTION_DEF(overload, 1, -1, "overload(fn...): makes an overload of functions")
 	std::vector<variant> functions;
 	foreach(expression_ptr expression, args()) {
@@ -329,15 +488,20 @@ FUNCTION_TYPE_DEF
 	return variant_type::get_function_overload_type(variant_type::get_function_type(arg_union, return_union, min_args), function_types);
 END_FUNCTION_DEF(overload)
 
-FUNCTION_DEF(create_cache, 0, 1, "create_cache(max_entries=4096): makes an FFL cache object")
+FUNCTION_DEF(create_cache, 0, 2, "create_cache(max_entries=4096, ttl=0): makes an FFL cache object which holds up to max_entries, evicting the least recently used entry when full. If ttl is given, entries expire that many cycles after being stored. The cache has the fields hits, misses, evictions, bytes, size, max_entries and ttl.")
 	formula::fail_if_static_context();
 	int max_entries = 4096;
 	if(args().size() >= 1) {
 		max_entries = args()[0]->evaluate(variables).as_int();
 	}
-	return variant(new ffl_cache(max_entries));
+
+	ASSERT_LOG(max_entries > 0, "create_cache() called with max_entries of " << max_entries);
+
+	const int ttl = args().size() >= 2 ? args()[1]->evaluate(variables).as_int() : 0;
+	return variant(new ffl_cache(max_entries, ttl));
 FUNCTION_ARGS_DEF
 	ARG_TYPE("int");
+	ARG_TYPE("int");
 END_FUNCTION_DEF(create_cache)
 
 FUNCTION_DEF(query_cache, 3, 3, "query_cache(ffl_cache, key, expr): ")
@@ -381,6 +545,17 @@ END_FUNCTION_DEF(query_cache)
 		}
 
 	private:
+		void get_tail_expressions(std::vector<const formula_expression*>* result) const {
+			const int nargs = args().size();
+			for(int n = 1; n < nargs; n += 2) {
+				result->push_back(args()[n].get());
+			}
+
+			if(nargs%2 == 1) {
+				result->push_back(args()[nargs-1].get());
+			}
+		}
+
 		variant execute(const formula_callable& variables) const {
 			const int nargs = args().size();
 			for(int n = 0; n < nargs-1; n += 2) {
@@ -397,6 +572,30 @@ END_FUNCTION_DEF(query_cache)
 			return args()[nargs-1]->evaluate(variables);
 		}
 
+		bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+			const int nargs = args().size();
+			std::vector<int> end_jumps;
+			for(int n = 0; n < nargs-1; n += 2) {
+				builder.lower(*args()[n], dst);
+				const int next_case = builder.emit(formula_vm::OP_JMP_IF_FALSE, dst);
+				builder.lower(*args()[n+1], dst);
+				end_jumps.push_back(builder.emit(formula_vm::OP_JMP, 0));
+				builder.patch_jump(next_case, builder.position());
+			}
+
+			if(nargs%2 == 0) {
+				builder.emit(formula_vm::OP_MOVE, dst, builder.add_constant(variant()));
+			} else {
+				builder.lower(*args()[nargs-1], dst);
+			}
+
+			foreach(int jump, end_jumps) {
+				builder.patch_jump(jump, builder.position());
+			}
+
+			return true;
+		}
+
 
 		variant_type_ptr get_variant_type() const {
 			std::vector<variant_type_ptr> types;
@@ -1219,27 +1418,42 @@ private:
 };
 }
 
-FUNCTION_DEF(fold, 2, 3, "fold(list, expr, [default]) -> value")
-	variant list = args()[0]->evaluate(variables);
-	const int size = list.num_elements();
-	if(size == 0) {
-		if(args().size() >= 3) {
-			return args()[2]->evaluate(variables);
-		} else {
-			return variant();
-		}
-	} else if(size == 1) {
-		return list[0];
+namespace {
+//folds elements into a single value as they are visited.
+class fold_visitor : public list_element_visitor {
+public:
+	explicit fold_visitor(const variant_comparator& callable) : callable_(callable), nelements_(0)
+	{}
+
+	void visit(const variant& v) {
+		value_ = nelements_++ == 0 ? v : callable_.eval(value_, v);
 	}
 
+	int num_elements() const { return nelements_; }
+	const variant& value() const { return value_; }
+private:
+	const variant_comparator& callable_;
+	variant value_;
+	int nelements_;
+};
+}
+
+FUNCTION_DEF(fold, 2, 3, "fold(list, expr, [default]) -> value")
 	boost::intrusive_ptr<variant_comparator> callable(new variant_comparator(args()[1], variables));
+	fold_visitor folder(*callable);
 
-	variant a = list[0];
-	for(int n = 1; n < list.num_elements(); ++n) {
-		a = callable->eval(a, list[n]);
+	variant list;
+	if(!args()[0]->evaluate_list_elements(variables, folder, &list)) {
+		for(int n = 0; n < list.num_elements(); ++n) {
+			folder.visit(list[n]);
+		}
+	}
+
+	if(folder.num_elements() == 0 && args().size() >= 3) {
+		return args()[2]->evaluate(variables);
 	}
 
-	return a;
+	return folder.value();
 FUNCTION_ARGS_DEF
 	ARG_TYPE("list");
 FUNCTION_TYPE_DEF
@@ -1582,17 +1796,24 @@ FUNCTION_TYPE_DEF
 END_FUNCTION_DEF(remove_from_map)
 	
 namespace {
-	void flatten_items( variant items, std::vector<variant>* output){
-		for(size_t n = 0; n != items.num_elements(); ++n) {
-			
-			if( items[n].is_list() ){
-				flatten_items(items[n], output);
+	//passes on the elements of any lists it's given, at any depth.
+	class flatten_visitor : public list_element_visitor {
+	public:
+		explicit flatten_visitor(list_element_visitor& next) : next_(next)
+		{}
+
+		void visit(const variant& v) {
+			if(v.is_list()) {
+				for(size_t n = 0; n != v.num_elements(); ++n) {
+					visit(v[n]);
+				}
 			} else {
-				output->push_back(items[n]);
+				next_.visit(v);
 			}
-			
 		}
-	}
+	private:
+		list_element_visitor& next_;
+	};
 
 	variant_type_ptr flatten_type(variant_type_ptr type) {
 
@@ -1617,10 +1838,21 @@ namespace {
 }
 
 FUNCTION_DEF(flatten, 1, 1, "flatten(list): Returns a list with a depth of 1 containing the elements of any list passed in.")
-	variant input = args()[0]->evaluate(variables);
 	std::vector<variant> output;
-	flatten_items(input, &output);
+	list_element_collector collector(&output);
+	variant unused;
+	execute_list_elements(variables, collector, &unused);
 	return variant(&output);
+FUNCTION_LIST_ELEMENTS_DEF
+	flatten_visitor flattener(visitor);
+	variant input;
+	if(!args()[0]->evaluate_list_elements(variables, flattener, &input)) {
+		for(size_t n = 0; n != input.num_elements(); ++n) {
+			flattener.visit(input[n]);
+		}
+	}
+
+	return true;
 FUNCTION_TYPE_DEF
 	std::cerr << "FLATTEN: " << args()[0]->query_variant_type()->to_string() << "  ---> " << variant_type::get_list(flatten_type(args()[0]->query_variant_type()))->to_string() << "\n";
 	return variant_type::get_list(flatten_type(args()[0]->query_variant_type()));
@@ -1793,11 +2025,79 @@ class map_callable : public formula_callable {
 		std::string value_name_;
 };
 
+namespace {
+//passes on the result of a map() expression for each element.
+class map_element_visitor : public list_element_visitor {
+public:
+	map_element_visitor(map_callable& callable, const formula_expression& expr, list_element_visitor& next)
+	  : callable_(callable), expr_(expr), next_(next), index_(0)
+	{}
+
+	void visit(const variant& v) {
+		callable_.set(v, index_++);
+		next_.visit(expr_.evaluate(callable_));
+	}
+
+	void reserve(size_t n) { next_.reserve(n); }
+private:
+	map_callable& callable_;
+	const formula_expression& expr_;
+	list_element_visitor& next_;
+	int index_;
+};
+
+//passes on the elements a filter() expression is true for.
+class filter_element_visitor : public list_element_visitor {
+public:
+	filter_element_visitor(map_callable& callable, const formula_expression& expr, list_element_visitor& next)
+	  : callable_(callable), expr_(expr), next_(next), index_(0)
+	{}
+
+	void visit(const variant& v) {
+		callable_.set(v, index_++);
+		if(expr_.evaluate(callable_).as_bool()) {
+			next_.visit(v);
+		}
+	}
+private:
+	map_callable& callable_;
+	const formula_expression& expr_;
+	list_element_visitor& next_;
+	int index_;
+};
+
+class count_visitor : public list_element_visitor {
+public:
+	count_visitor() : count_(0) {}
+	void visit(const variant& v) { ++count_; }
+	int count() const { return count_; }
+private:
+	int count_;
+};
+
+class sum_visitor : public list_element_visitor {
+public:
+	explicit sum_visitor(const variant& init) : sum_(init) {}
+	void visit(const variant& v) { sum_ = sum_ + v; }
+	const variant& sum() const { return sum_; }
+private:
+	variant sum_;
+};
+}
+
 FUNCTION_DEF(count, 2, 2, "count(list, expr): Returns an integer count of how many items in the list 'expr' returns true for.")
-	const variant items = split_variant_if_str(args()[0]->evaluate(variables));
+	boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+	count_visitor counter;
+	filter_element_visitor filter(*callable, *args().back(), counter);
+
+	variant input;
+	if(args()[0]->evaluate_list_elements(variables, filter, &input)) {
+		return variant(counter.count());
+	}
+
+	const variant items = split_variant_if_str(input);
 	if(items.is_map()) {
 		int res = 0;
-		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
 		int index = 0;
 		foreach(const variant_pair& p, items.as_map()) {
 			callable->set(p.first, p.second, index);
@@ -1811,17 +2111,11 @@ FUNCTION_DEF(count, 2, 2, "count(list, expr): Returns an integer count of how ma
 
 		return variant(res);
 	} else {
-		int res = 0;
-		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
 		for(size_t n = 0; n != items.num_elements(); ++n) {
-			callable->set(items[n], n);
-			const variant val = args().back()->evaluate(*callable);
-			if(val.as_bool()) {
-				++res;
-			}
+			filter.visit(items[n]);
 		}
 
-		return variant(res);
+		return variant(counter.count());
 	}
 
 FUNCTION_ARGS_DEF
@@ -1843,49 +2137,52 @@ private:
 	std::string identifier_;
 	variant execute(const formula_callable& variables) const {
 		std::vector<variant> vars;
-		const variant items = args()[0]->evaluate(variables);
-		if(args().size() == 2) {
+		list_element_collector collector(&vars);
+		variant result;
+		if(execute_list_elements(variables, collector, &result)) {
+			return variant(&vars);
+		}
 
-			if(items.is_map()) {
-				boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-				std::map<variant,variant> m;
-				int index = 0;
-				foreach(const variant_pair& p, items.as_map()) {
-					callable->set(p.first, p.second, index);
-					const variant val = args().back()->evaluate(*callable);
-					if(val.as_bool()) {
-						m[p.first] = p.second;
-					}
+		return result;
+	}
 
-					++index;
-				}
+	//filtering a map gives a map, anything else is filtered element by
+	//element.
+	bool execute_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		if(args().size() == 3) {
+			callable->set_value_name(identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_);
+		}
 
-				return variant(&m);
-			} else {
-				boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-				for(size_t n = 0; n != items.num_elements(); ++n) {
-					callable->set(items[n], n);
-					const variant val = args().back()->evaluate(*callable);
-					if(val.as_bool()) {
-						vars.push_back(items[n]);
-					}
-				}
-			}
-		} else {
-			boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-			const std::string self = identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_;
-			callable->set_value_name(self);
+		filter_element_visitor filter(*callable, *args().back(), visitor);
 
-			for(size_t n = 0; n != items.num_elements(); ++n) {
-				callable->set(items[n], n);
+		variant items;
+		if(args()[0]->evaluate_list_elements(variables, filter, &items)) {
+			return true;
+		}
+
+		if(args().size() == 2 && items.is_map()) {
+			std::map<variant,variant> m;
+			int index = 0;
+			foreach(const variant_pair& p, items.as_map()) {
+				callable->set(p.first, p.second, index);
 				const variant val = args().back()->evaluate(*callable);
 				if(val.as_bool()) {
-					vars.push_back(items[n]);
+					m[p.first] = p.second;
 				}
+
+				++index;
 			}
+
+			*result = variant(&m);
+			return false;
 		}
 
-		return variant(&vars);
+		for(size_t n = 0; n != items.num_elements(); ++n) {
+			filter.visit(items[n]);
+		}
+
+		return true;
 	}
 
 	variant_type_ptr get_variant_type() const {
@@ -2199,50 +2496,47 @@ private:
 
 	variant execute(const formula_callable& variables) const {
 		std::vector<variant> vars;
-		const variant items = args()[0]->evaluate(variables);
+		list_element_collector collector(&vars);
+		variant unused;
+		execute_list_elements(variables, collector, &unused);
+		return variant(&vars);
+	}
 
-		vars.reserve(items.num_elements());
+	bool execute_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		if(args().size() == 3) {
+			callable->set_value_name(identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_);
+		}
 
-		if(args().size() == 2) {
+		map_element_visitor mapper(*callable, *args().back(), visitor);
 
-			if(items.is_map()) {
-				boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-				int index = 0;
-				foreach(const variant_pair& p, items.as_map()) {
-					callable->set(p.first, p.second, index);
-					const variant val = args().back()->evaluate(*callable);
-					vars.push_back(val);
-					++index;
-				}
-			} else if(items.is_string()) {
-				const std::string& s = items.as_string();
-				boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-				for(size_t n = 0; n != s.length(); ++n) {
-					variant v(s.substr(n,1));
-					callable->set(v, n);
-					const variant val = args().back()->evaluate(*callable);
-					vars.push_back(val);
-				}
-			} else {
-				boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-				for(size_t n = 0; n != items.num_elements(); ++n) {
-					callable->set(items[n], n);
-					const variant val = args().back()->evaluate(*callable);
-					vars.push_back(val);
-				}
+		variant items;
+		if(args()[0]->evaluate_list_elements(variables, mapper, &items)) {
+			return true;
+		}
+
+		if(args().size() == 2 && items.is_map()) {
+			visitor.reserve(items.num_elements());
+			int index = 0;
+			foreach(const variant_pair& p, items.as_map()) {
+				callable->set(p.first, p.second, index);
+				visitor.visit(args().back()->evaluate(*callable));
+				++index;
+			}
+		} else if(args().size() == 2 && items.is_string()) {
+			const std::string& s = items.as_string();
+			visitor.reserve(s.length());
+			for(size_t n = 0; n != s.length(); ++n) {
+				mapper.visit(variant(s.substr(n,1)));
 			}
 		} else {
-			boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
-			const std::string self = identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_;
-			callable->set_value_name(self);
+			visitor.reserve(items.num_elements());
 			for(size_t n = 0; n != items.num_elements(); ++n) {
-				callable->set(items[n], n);
-				const variant val = args().back()->evaluate(*callable);
-				vars.push_back(val);
+				mapper.visit(items[n]);
 			}
 		}
 
-		return variant(&vars);
+		return true;
 	}
 
 	variant_type_ptr get_variant_type() const {
@@ -2251,16 +2545,15 @@ private:
 };
 
 FUNCTION_DEF(sum, 1, 2, "sum(list[, counter]): Adds all elements of the list together. If counter is supplied, all elements of the list are added to the counter instead of to 0.")
-	variant res(0);
-	const variant items = args()[0]->evaluate(variables);
-	if(args().size() >= 2) {
-		res = args()[1]->evaluate(variables);
-	}
-	for(size_t n = 0; n != items.num_elements(); ++n) {
-		res = res + items[n];
+	sum_visitor summer(args().size() >= 2 ? args()[1]->evaluate(variables) : variant(0));
+	variant items;
+	if(!args()[0]->evaluate_list_elements(variables, summer, &items)) {
+		for(size_t n = 0; n != items.num_elements(); ++n) {
+			summer.visit(items[n]);
+		}
 	}
 
-	return res;
+	return summer.sum();
 
 FUNCTION_ARGS_DEF
 	ARG_TYPE("list");
@@ -2276,6 +2569,12 @@ FUNCTION_TYPE_DEF
 END_FUNCTION_DEF(sum)
 
 FUNCTION_DEF(range, 1, 3, "range([start, ]finish[, step]): Returns a list containing all numbers smaller than the finish value and and larger than or equal to the start value. The start value defaults to 0.")
+	std::vector<variant> v;
+	list_element_collector collector(&v);
+	variant unused;
+	execute_list_elements(variables, collector, &unused);
+	return variant(&v);
+FUNCTION_LIST_ELEMENTS_DEF
 	int start = args().size() > 1 ? args()[0]->evaluate(variables).as_int() : 0;
 	int end = args()[args().size() > 1 ? 1 : 0]->evaluate(variables).as_int();
 	int step = args().size() < 3 ? 1 : args()[2]->evaluate(variables).as_int();
@@ -2288,22 +2587,23 @@ FUNCTION_DEF(range, 1, 3, "range([start, ]finish[, step]): Returns a list contai
 		reverse = true;
 	}
 	const int nelem = end - start;
+	if(nelem <= 0) {
+		return true;
+	}
 
-	std::vector<variant> v;
-
-	if(nelem > 0) {
-		v.reserve(nelem/step);
+	visitor.reserve((nelem + step - 1)/step);
 
+	if(reverse) {
+		for(int n = ((nelem - 1)/step)*step; n >= 0; n -= step) {
+			visitor.visit(variant(start+n));
+		}
+	} else {
 		for(int n = 0; n < nelem; n += step) {
-			v.push_back(variant(start+n));
+			visitor.visit(variant(start+n));
 		}
 	}
 
-	if(reverse) {
-		std::reverse(v.begin(), v.end());
-	}
-
-	return variant(&v);
+	return true;
 FUNCTION_TYPE_DEF
 	return variant_type::get_list(variant_type::get_type(variant::VARIANT_TYPE_INT));
 END_FUNCTION_DEF(range)
@@ -3539,7 +3839,7 @@ void function_expression::check_arg_type(int narg, const std::string& type_str)
 
 formula_function_expression::formula_function_expression(const std::string& name, const args_list& args, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& arg_names, const std::vector<variant_type_ptr>& variant_types)
 : function_expression(name, args, arg_names.size(), arg_names.size()),
-	formula_(formula), precondition_(precondition), arg_names_(arg_names), variant_types_(variant_types), star_arg_(-1), has_closure_(false), base_slot_(0)
+	formula_(formula), precondition_(precondition), arg_names_(arg_names), variant_types_(variant_types), star_arg_(-1), has_closure_(false), base_slot_(0), tail_call_(false)
 {
 	assert(!precondition_ || !precondition_->str().empty());
 	for(size_t n = 0; n != arg_names_.size(); ++n) {
@@ -3549,6 +3849,13 @@ formula_function_expression::formula_function_expression(const std::string& name
 			break;
 		}
 	}
+
+	if(formula::strict_checking()) {
+		proven_args_.resize(variant_types_.size());
+		for(int n = 0; n < variant_types_.size() && n < args.size(); ++n) {
+			proven_args_[n] = variant_types_[n] && variant_types_proven_match(variant_types_[n], args[n]->query_variant_type());
+		}
+	}
 }
 
 namespace {
@@ -3569,6 +3876,15 @@ struct recursion_calculation_scope {
 	~recursion_calculation_scope() { is_calculating_recursion = false; }
 };
 
+//a self tail call which has had its arguments calculated and is waiting
+//for the invocation of the function below it to run it.
+struct pending_tail_call {
+	boost::intrusive_ptr<slot_formula_callable> callable;
+	const formula_function_expression* source;
+};
+
+pending_tail_call tail_call;
+
 
 }
 
@@ -3590,7 +3906,7 @@ boost::intrusive_ptr<slot_formula_callable> formula_function_expression::calcula
 	for(int n = 0; n != arg_names_.size(); ++n) {
 		variant var = args()[n]->evaluate(variables);
 
-		if(n < variant_types_.size() && variant_types_[n]) {
+		if(n < variant_types_.size() && variant_types_[n] && (n >= proven_args_.size() || !proven_args_[n])) {
 			ASSERT_LOG(variant_types_[n]->match(var), "FUNCTION ARGUMENT " << (n+1) << " EXPECTED TYPE " << variant_types_[n]->str() << " BUT FOUND " << var.write_json() << " TYPE " << get_variant_type_from_value(var)->to_string() << " AT " << debug_pinpoint_location());
 		}
 
@@ -3603,6 +3919,17 @@ boost::intrusive_ptr<slot_formula_callable> formula_function_expression::calcula
 	return tmp_callable;
 }
 
+void formula_function_expression::check_precondition(const slot_formula_callable& callable) const
+{
+	if(!precondition_->execute(callable).as_bool()) {
+		std::cerr << "FAILED function precondition (" << precondition_->str() << ") for function '" << formula_->str() << "' with arguments: ";
+		const std::vector<variant>& values = callable.values();
+		for(size_t n = 0; n != arg_names_.size() && n != values.size(); ++n) {
+			std::cerr << "  arg " << (n+1) << ": " << values[n].to_debug_string() << "\n";
+		}
+	}
+}
+
 variant formula_function_expression::execute(const formula_callable& variables) const
 {
 	if(fed_result_) {
@@ -3611,17 +3938,33 @@ variant formula_function_expression::execute(const formula_callable& variables)
 		return result;
 	}
 
+	if(tail_call_ && !is_calculating_recursion && !formula_fn_stack.empty() && formula_fn_stack.top()->formula_ == formula_) {
+		//the value of this call is the value of the invocation of this
+		//function we're inside, so rather than recursing, leave the call
+		//for that invocation to run.
+		tail_call.callable = calculate_args_callable(variables);
+		tail_call.source = this;
+		return variant();
+	}
+
 	boost::intrusive_ptr<slot_formula_callable> tmp_callable = calculate_args_callable(variables);
 
-	if(precondition_) {
-		if(!precondition_->execute(*tmp_callable).as_bool()) {
-			std::cerr << "FAILED function precondition (" << precondition_->str() << ") for function '" << formula_->str() << "' with arguments: ";
-			for(size_t n = 0; n != arg_names_.size(); ++n) {
-				std::cerr << "  arg " << (n+1) << ": " << args()[n]->evaluate(variables).to_debug_string() << "\n";
-			}
+	variant memo_key;
+	if(memo_cache_.is_callable()) {
+		std::vector<variant> key = tmp_callable->values();
+		memo_key = variant(&key);
+		const variant* cached = static_cast<const ffl_cache*>(memo_cache_.as_callable())->get(memo_key);
+		if(cached) {
+			callable_ = tmp_callable;
+			callable_->clear();
+			return *cached;
 		}
 	}
 
+	if(precondition_) {
+		check_precondition(*tmp_callable);
+	}
+
 	if(!is_calculating_recursion && formula_->has_guards() && !formula_fn_stack.empty() && formula_fn_stack.top() == this) {
 		const recursion_calculation_scope recursion_scope;
 
@@ -3647,11 +3990,38 @@ variant formula_function_expression::execute(const formula_callable& variables)
 	}
 
 	formula_function_scope scope(this);
+
+	//a call left behind by an invocation which was aborted by an error.
+	tail_call.callable.reset();
+
 	variant res = formula_->execute(*tmp_callable);
 
+	while(tail_call.callable) {
+		boost::intrusive_ptr<slot_formula_callable> next;
+		next.swap(tail_call.callable);
+
+		//give the finished arguments back to the call site, so their
+		//storage is reused for its next call.
+		if(tmp_callable->refcount() == 1 && !tail_call.source->callable_) {
+			tmp_callable->clear();
+			tail_call.source->callable_ = tmp_callable;
+		}
+
+		tmp_callable = next;
+		if(precondition_) {
+			check_precondition(*tmp_callable);
+		}
+
+		res = formula_->execute(*tmp_callable);
+	}
+
 	callable_ = tmp_callable;
 	callable_->clear();
 
+	if(memo_key.is_list()) {
+		static_cast<const ffl_cache*>(memo_cache_.as_callable())->store(memo_key, res);
+	}
+
 	return res;
 }
 
@@ -3667,7 +4037,9 @@ variant formula_function_expression::execute(const formula_callable& variables)
 			}
 		}
 
-		return formula_function_expression_ptr(new formula_function_expression(name_, args, formula_, precondition_, args_, variant_types_));
+		formula_function_expression_ptr result(new formula_function_expression(name_, args, formula_, precondition_, args_, variant_types_));
+		result->set_memo_cache(memo_cache_);
+		return result;
 	}
 
 	void function_symbol_table::add_formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types)
@@ -3699,6 +4071,13 @@ variant formula_function_expression::execute(const formula_callable& variables)
 		return res;
 	}
 
+	void function_symbol_table::set_memo_cache(const std::string& fn, const variant& cache)
+	{
+		std::map<std::string, formula_function>::iterator i = custom_formulas_.find(fn);
+		ASSERT_LOG(i != custom_formulas_.end(), "Memoizing unknown function " << fn);
+		i->second.set_memo_cache(cache);
+	}
+
 	const formula_function* function_symbol_table::get_formula_function(const std::string& fn) const
 	{
 		const std::map<std::string, formula_function>::const_iterator i = custom_formulas_.find(fn);
@@ -3733,10 +4112,32 @@ variant formula_function_expression::execute(const formula_callable& variables)
 		return expression_ptr();
 	}
 
+namespace {
+	void add_tail_expressions(const formula_expression* expr, std::vector<const formula_expression*>* result)
+	{
+		result->push_back(expr);
+
+		std::vector<const formula_expression*> tail;
+		expr->get_tail_expressions(&tail);
+		foreach(const formula_expression* e, tail) {
+			add_tail_expressions(e, result);
+		}
+	}
+}
+
 	void recursive_function_symbol_table::resolve_recursive_calls(const_formula_ptr f)
 	{
+		//functions with base cases recurse in their own way, and closures
+		//need their own scope for each call, so only plain functions have
+		//their tail calls run as iteration.
+		std::vector<const formula_expression*> tail_expressions;
+		if(f && f->expr() && !f->has_guards() && !closure_definition_) {
+			add_tail_expressions(f->expr().get(), &tail_expressions);
+		}
+
 		foreach(formula_function_expression_ptr& fn, expr_) {
 			fn->set_formula(f);
+			fn->set_tail_call(std::count(tail_expressions.begin(), tail_expressions.end(), fn.get()) > 0);
 		}
 	}
 
@@ -4299,6 +4700,98 @@ UNIT_TEST(map_function) {
 	CHECK_EQ(game_logic::formula(variant("map([2,3,4], value+index)")).execute(), game_logic::formula(variant("[2,4,6]")).execute());
 }
 
+UNIT_TEST(ffl_cache_lru) {
+	boost::intrusive_ptr<game_logic::ffl_cache> cache(new game_logic::ffl_cache(2, 0));
+	cache->store(variant("a"), variant(1));
+	cache->store(variant("b"), variant(2));
+	CHECK_EQ(*cache->get(variant("a")), variant(1));
+
+	//b is now the least recently used entry, so it's evicted.
+	cache->store(variant("c"), variant(3));
+	CHECK(cache->get(variant("b")) == NULL, "least recently used entry not evicted");
+	CHECK_EQ(*cache->get(variant("a")), variant(1));
+	CHECK_EQ(*cache->get(variant("c")), variant(3));
+
+	CHECK_EQ(cache->query_value("hits"), variant(3));
+	CHECK_EQ(cache->query_value("misses"), variant(1));
+	CHECK_EQ(cache->query_value("evictions"), variant(1));
+	CHECK_EQ(cache->query_value("size"), variant(2));
+	CHECK_EQ(cache->query_value("bytes").as_int() > 0, true);
+}
+
+namespace {
+//makes a symbol table containing a recursive fib() function, the way
+//functions are loaded from functions.cfg.
+game_logic::function_symbol_table* create_fib_symbols(variant memo_cache)
+{
+	using namespace game_logic;
+	function_symbol_table* symbols = new function_symbol_table;
+	std::vector<std::string> args(1, "n");
+	std::vector<variant> default_args;
+	std::vector<variant_type_ptr> variant_types;
+	formula_callable_definition_ptr args_definition = create_formula_callable_definition(&args[0], &args[0] + args.size());
+	recursive_function_symbol_table recursive_symbols("fib", args, default_args, symbols, NULL, variant_types);
+	if(memo_cache.is_callable()) {
+		recursive_symbols.set_memo_cache(memo_cache);
+	}
+
+	const_formula_ptr fml(new formula(variant("if(n < 2, n, fib(n-1) + fib(n-2))"), &recursive_symbols, args_definition.get()));
+	symbols->add_formula_function("fib", fml, const_formula_ptr(), args, default_args, variant_types);
+	if(memo_cache.is_callable()) {
+		symbols->set_memo_cache("fib", memo_cache);
+	}
+
+	recursive_symbols.resolve_recursive_calls(fml);
+	return symbols;
+}
+}
+
+UNIT_TEST(memoized_function) {
+	const variant cache = game_logic::create_memo_cache(64);
+	boost::scoped_ptr<game_logic::function_symbol_table> symbols(create_fib_symbols(cache));
+	game_logic::formula f(variant("fib(20)"), symbols.get());
+	CHECK_EQ(f.execute(), variant(6765));
+	CHECK_EQ(f.execute(), variant(6765));
+	CHECK_EQ(cache.as_callable()->query_value("misses"), variant(21));
+	CHECK_EQ(cache.as_callable()->query_value("hits").as_int() > 0, true);
+}
+
+BENCHMARK(memoized_function_call) {
+	static boost::scoped_ptr<game_logic::function_symbol_table> symbols(create_fib_symbols(game_logic::create_memo_cache(64)));
+	static game_logic::formula f(variant("fib(20)"), symbols.get());
+	BENCHMARK_LOOP {
+		f.execute();
+	}
+}
+
+BENCHMARK(unmemoized_function_call) {
+	static boost::scoped_ptr<game_logic::function_symbol_table> symbols(create_fib_symbols(variant()));
+	static game_logic::formula f(variant("fib(20)"), symbols.get());
+	BENCHMARK_LOOP {
+		f.execute();
+	}
+}
+
+UNIT_TEST(tail_recursive_function) {
+	//deep enough that it would overflow the stack if each call recursed.
+	CHECK_EQ(game_logic::formula(variant("def count_to(n, acc) if(n <= 0, acc, count_to(n-1, acc+2)); count_to(1000000, 0)")).execute(), variant(2000000));
+	CHECK_EQ(game_logic::formula(variant("def count_down(n) if(n <= 0, 'done', count_down(m) where m = n-1); count_down(100000)")).execute(), variant("done"));
+
+	//not in tail position, so still runs as a normal recursive call.
+	CHECK_EQ(game_logic::formula(variant("def fact(n) if(n <= 1, 1, n*fact(n-1)); fact(10)")).execute(), variant(3628800));
+}
+
+UNIT_TEST(fused_list_functions) {
+	CHECK_EQ(game_logic::formula(variant("sum(map(filter(range(10), value%2 = 0), value*value))")).execute(), variant(120));
+	CHECK_EQ(game_logic::formula(variant("count(map(range(5), value*2), value > 4)")).execute(), variant(2));
+	CHECK_EQ(game_logic::formula(variant("fold(map(range(5), value+1), a*b)")).execute(), variant(120));
+	CHECK_EQ(game_logic::formula(variant("fold(filter(range(5), value > 10), a+b, -1)")).execute(), variant(-1));
+	CHECK_EQ(game_logic::formula(variant("flatten(map(range(3), [value, [value]]))")).execute(), game_logic::formula(variant("[0,0,1,1,2,2]")).execute());
+	CHECK_EQ(game_logic::formula(variant("range(10, 0, 2)")).execute(), game_logic::formula(variant("[9,7,5,3,1]")).execute());
+	CHECK_EQ(game_logic::formula(variant("sum([x*2 | x <- range(4)])")).execute(), variant(12));
+	CHECK_EQ(game_logic::formula(variant("filter({'a': 1, 'b': 2}, value > 1)")).execute(), game_logic::formula(variant("{'b': 2}")).execute());
+}
+
 UNIT_TEST(where_scope_function) {
 	CHECK(game_logic::formula(variant("{'val': num} where num = 5")).execute() == game_logic::formula(variant("{'val': 5}")).execute(), "map where test failed");
 	CHECK(game_logic::formula(variant("'five: ${five}' where five = 5")).execute() == game_logic::formula(variant("'five: 5'")).execute(), "string where test failed");
@@ -4331,6 +4824,13 @@ BENCHMARK(map_function) {
 	}
 }
 
+BENCHMARK(fused_list_functions) {
+	static game_logic::formula f(variant("sum(map(filter(range(100000), value%3 = 0), value*2))"));
+	BENCHMARK_LOOP {
+		f.execute();
+	}
+}
+
 namespace game_logic {
 
 const_formula_callable_definition_ptr get_map_callable_definition(const_formula_callable_definition_ptr base_def, variant_type_ptr key_type, variant_type_ptr value_type, const std::string& value_name)
@@ -32,6 +32,10 @@
 #include "variant.hpp"
 #include "variant_type.hpp"
 
+namespace formula_vm {
+class program_builder;
+}
+
 namespace game_logic {
 
 class formula_expression;
@@ -47,10 +51,31 @@ std::string pinpoint_location(variant v, std::string::const_iterator begin,
                                          std::string::const_iterator end,
 										 PinpointedLoc* pos_info=0);
 
+//receives the elements of a list one at a time, see
+//formula_expression::evaluate_list_elements().
+class list_element_visitor {
+public:
+	virtual ~list_element_visitor() {}
+	virtual void visit(const variant& v) = 0;
+
+	//a hint of how many more elements are going to be visited.
+	virtual void reserve(size_t n) {}
+};
+
+//a visitor which appends the elements it's given to a vector.
+class list_element_collector : public list_element_visitor {
+public:
+	explicit list_element_collector(std::vector<variant>* items) : items_(items) {}
+	void visit(const variant& v) { items_->push_back(v); }
+	void reserve(size_t n) { items_->reserve(items_->size() + n); }
+private:
+	std::vector<variant>* items_;
+};
+
 class formula_expression : public reference_counted_object {
 public:
 	explicit formula_expression(const char* name=NULL);
-	virtual ~formula_expression() {}
+	virtual ~formula_expression();
 	virtual variant static_evaluate(const formula_callable& variables) const {
 		return evaluate(variables);
 	}
@@ -71,6 +96,19 @@ public:
 		return execute(variables);
 	}
 
+	//evaluates an expression which produces a list element by element,
+	//passing each element to the visitor and returning true. List functions
+	//do this so chains such as sum(map(filter(...))) run as a single loop
+	//without building intermediate lists. Other expressions place their
+	//result in *result and return false.
+	bool evaluate_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
+#if !TARGET_OS_IPHONE
+		++ntimes_called_;
+		call_stack_manager manager(this, &variables);
+#endif
+		return execute_list_elements(variables, visitor, result);
+	}
+
 	variant evaluate_with_member(const formula_callable& variables, std::string& id, variant* variant_id=NULL) const {
 #if !TARGET_OS_IPHONE
 		call_stack_manager manager(this, &variables);
@@ -90,8 +128,20 @@ public:
 		return false;
 	}
 
+	//emits bytecode which places the result of this expression in register
+	//dst. Returns false, without emitting anything, if the expression
+	//can't be lowered, in which case the tree walker is used for it.
+	virtual bool compile_vm(formula_vm::program_builder& builder, int dst) const {
+		return false;
+	}
+
 	virtual const_formula_callable_definition_ptr get_type_definition() const;
 
+	//adds the subexpressions whose value becomes the value of this
+	//expression with nothing more to compute, such as the branches of an
+	//if(). Used to find tail calls.
+	virtual void get_tail_expressions(std::vector<const formula_expression*>* result) const {}
+
 	const char* name() const { return name_; }
 	void set_name(const char* name) { name_ = name; }
 
@@ -103,6 +153,9 @@ public:
 	std::string debug_pinpoint_location(PinpointedLoc* loc=NULL) const;
 	std::pair<int, int> debug_loc_in_file() const;
 
+	//the file and line the expression is at, as file:line, on one line.
+	std::string debug_short_location() const;
+
 	void set_str(const std::string& str) { str_ = str; }
 	const std::string& str() const { return str_; }
 
@@ -127,6 +180,11 @@ protected:
 	virtual variant execute_member(const formula_callable& variables, std::string& id, variant* variant_id) const;
 private:
 	virtual variant execute(const formula_callable& variables) const = 0;
+	virtual bool execute_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
+		*result = execute(variables);
+		return false;
+	}
+
 	virtual void static_error_analysis() const {}
 	virtual const_formula_callable_definition_ptr get_modified_definition_based_on_result(bool result, const_formula_callable_definition_ptr current_def, variant_type_ptr expression_is_this_type) const { return NULL; }
 
@@ -178,13 +236,28 @@ public:
 
 	void set_formula(const_formula_ptr f) { formula_ = f; }
 	void set_has_closure(int base_slot) { has_closure_ = true; base_slot_ = base_slot; }
+
+	//results of calls will be stored in and looked up from this cache,
+	//which is keyed on the list of argument values. See create_memo_cache().
+	void set_memo_cache(const variant& cache) { memo_cache_ = cache; }
+
+	//marks this as a call a function makes to itself in tail position. Such
+	//calls are run as iteration by the function's invocation, so they don't
+	//grow the stack.
+	void set_tail_call(bool value) { tail_call_ = value; }
 private:
 	boost::intrusive_ptr<slot_formula_callable> calculate_args_callable(const formula_callable& variables) const;
+
+	//reports a call whose arguments don't satisfy the precondition.
+	void check_precondition(const slot_formula_callable& callable) const;
 	variant execute(const formula_callable& variables) const;
 	const_formula_ptr formula_;
 	const_formula_ptr precondition_;
 	std::vector<std::string> arg_names_;
 	std::vector<variant_type_ptr> variant_types_;
+
+	//arguments whose types were proven statically, so need no runtime check.
+	std::vector<bool> proven_args_;
 	int star_arg_;
 
 	//this is the callable object that is populated with the arguments to the
@@ -196,6 +269,9 @@ private:
 	bool has_closure_;
 	int base_slot_;
 
+	variant memo_cache_;
+	bool tail_call_;
+
 };
 
 typedef boost::intrusive_ptr<function_expression> function_expression_ptr;
@@ -208,6 +284,7 @@ class formula_function {
 	std::vector<std::string> args_;
 	std::vector<variant> default_args_;
 	std::vector<variant_type_ptr> variant_types_;
+	variant memo_cache_;
 public:
 	formula_function() {}
 	formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types) : name_(name), formula_(formula), precondition_(precondition), args_(args), default_args_(default_args), variant_types_(variant_types)
@@ -219,6 +296,8 @@ public:
 	const std::vector<variant> default_args() const { return default_args_; }
 	const_formula_ptr get_formula() const { return formula_; }
 	const std::vector<variant_type_ptr>& variant_types() const { return variant_types_; }
+
+	void set_memo_cache(const variant& cache) { memo_cache_ = cache; }
 };	
 
 class function_symbol_table {
@@ -234,6 +313,9 @@ public:
 										   const_formula_callable_definition_ptr callable_def) const;
 	std::vector<std::string> get_function_names() const;
 	const formula_function* get_formula_function(const std::string& fn) const;
+
+	//makes calls to the given function look up their results in a cache.
+	void set_memo_cache(const std::string& fn, const variant& cache);
 };
 
 //a special symbol table which is used to facilitate recursive functions.
@@ -252,8 +334,20 @@ public:
 					                       const std::vector<expression_ptr>& args,
 										   const_formula_callable_definition_ptr callable_def) const;
 	void resolve_recursive_calls(const_formula_ptr f);
+
+	//makes recursive calls use the function's memo cache.
+	void set_memo_cache(const variant& cache) { stub_.set_memo_cache(cache); }
 };
 
+//Creates the cache a memoized function stores its results in. Functions
+//are memoized when they are declared with memoize: true, or with the
+//maximum number of results to keep, which should only be done for pure
+//functions, whose result depends only on their arguments.
+variant create_memo_cache(int max_entries);
+
+//empties all memo caches, called when modules are reloaded.
+void clear_memo_caches();
+
 expression_ptr create_function(const std::string& fn,
                                const std::vector<expression_ptr>& args,
 							   const function_symbol_table* symbols,
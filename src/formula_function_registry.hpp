@@ -63,6 +63,10 @@ private: \
 
 #define FUNCTION_OPTIMIZE } expression_ptr optimize() const {
 
+//defines how the function produces its result element by element, see
+//formula_expression::evaluate_list_elements().
+#define FUNCTION_LIST_ELEMENTS_DEF } bool execute_list_elements(const formula_callable& variables, list_element_visitor& visitor, variant* result) const {
+
 #define EVAL_ARG(n) (args()[n]->evaluate(variables))
 #define NUM_ARGS (args().size())
 
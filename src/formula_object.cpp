@@ -29,6 +29,8 @@
 #include "module.hpp"
 #include "preferences.hpp"
 #include "string_utils.hpp"
+#include "unit_test.hpp"
+#include "variant_hash_map.hpp"
 #include "variant_type.hpp"
 #include "variant_utils.hpp"
 
@@ -433,6 +435,8 @@ public:
 
 	int nstate_slots() const { return nstate_slots_; }
 
+	const formula_callable_definition* definition() const { return definition_.get(); }
+
 	void build_nested_classes();
 	void run_unit_tests();
 
@@ -455,6 +459,8 @@ private:
 	variant nested_classes_;
 
 	int nstate_slots_;
+
+	const_formula_callable_definition_ptr definition_;
 };
 
 bool is_class_derived_from(const std::string& derived, const std::string& base)
@@ -510,6 +516,7 @@ formula_class::formula_class(const std::string& class_name, const variant& node)
 
 	formula_callable_definition_ptr class_def = get_class_definition(class_name);
 	assert(class_def);
+	definition_ = class_def;
 
 	formula_class_definition* class_definition = dynamic_cast<formula_class_definition*>(class_def.get());
 	assert(class_definition);
@@ -754,7 +761,7 @@ void formula_object::visit_variants(variant node, boost::function<void (variant)
 		wml_formula_callable_serialization_scope::register_serialized_object(ptr);
 		seen->push_back(obj);
 
-		foreach(const variant& v, obj->variables_) {
+		foreach(const variant& v, obj->variables_->values) {
 			visit_variants(v, fn, seen);
 		}
 
@@ -794,8 +801,8 @@ variant formula_object::deep_clone(variant v, std::map<formula_object*,formula_o
 			boost::intrusive_ptr<formula_object> duplicate = obj->clone();
 			mapping[obj] = duplicate.get();
 
-			for(int n = 0; n != duplicate->variables_.size(); ++n) {
-				duplicate->variables_[n] = deep_clone(duplicate->variables_[n], mapping);
+			for(int n = 0; n != duplicate->variables_->values.size(); ++n) {
+				duplicate->set_variable(n, deep_clone(duplicate->variables_->values[n], mapping));
 			}
 
 			return variant(duplicate.get());
@@ -811,7 +818,7 @@ variant formula_object::deep_clone(variant v, std::map<formula_object*,formula_o
 		return variant(&items);
 	} else if(v.is_map()) {
 		std::map<variant, variant> m;
-		foreach(const variant::map_pair& p, v.as_map()) {
+		foreach(const variant_hash_map::value_type& p, v.as_hash_map()) {
 			m[deep_clone(p.first, mapping)] = deep_clone(p.second, mapping);
 		}
 
@@ -853,15 +860,15 @@ boost::intrusive_ptr<formula_object> formula_object::create(const std::string& t
 }
 
 formula_object::formula_object(const std::string& type, variant args)
-  : class_(get_class(type)), private_data_(-1)
+  : variables_(new variable_storage), class_(get_class(type)), private_data_(-1)
 {
-	variables_.resize(class_->nstate_slots());
+	variables_->values.resize(class_->nstate_slots());
 	foreach(const property_entry& slot, class_->slots()) {
 		if(slot.variable_slot != -1) {
 			if(slot.initializer) {
-				variables_[slot.variable_slot] = slot.initializer->execute(*this);
+				set_variable(slot.variable_slot, slot.initializer->execute(*this));
 			} else {
-				variables_[slot.variable_slot] = deep_copy_variant(slot.default_value);
+				set_variable(slot.variable_slot, deep_copy_variant(slot.default_value));
 			}
 		}
 	}
@@ -908,9 +915,9 @@ void formula_object::call_constructors(variant args)
 }
 
 formula_object::formula_object(variant data)
-  : class_(get_class(data["@class"].as_string())), private_data_(-1)
+  : variables_(new variable_storage), class_(get_class(data["@class"].as_string())), private_data_(-1)
 {
-	variables_.resize(class_->nstate_slots());
+	variables_->values.resize(class_->nstate_slots());
 
 	if(data.is_map() && data["state"].is_map()) {
 		variant state = data["state"];
@@ -921,7 +928,7 @@ formula_object::formula_object(variant data)
 			const property_entry& entry = class_->slots()[itor->second];
 			ASSERT_NE(entry.variable_slot, -1);
 
-			variables_[entry.variable_slot] = p.second;
+			variables_->values[entry.variable_slot] = p.second;
 		}
 	}
 
@@ -948,6 +955,17 @@ boost::intrusive_ptr<formula_object> formula_object::clone() const
 	return boost::intrusive_ptr<formula_object>(new formula_object(*this));
 }
 
+void formula_object::set_variable(int slot, const variant& value)
+{
+	if(variables_->refcount() > 1) {
+		boost::intrusive_ptr<variable_storage> copy(new variable_storage);
+		copy->values = variables_->values;
+		variables_ = copy;
+	}
+
+	variables_->values[slot] = value;
+}
+
 variant formula_object::serialize_to_wml() const
 {
 	std::map<variant, variant> result;
@@ -956,9 +974,9 @@ variant formula_object::serialize_to_wml() const
 	std::map<variant,variant> state;
 	foreach(const property_entry& slot, class_->slots()) {
 		const int nstate_slot = slot.variable_slot;
-		if(nstate_slot != -1 && nstate_slot < variables_.size() &&
-		   variables_[nstate_slot].is_null() == false) {
-			state[variant(slot.name)] = variables_[nstate_slot];
+		if(nstate_slot != -1 && nstate_slot < variables_->values.size() &&
+		   variables_->values[nstate_slot].is_null() == false) {
+			state[variant(slot.name)] = variables_->values[nstate_slot];
 		}
 	}
 
@@ -989,7 +1007,7 @@ variant formula_object::get_value(const std::string& key) const
 	if(expose_private_data_) */ {
 		if(key == "_data") {
 			ASSERT_NE(private_data_, -1);
-			return variables_[private_data_];
+			return variables_->values[private_data_];
 		} else if(key == "value") {
 			return tmp_value_;
 		}
@@ -1020,18 +1038,25 @@ variant formula_object::get_value(const std::string& key) const
 		private_data_scope scope(&private_data_, entry.variable_slot);
 		return entry.getter->execute(*this);
 	} else if(entry.variable_slot != -1) {
-		return variables_[entry.variable_slot];
+		return variables_->values[entry.variable_slot];
 	} else {
 		ASSERT_LOG(false, "ILLEGAL READ PROPERTY ACCESS OF NON-READABLE VARIABLE " << key << " IN CLASS " << class_->name());
 	}
 }
 
+const formula_callable_definition* formula_object::get_slot_definition() const
+{
+	//get_value() finds properties by name in the same layout the class
+	//definition gives them, so the definition's slots can be used directly.
+	return class_->definition();
+}
+
 variant formula_object::get_value_by_slot(int slot) const
 {
 	switch(slot) {
 		case FIELD_PRIVATE: {
 			ASSERT_NE(private_data_, -1);
-			return variables_[private_data_];
+			return variables_->values[private_data_];
 		}
 		case FIELD_VALUE: return tmp_value_;
 		case FIELD_SELF:
@@ -1056,7 +1081,7 @@ variant formula_object::get_value_by_slot(int slot) const
 		private_data_scope scope(&private_data_, entry.variable_slot);
 		return entry.getter->execute(*this);
 	} else if(entry.variable_slot != -1) {
-		return variables_[entry.variable_slot];
+		return variables_->values[entry.variable_slot];
 	} else {
 		ASSERT_LOG(false, "ILLEGAL READ PROPERTY ACCESS OF NON-READABLE VARIABLE IN CLASS " << class_->name());
 	}
@@ -1065,7 +1090,7 @@ variant formula_object::get_value_by_slot(int slot) const
 void formula_object::set_value(const std::string& key, const variant& value)
 {
 	if(private_data_ != -1 && key == "_data") {
-		variables_[private_data_] = value;
+		set_variable(private_data_, value);
 		return;
 	}
 
@@ -1082,7 +1107,7 @@ void formula_object::set_value_by_slot(int slot, const variant& value)
 		switch(slot) {
 		case FIELD_PRIVATE:
 			ASSERT_NE(private_data_, -1);
-			variables_[private_data_] = value;
+			set_variable(private_data_, value);
 			return;
 		default:
 			ASSERT_LOG(false, "TRIED TO SET ILLEGAL KEY IN CLASS: " << BaseFields[slot]);
@@ -1105,7 +1130,7 @@ void formula_object::set_value_by_slot(int slot, const variant& value)
 		private_data_scope scope(&private_data_, entry.variable_slot);
 		execute_command(entry.setter->execute(*this));
 	} else if(entry.variable_slot != -1) {
-		variables_[entry.variable_slot] = value;
+		set_variable(entry.variable_slot, value);
 	} else {
 		ASSERT_LOG(false, "ILLEGAL WRITE PROPERTY ACCESS OF NON-WRITABLE VARIABLE " << entry.name << " IN CLASS " << class_->name());
 	}
@@ -1127,7 +1152,7 @@ void formula_object::set_value_by_slot(int slot, const variant& value)
 			var = entry.getter->execute(*this);
 		} else {
 			ASSERT_NE(entry.variable_slot, -1);
-			var = variables_[entry.variable_slot];
+			var = variables_->values[entry.variable_slot];
 		}
 
 		ASSERT_LOG(entry.get_type->match(var), "AFTER WRITE TO " << entry.name << " IN CLASS " << class_->name() << " TYPE IS INVALID. EXPECTED " << entry.get_type->str() << " BUT FOUND " << var.write_json());
@@ -1162,7 +1187,7 @@ void formula_object::validate() const
 			value = entry.getter->execute(*this);
 		} else if(entry.variable_slot != -1) {
 			private_data_scope scope(&private_data_, entry.variable_slot);
-			value = variables_[entry.variable_slot];
+			value = variables_->values[entry.variable_slot];
 		} else {
 			++index;
 			continue;
@@ -1338,3 +1363,32 @@ formula_callable_ptr get_library_object()
 
 }
 
+UNIT_TEST(formula_object_clone_variables)
+{
+	using game_logic::formula_object;
+	boost::intrusive_ptr<formula_object> obj = formula_object::create("clone_test");
+	boost::intrusive_ptr<formula_object> a = obj->clone();
+	boost::intrusive_ptr<formula_object> b = obj->clone();
+
+	//clones share variables until written.
+	CHECK(a->shares_variables_with(*obj), "clone doesn't share variables");
+	CHECK(b->shares_variables_with(*obj), "clone doesn't share variables");
+
+	a->mutate_value("a", variant(5));
+	CHECK(!a->shares_variables_with(*obj), "written clone still shares variables");
+	CHECK(b->shares_variables_with(*obj), "unwritten clone doesn't share variables");
+	CHECK_EQ(a->query_value("a"), variant(5));
+	CHECK_EQ(a->query_value("b"), variant(2));
+	CHECK_EQ(b->query_value("a"), variant(1));
+	CHECK_EQ(obj->query_value("a"), variant(1));
+
+	b->mutate_value("b", variant(7));
+	CHECK_EQ(b->query_value("b"), variant(7));
+	CHECK_EQ(a->query_value("b"), variant(2));
+	CHECK_EQ(obj->query_value("b"), variant(2));
+
+	obj->mutate_value("a", variant(9));
+	CHECK_EQ(obj->query_value("a"), variant(9));
+	CHECK_EQ(a->query_value("a"), variant(5));
+	CHECK_EQ(b->query_value("a"), variant(1));
+}
@@ -60,6 +60,10 @@ public:
 
 	boost::intrusive_ptr<formula_object> clone() const;
 
+	//true if this and o use the same variable storage, as a clone does
+	//until either is written.
+	bool shares_variables_with(const formula_object& o) const { return variables_ == o.variables_; }
+
 	void validate() const;
 private:
 	//construct with type and constructor parameters.
@@ -74,12 +78,25 @@ private:
 	void set_value(const std::string& key, const variant& value);
 	void set_value_by_slot(int slot, const variant& value);
 
+	const formula_callable_definition* get_slot_definition() const;
+
 	void get_inputs(std::vector<formula_input>* inputs) const;
 
+	//writes a variable, first making a copy of the variables if they are
+	//shared with a clone.
+	void set_variable(int slot, const variant& value);
+
 	//overrides of the class's read-only properties.
 	std::vector<formula_ptr> property_overrides_;
 
-	std::vector<variant> variables_;
+	//the values of the class's variables, indexed by the variable slot of
+	//each property. A clone shares the storage with the object it was
+	//cloned from until either of them writes to a variable.
+	struct variable_storage : public reference_counted_object {
+		std::vector<variant> values;
+	};
+
+	boost::intrusive_ptr<variable_storage> variables_;
 
 	boost::intrusive_ptr<const formula_class> class_;
 
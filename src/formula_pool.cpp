@@ -0,0 +1,179 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "formula_allocation_counter.hpp"
+#include "formula_pool.hpp"
+#include "preferences.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace {
+PREF_INT(formula_pool, 1);
+
+//the number of free blocks of each size kept at the end of a frame.
+PREF_INT(formula_pool_max_free, 4096);
+
+const size_t Granularity = 16;
+const size_t MaxPooledSize = 256;
+const int NumSizeClasses = MaxPooledSize/Granularity;
+
+//freed blocks are linked through their own storage.
+struct free_block {
+	free_block* next;
+};
+
+struct size_class {
+	size_class() : head(NULL), count(0) {}
+	free_block* head;
+	int count;
+};
+
+size_class free_lists[NumSizeClasses];
+
+bool have_owner = false;
+Uint32 owner_thread;
+
+formula_pool::frame_stats current_stats, last_stats;
+
+//returns the size class blocks of the given size belong to, or -1 if
+//blocks this size aren't pooled.
+int get_size_class(size_t size)
+{
+	if(size == 0 || size > MaxPooledSize) {
+		return -1;
+	}
+
+	return (size - 1)/Granularity;
+}
+
+size_t block_size(int size_class)
+{
+	return (size_class + 1)*Granularity;
+}
+
+bool on_owner_thread()
+{
+	return have_owner && threading::get_current_thread_id() == owner_thread;
+}
+}
+
+namespace formula_pool
+{
+
+void* allocate(size_t size)
+{
+#ifdef FORMULA_ALLOCATION_COUNTING
+	if(on_owner_thread()) {
+		formula_allocation_counter::record(size);
+	}
+#endif
+
+	const int index = get_size_class(size);
+	if(index == -1) {
+		return ::operator new(size);
+	}
+
+	if(on_owner_thread()) {
+		++current_stats.allocations;
+
+		size_class& c = free_lists[index];
+		if(c.head && g_formula_pool) {
+			free_block* result = c.head;
+			c.head = result->next;
+			--c.count;
+			return result;
+		}
+
+		++current_stats.heap_allocations;
+	}
+
+	//blocks are always allocated at the full size of their class, so they
+	//can go into a free list no matter which thread frees them.
+	return ::operator new(block_size(index));
+}
+
+void deallocate(void* p, size_t size)
+{
+	if(p == NULL) {
+		return;
+	}
+
+	const int index = get_size_class(size);
+	if(index != -1 && g_formula_pool && on_owner_thread()) {
+		size_class& c = free_lists[index];
+		free_block* block = static_cast<free_block*>(p);
+		block->next = c.head;
+		c.head = block;
+		++c.count;
+		return;
+	}
+
+	::operator delete(p);
+}
+
+void end_frame()
+{
+	if(!have_owner) {
+		owner_thread = threading::get_current_thread_id();
+		have_owner = true;
+	}
+
+	for(int n = 0; n != NumSizeClasses; ++n) {
+		size_class& c = free_lists[n];
+		while(c.count > g_formula_pool_max_free) {
+			free_block* block = c.head;
+			c.head = block->next;
+			--c.count;
+			::operator delete(block);
+		}
+	}
+
+	last_stats = current_stats;
+	current_stats = frame_stats();
+
+#ifdef FORMULA_ALLOCATION_COUNTING
+	formula_allocation_counter::end_frame();
+#endif
+}
+
+const frame_stats& last_frame()
+{
+	return last_stats;
+}
+
+}
+
+UNIT_TEST(formula_pool_recycles_blocks)
+{
+	formula_pool::end_frame();
+
+	void* a = formula_pool::allocate(40);
+	formula_pool::deallocate(a, 40);
+
+	//48 bytes is in the same size class as 40.
+	void* b = formula_pool::allocate(48);
+	if(g_formula_pool) {
+		CHECK_EQ(a, b);
+	}
+
+	formula_pool::deallocate(b, 48);
+
+	void* large = formula_pool::allocate(MaxPooledSize*2);
+	formula_pool::deallocate(large, MaxPooledSize*2);
+
+	formula_pool::end_frame();
+	CHECK_EQ(formula_pool::last_frame().allocations, 2);
+}
@@ -0,0 +1,58 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FORMULA_POOL_HPP_INCLUDED
+#define FORMULA_POOL_HPP_INCLUDED
+
+#include <cstddef>
+
+//A recycling allocator for the small objects formulas create and destroy
+//in large numbers while handling events, such as lists, maps and
+//temporary callables. Blocks freed on the main thread are kept in free
+//lists and reused, and the excess is released at the end of each frame.
+//Every block comes from the general heap, so objects which escape an
+//event, or are created or destroyed on other threads, need no special
+//treatment.
+namespace formula_pool
+{
+
+void* allocate(size_t size);
+void deallocate(void* p, size_t size);
+
+//called by the main loop once per frame. The first call makes the calling
+//thread the one the pool serves.
+void end_frame();
+
+//allocation counts for the most recently completed frame. 'allocations'
+//is how many pooled objects were created, 'heap_allocations' is how many
+//of those had to go to the general heap.
+struct frame_stats {
+	frame_stats() : allocations(0), heap_allocations(0) {}
+	int allocations;
+	int heap_allocations;
+};
+
+const frame_stats& last_frame();
+
+}
+
+//placed in a class definition to allocate instances of the class, and of
+//classes derived from it, from the pool.
+#define FORMULA_POOL_ALLOCATED \
+	static void* operator new(size_t size) { return formula_pool::allocate(size); } \
+	static void operator delete(void* p, size_t size) { formula_pool::deallocate(p, size); }
+
+#endif
@@ -16,9 +16,11 @@
 */
 #ifndef DISABLE_FORMULA_PROFILER
 
+#include <SDL.h>
 #include <SDL_thread.h>
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <string>
@@ -38,9 +40,19 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
+#include "json_parser.hpp"
 #include "object_events.hpp"
+#include "preferences.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
 #include "variant.hpp"
 
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
 namespace formula_profiler
 {
 
@@ -54,25 +66,242 @@ struct InstrumentationRecord {
 };
 
 std::map<const char*, InstrumentationRecord> g_instrumentation;
+
+PREF_STRING(trace_output, "");
+
+//the number of events kept for each thread. Must be a power of two.
+PREF_INT(trace_buffer_size, 65536);
+
+bool tracing = false;
+uint64_t trace_start_ns = 0;
+int trace_frame_number = 0;
+
+struct trace_event {
+	//instruments are recorded as complete events, frames as instant ones.
+	enum TYPE { INSTRUMENT, FRAME };
+	TYPE type;
+	const char* name;
+
+	//the object and event being handled when the instrument ran, if any.
+	//The type's id is copied since the type may be gone by export.
+	std::string object_type;
+	int event_id;
+
+	uint64_t begin_ns, end_ns;
+	int frame_number;
+};
+
+struct trace_buffer {
+	trace_buffer(int size, int thread_id, bool main) : events(size), next(0), thread_id(thread_id), is_main_thread(main)
+	{}
+
+	std::vector<trace_event> events;
+
+	//the number of events ever written. The most recent events are kept.
+	unsigned int next;
+	int thread_id;
+	bool is_main_thread;
+
+	trace_event& add() {
+		trace_event& e = events[next&(events.size()-1)];
+		++next;
+		return e;
+	}
+};
+
+TRACE_THREAD_LOCAL trace_buffer* thread_trace_buffer = NULL;
+int trace_main_thread = 0;
+
+//every thread's buffer. Only locked when a thread makes its buffer and
+//when exporting, never while recording.
+threading::mutex& trace_buffers_mutex() {
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
+
+std::vector<trace_buffer*> trace_buffers;
+
+trace_buffer* get_thread_trace_buffer() {
+	if(thread_trace_buffer == NULL) {
+		int size = 1;
+		while(size < g_trace_buffer_size) {
+			size *= 2;
+		}
+
+		const int thread_id = SDL_ThreadID();
+		thread_trace_buffer = new trace_buffer(size, thread_id, thread_id == trace_main_thread);
+
+		threading::lock lck(trace_buffers_mutex());
+		trace_buffers.push_back(thread_trace_buffer);
+	}
+
+	return thread_trace_buffer;
+}
+
+void record_instrument(const char* id, uint64_t begin_ns, uint64_t end_ns) {
+	trace_buffer* buf = get_thread_trace_buffer();
+	trace_event& e = buf->add();
+	e.type = trace_event::INSTRUMENT;
+	e.name = id;
+	e.object_type.clear();
+	e.event_id = -1;
+	e.begin_ns = begin_ns;
+	e.end_ns = end_ns;
+	e.frame_number = trace_frame_number;
+
+	//the event call stack belongs to the main thread.
+	if(buf->is_main_thread && event_call_stack.empty() == false) {
+		e.object_type = event_call_stack.back().type->id();
+		e.event_id = event_call_stack.back().event_id;
+	}
 }
 
-instrument::instrument(const char* id) : id_(id)
+void write_json_string(std::ostream& s, const std::string& str) {
+	s << '"';
+	foreach(char c, str) {
+		if(c == '"' || c == '\\') {
+			s << '\\';
+		}
+		s << c;
+	}
+	s << '"';
+}
+}
+
+uint64_t get_time_ns()
 {
-	if(profiler_on) {
-		gettimeofday(&tv_, NULL);
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	static const uint64_t frequency = SDL_GetPerformanceFrequency();
+	const uint64_t counter = SDL_GetPerformanceCounter();
+	return (counter/frequency)*1000000000ULL + ((counter%frequency)*1000000000ULL)/frequency;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return uint64_t(tv.tv_sec)*1000000000ULL + uint64_t(tv.tv_usec)*1000ULL;
+#endif
+}
+
+instrument::instrument(const char* id) : id_(id), begin_ns_(0)
+{
+	if(profiler_on || tracing) {
+		begin_ns_ = get_time_ns();
 	}
 }
 
 instrument::~instrument()
 {
+	if(begin_ns_ == 0) {
+		return;
+	}
+
+	const uint64_t end_ns = get_time_ns();
 	if(profiler_on) {
-		struct timeval end_tv;
-		gettimeofday(&end_tv, NULL);
-		const int time_us = (end_tv.tv_sec - tv_.tv_sec)*1000000 + (end_tv.tv_usec - tv_.tv_usec);
 		InstrumentationRecord& r = g_instrumentation[id_];
-		r.time_us += (end_tv.tv_sec - tv_.tv_sec)*1000000 + (end_tv.tv_usec - tv_.tv_usec);
+		r.time_us += int((end_ns - begin_ns_)/1000);
 		r.nsamples++;
 	}
+
+	if(tracing) {
+		record_instrument(id_, begin_ns_, end_ns);
+	}
+}
+
+void start_tracing()
+{
+	if(tracing) {
+		return;
+	}
+
+	trace_main_thread = SDL_ThreadID();
+	trace_start_ns = get_time_ns();
+	trace_frame_number = 0;
+
+	threading::lock lck(trace_buffers_mutex());
+	foreach(trace_buffer* buf, trace_buffers) {
+		buf->next = 0;
+		buf->is_main_thread = buf->thread_id == trace_main_thread;
+	}
+
+	tracing = true;
+}
+
+void stop_tracing()
+{
+	tracing = false;
+}
+
+bool is_tracing()
+{
+	return tracing;
+}
+
+void mark_frame()
+{
+	if(!tracing) {
+		return;
+	}
+
+	trace_event& e = get_thread_trace_buffer()->add();
+	e.type = trace_event::FRAME;
+	e.name = "FRAME";
+	e.object_type.clear();
+	e.event_id = -1;
+	e.begin_ns = e.end_ns = get_time_ns();
+	e.frame_number = ++trace_frame_number;
+}
+
+std::string get_chrome_trace()
+{
+	std::ostringstream s;
+	s << "{\"traceEvents\":[";
+
+	bool first = true;
+
+	threading::lock lck(trace_buffers_mutex());
+	foreach(const trace_buffer* buf, trace_buffers) {
+		const unsigned int nevents = std::min<unsigned int>(buf->next, buf->events.size());
+		for(unsigned int n = buf->next - nevents; n != buf->next; ++n) {
+			const trace_event& e = buf->events[n&(buf->events.size()-1)];
+			if(e.begin_ns < trace_start_ns) {
+				continue;
+			}
+
+			if(!first) {
+				s << ",";
+			}
+
+			first = false;
+
+			//events inside an object's event handler are named after the
+			//object and event, as in profiles. Timestamps are in microseconds.
+			s << "\n{\"name\":";
+			if(!e.object_type.empty()) {
+				write_json_string(s, formatter() << e.object_type << ":" << get_object_event_str(e.event_id) << ":" << e.name);
+			} else {
+				write_json_string(s, e.name);
+			}
+			s << ",\"cat\":";
+			write_json_string(s, e.name);
+			s << ",\"pid\":1,\"tid\":" << buf->thread_id << ",\"ts\":" << double(e.begin_ns - trace_start_ns)/1000.0;
+			if(e.type == trace_event::FRAME) {
+				s << ",\"ph\":\"i\",\"s\":\"g\"";
+			} else {
+				s << ",\"ph\":\"X\",\"dur\":" << double(e.end_ns - e.begin_ns)/1000.0;
+			}
+
+			s << ",\"args\":{\"frame\":" << e.frame_number;
+			if(!e.object_type.empty()) {
+				s << ",\"object\":";
+				write_json_string(s, e.object_type);
+				s << ",\"event\":";
+				write_json_string(s, get_object_event_str(e.event_id));
+			}
+			s << "}}";
+		}
+	}
+
+	s << "\n]}\n";
+	return s.str();
 }
 
 void dump_instrumentation()
@@ -111,13 +340,18 @@ int main_thread;
 
 int empty_samples = 0;
 
-std::map<std::vector<CallStackEntry>, int> expression_call_stack_samples;
-std::vector<CallStackEntry> current_expression_call_stack;
-
 std::vector<custom_object_event_frame> event_call_stack_samples;
 int num_samples = 0;
 const size_t max_samples = 10000;
 
+//the FFL expression call stack of every sample, stored one after another
+//in a buffer allocated before sampling starts. Sample n's stack is the
+//sample_stack_size[n] entries starting at sample_stack_begin[n].
+std::vector<const game_logic::formula_expression*> sample_stack_entries;
+std::vector<int> sample_stack_begin, sample_stack_size;
+int num_sample_stack_entries = 0;
+const size_t max_sample_stack_entries = 1 << 20;
+
 int nframes_profiled = 0;
 
 #if defined(_WINDOWS) || TARGET_OS_IPHONE
@@ -142,11 +376,6 @@ void sigprof_handler(int sig)
 	}
 #endif
 
-	if(current_expression_call_stack.empty() && current_expression_call_stack.capacity() >= get_expression_call_stack().size()) {
-		//Very important that this doesnot allocate memory.
-		current_expression_call_stack = get_expression_call_stack();
-	}
-
 	if(num_samples == max_samples) {
 #if defined(_WINDOWS) || TARGET_OS_IPHONE
 		return interval;
@@ -158,6 +387,21 @@ void sigprof_handler(int sig)
 	if(event_call_stack.empty()) {
 		++empty_samples;
 	} else {
+		//Very important that this does not allocate memory. A stack that
+		//doesn't fit is recorded as empty.
+		const std::vector<CallStackEntry>& stack = get_expression_call_stack();
+		int stack_size = 0;
+		if(num_sample_stack_entries + stack.size() <= max_sample_stack_entries) {
+			stack_size = stack.size();
+			for(int n = 0; n != stack_size; ++n) {
+				sample_stack_entries[num_sample_stack_entries + n] = stack[n].expression;
+			}
+		}
+
+		sample_stack_begin[num_samples] = num_sample_stack_entries;
+		sample_stack_size[num_samples] = stack_size;
+		num_sample_stack_entries += stack_size;
+
 		event_call_stack_samples[num_samples++] = event_call_stack.back();
 	}
 #if defined(_WINDOWS) || TARGET_OS_IPHONE
@@ -169,9 +413,15 @@ void sigprof_handler(int sig)
 
 manager::manager(const char* output_file)
 {
+	if(g_trace_output.empty() == false) {
+		start_tracing();
+	}
+
 	if(output_file) {
-		current_expression_call_stack.reserve(10000);
 		event_call_stack_samples.resize(max_samples);
+		sample_stack_begin.resize(max_samples);
+		sample_stack_size.resize(max_samples);
+		sample_stack_entries.resize(max_sample_stack_entries);
 
 		main_thread = SDL_GetThreadID(NULL);
 
@@ -200,6 +450,11 @@ manager::manager(const char* output_file)
 manager::~manager()
 {
 	end_profiling();
+
+	if(g_trace_output.empty() == false && tracing) {
+		stop_tracing();
+		sys::write_file(g_trace_output, get_chrome_trace());
+	}
 }
 
 void end_profiling()
@@ -215,6 +470,13 @@ void end_profiling()
 
 		std::map<std::string, int> samples_map;
 
+		//samples as folded stacks, the input format of flame graph tools:
+		//one line per distinct stack, with frames separated by ';',
+		//followed by the number of samples of that stack.
+		std::map<std::string, int> folded_stacks;
+		folded_stacks["CORE_ENGINE"] = empty_samples;
+
+		std::map<const game_logic::formula_expression*, std::string> expression_locations;
 
 		for(int n = 0; n != num_samples; ++n) {
 			const custom_object_event_frame& frame = event_call_stack_samples[n];
@@ -222,6 +484,19 @@ void end_profiling()
 			std::string str = formatter() << frame.type->id() << ":" << get_object_event_str(frame.event_id) << ":" << (frame.executing_commands ? "CMD" : "FFL");
 
 			samples_map[str]++;
+
+			for(int i = sample_stack_begin[n]; i != sample_stack_begin[n] + sample_stack_size[n]; ++i) {
+				const game_logic::formula_expression* expr = sample_stack_entries[i];
+				std::map<const game_logic::formula_expression*, std::string>::iterator loc = expression_locations.find(expr);
+				if(loc == expression_locations.end()) {
+					const std::string location = formatter() << expr->debug_short_location() << " " << expr->name();
+					loc = expression_locations.insert(std::make_pair(expr, location)).first;
+				}
+
+				str += ";" + loc->second;
+			}
+
+			folded_stacks[str]++;
 		}
 
 		std::vector<std::pair<int, std::string> > sorted_samples, cum_sorted_samples;
@@ -251,20 +526,20 @@ void end_profiling()
 
 		int total_expr_samples = 0;
 
-		for(std::map<std::vector<CallStackEntry>, int>::const_iterator i = expression_call_stack_samples.begin(); i != expression_call_stack_samples.end(); ++i) {
-			const std::vector<CallStackEntry>& sample = i->first;
-			const int nsamples = i->second;
-			if(sample.empty()) {
+		for(int n = 0; n != num_samples; ++n) {
+			const int begin = sample_stack_begin[n];
+			const int end = begin + sample_stack_size[n];
+			if(begin == end) {
 				continue;
 			}
 
-			foreach(const CallStackEntry& entry, sample) {
-				cum_expr_samples[entry.expression] += nsamples;
+			for(int i = begin; i != end; ++i) {
+				cum_expr_samples[sample_stack_entries[i]]++;
 			}
 
-			expr_samples[sample.back().expression] += nsamples;
+			expr_samples[sample_stack_entries[end-1]]++;
 
-			total_expr_samples += nsamples;
+			++total_expr_samples;
 		}
 
 		for(std::map<const game_logic::formula_expression*, int>::const_iterator i = expr_samples.begin(); i != expr_samples.end(); ++i) {
@@ -292,8 +567,16 @@ void end_profiling()
 			s << (100*cum_sorted_samples[n].first)/total_expr_samples << "% (" << cum_sorted_samples[n].first << ") " << cum_sorted_samples[n].second << "\n";
 		}
 
+		std::ostringstream folded;
+		for(std::map<std::string, int>::const_iterator i = folded_stacks.begin(); i != folded_stacks.end(); ++i) {
+			if(i->second) {
+				folded << i->first << " " << i->second << "\n";
+			}
+		}
+
 		if(!output_fname.empty()) {
 			sys::write_file(output_fname, s.str());
+			sys::write_file(output_fname + ".folded", folded.str());
 		} else {
 			std::cerr << "===\n=== PROFILE REPORT ===\n";
 			std::cerr << s.str();
@@ -311,11 +594,6 @@ void pump()
 		dump_instrumentation();
 	}
 
-	if(current_expression_call_stack.empty() == false) {
-		expression_call_stack_samples[current_expression_call_stack]++;
-		current_expression_call_stack.clear();
-	}
-
 	++nframes_profiled;
 }
 
@@ -373,4 +651,26 @@ std::string get_profile_summary()
 
 }
 
+UNIT_TEST(formula_profiler_chrome_trace) {
+	formula_profiler::start_tracing();
+	{
+		formula_profiler::instrument instrumentation("TEST_INSTRUMENT");
+	}
+	formula_profiler::mark_frame();
+	formula_profiler::stop_tracing();
+
+	//events recorded while tracing is stopped are ignored.
+	{
+		formula_profiler::instrument instrumentation("UNRECORDED_INSTRUMENT");
+	}
+
+	const variant trace = json::parse(formula_profiler::get_chrome_trace(), json::JSON_NO_PREPROCESSOR);
+	const variant events = trace["traceEvents"];
+	CHECK_EQ(events.num_elements(), 2);
+	CHECK_EQ(events[0]["name"], variant("TEST_INSTRUMENT"));
+	CHECK_EQ(events[0]["ph"], variant("X"));
+	CHECK_EQ(events[1]["name"], variant("FRAME"));
+	CHECK_EQ(events[1]["args"]["frame"], variant(1));
+}
+
 #endif
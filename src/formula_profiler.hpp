@@ -49,10 +49,18 @@ class suspend_scope
 
 inline std::string get_profile_summary() { return ""; }
 
+inline void start_tracing() {}
+inline void stop_tracing() {}
+inline bool is_tracing() { return false; }
+inline void mark_frame() {}
+inline std::string get_chrome_trace() { return ""; }
+
 }
 
 #else
 
+#include <stdint.h>
+
 #include <vector>
 
 #if defined(_WINDOWS)
@@ -66,6 +74,9 @@ class custom_object_type;
 namespace formula_profiler
 {
 
+//a monotonic, high resolution clock, in nanoseconds.
+uint64_t get_time_ns();
+
 //instruments inside a given scope.
 class instrument
 {
@@ -74,7 +85,7 @@ public:
 	~instrument();
 private:
 	const char* id_;
-	struct timeval tv_;
+	uint64_t begin_ns_;
 };
 
 void dump_instrumentation();
@@ -113,6 +124,23 @@ private:
 
 std::string get_profile_summary();
 
+//The trace recorder keeps a timeline of instruments and frames in a ring
+//buffer for each thread. The owning thread is the only writer of each
+//buffer, so recording takes no locks. The timeline can be exported in
+//Chrome's trace event format and viewed in chrome://tracing.
+//Setting the trace_output preference records a trace of the whole run
+//into that file.
+void start_tracing();
+void stop_tracing();
+bool is_tracing();
+
+//records the start of a new frame. Called by the main loop.
+void mark_frame();
+
+//the recorded events as a Chrome trace event JSON document. Tracing
+//should be stopped first, so no buffer is written while it is read.
+std::string get_chrome_trace();
+
 }
 
 #endif
@@ -22,10 +22,10 @@
 namespace game_logic
 {
 
-formula_variable_storage::formula_variable_storage() : disallow_new_keys_(false)
+formula_variable_storage::formula_variable_storage() : disallow_new_keys_(false), version_(0)
 {}
 
-formula_variable_storage::formula_variable_storage(const std::map<std::string, variant>& m) : disallow_new_keys_(false)
+formula_variable_storage::formula_variable_storage(const std::map<std::string, variant>& m) : disallow_new_keys_(false), version_(0)
 {
 	for(std::map<std::string, variant>::const_iterator i = m.begin(); i != m.end(); ++i) {
 		add(i->first, i->second);
@@ -76,6 +76,14 @@ variant formula_variable_storage::write() const
 
 void formula_variable_storage::add(const std::string& key, const variant& value)
 {
+	++version_;
+	if(key_hash_) {
+		const int slot = key_hash_->find(key);
+		ASSERT_LOG(slot != -1, "UNKNOWN KEY SET IN VAR STORAGE: " << key);
+		values_[slot] = value;
+		return;
+	}
+
 	std::map<std::string,int>::const_iterator i = strings_to_values_.find(key);
 	if(i != strings_to_values_.end()) {
 		values_[i->second] = value;
@@ -95,6 +103,12 @@ void formula_variable_storage::add(const formula_variable_storage& value)
 
 variant formula_variable_storage::get_value(const std::string& key) const
 {
+	if(key_hash_) {
+		const int slot = key_hash_->find(key);
+		ASSERT_LOG(slot != -1, "UNKNOWN KEY ACCESSED IN VAR STORAGE: " << key);
+		return values_[slot];
+	}
+
 	std::map<std::string,int>::const_iterator i = strings_to_values_.find(key);
 	if(i != strings_to_values_.end()) {
 		return values_[i->second];
@@ -116,6 +130,7 @@ void formula_variable_storage::set_value(const std::string& key, const variant&
 
 void formula_variable_storage::set_value_by_slot(int slot, const variant& value)
 {
+	++version_;
 	values_[slot] = value;
 }
 
@@ -126,6 +141,64 @@ void formula_variable_storage::get_inputs(std::vector<formula_input>* inputs) co
 	}
 }
 
+namespace {
+boost::shared_ptr<const perfect_hash> build_key_hash(const std::vector<std::string>& keys, const std::vector<int>& slots)
+{
+	boost::shared_ptr<perfect_hash> result(new perfect_hash);
+	if(!result->build(keys, slots) || result->empty()) {
+		return boost::shared_ptr<const perfect_hash>();
+	}
+
+	return result;
+}
+}
+
+boost::shared_ptr<const perfect_hash> formula_variable_storage::create_key_hash(const std::map<std::string, variant>& m)
+{
+	//keys are given slots in order, as add() does when constructing.
+	std::vector<std::string> keys;
+	std::vector<int> slots;
+	for(std::map<std::string, variant>::const_iterator i = m.begin(); i != m.end(); ++i) {
+		slots.push_back(keys.size());
+		keys.push_back(i->first);
+	}
+
+	return build_key_hash(keys, slots);
+}
+
+void formula_variable_storage::disallow_new_keys(bool value, const boost::shared_ptr<const perfect_hash>& key_hash)
+{
+	disallow_new_keys_ = value;
+	key_hash_.reset();
+	if(!value) {
+		return;
+	}
+
+	if(key_hash && key_hash->size() == strings_to_values_.size()) {
+		bool matches = true;
+		for(std::map<std::string, int>::const_iterator i = strings_to_values_.begin(); i != strings_to_values_.end(); ++i) {
+			if(key_hash->find(i->first) != i->second) {
+				matches = false;
+				break;
+			}
+		}
+
+		if(matches) {
+			key_hash_ = key_hash;
+			return;
+		}
+	}
+
+	std::vector<std::string> keys;
+	std::vector<int> slots;
+	for(std::map<std::string, int>::const_iterator i = strings_to_values_.begin(); i != strings_to_values_.end(); ++i) {
+		keys.push_back(i->first);
+		slots.push_back(i->second);
+	}
+
+	key_hash_ = build_key_hash(keys, slots);
+}
+
 std::vector<std::string> formula_variable_storage::keys() const
 {
 	std::vector<std::string> result;
@@ -18,8 +18,10 @@
 #define FORMULA_VARIABLE_STORAGE_HPP_INCLUDED
 
 #include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "formula_callable.hpp"
+#include "perfect_hash.hpp"
 #include "variant.hpp"
 
 namespace game_logic
@@ -38,12 +40,22 @@ public:
 	void add(const std::string& key, const variant& value);
 	void add(const formula_variable_storage& value);
 
-	std::vector<variant>& values() { return values_; }
+	std::vector<variant>& values() { ++version_; return values_; }
 	const std::vector<variant>& values() const { return values_; }
 
+	//a counter which changes whenever any value may have been written.
+	unsigned int version() const { return version_; }
+
 	std::vector<std::string> keys() const;
 
-	void disallow_new_keys(bool value=true) { disallow_new_keys_ = value; }
+	//a perfect hash of the keys of a storage constructed from m, which can
+	//be shared by all storages with those keys.
+	static boost::shared_ptr<const perfect_hash> create_key_hash(const std::map<std::string, variant>& m);
+
+	//once new keys are disallowed the key set is fixed, and a perfect hash
+	//of it is used for lookups by name. key_hash is used if it matches our
+	//keys, otherwise a hash is built for this storage.
+	void disallow_new_keys(bool value=true, const boost::shared_ptr<const perfect_hash>& key_hash=boost::shared_ptr<const perfect_hash>());
 
 private:
 	variant get_value(const std::string& key) const;
@@ -55,8 +67,10 @@ private:
 	
 	std::vector<variant> values_;
 	std::map<std::string, int> strings_to_values_;
+	boost::shared_ptr<const perfect_hash> key_hash_;
 
 	bool disallow_new_keys_;
+	unsigned int version_;
 };
 
 typedef boost::intrusive_ptr<formula_variable_storage> formula_variable_storage_ptr;
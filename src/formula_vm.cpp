@@ -0,0 +1,371 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <sstream>
+
+#include "asserts.hpp"
+#include "decimal.hpp"
+#include "formula.hpp"
+#include "formula_callable.hpp"
+#include "formula_function.hpp"
+#include "formula_vm.hpp"
+#include "preferences.hpp"
+#include "unit_test.hpp"
+
+namespace {
+PREF_INT(ffl_vm, 1);
+
+//programs using no more than this many registers run without allocating.
+const int MaxStackRegisters = 16;
+
+const char* OpcodeNames[] = {
+	"MOVE", "LOAD_SLOT", "EVAL", "NOT", "NEG",
+	"ADD", "SUB", "MUL", "DIV", "MOD", "POW",
+	"EQ", "NEQ", "LT", "GT", "LTE", "GTE",
+	"IN", "NOT_IN", "LIST", "JMP", "JMP_IF_FALSE", "JMP_IF_TRUE",
+	"RETURN",
+};
+}
+
+namespace formula_vm
+{
+
+using game_logic::formula_callable;
+using game_logic::formula_expression;
+
+variant program::execute(const formula_callable& variables) const
+{
+#if !TARGET_OS_IPHONE
+	call_stack_manager manager(root_.get(), &variables);
+#endif
+
+	variant stack_registers[MaxStackRegisters];
+	std::vector<variant> heap_registers;
+	variant* reg = stack_registers;
+	if(nregisters_ > MaxStackRegisters) {
+		heap_registers.resize(nregisters_);
+		reg = &heap_registers[0];
+	}
+
+	const variant* constants = constants_.empty() ? NULL : &constants_[0];
+	const instruction* code = &code_[0];
+	const instruction* ip = code;
+
+#define OPERAND(n) ((n) >= 0 ? reg[(n)] : constants[-1 - (n)])
+
+	for(;;) {
+		const instruction& i = *ip++;
+		switch(i.op) {
+		case OP_MOVE:
+			reg[i.dst] = OPERAND(i.a);
+			break;
+		case OP_LOAD_SLOT:
+			reg[i.dst] = variables.query_value_by_slot(i.a);
+			break;
+		case OP_EVAL:
+			reg[i.dst] = fallbacks_[i.a]->evaluate(variables);
+			break;
+		case OP_NOT:
+			reg[i.dst] = variant::from_bool(!OPERAND(i.a).as_bool());
+			break;
+		case OP_NEG:
+			reg[i.dst] = -OPERAND(i.a);
+			break;
+		case OP_ADD:
+			reg[i.dst] = OPERAND(i.a) + OPERAND(i.b);
+			break;
+		case OP_SUB:
+			reg[i.dst] = OPERAND(i.a) - OPERAND(i.b);
+			break;
+		case OP_MUL:
+			reg[i.dst] = OPERAND(i.a) * OPERAND(i.b);
+			break;
+		case OP_DIV: {
+			//same divide-by-zero guard as operator_expression.
+			const variant& right = OPERAND(i.b);
+			if(right == variant(0)) {
+				reg[i.dst] = OPERAND(i.a) / variant(decimal::epsilon());
+			} else {
+				reg[i.dst] = OPERAND(i.a) / right;
+			}
+			break;
+		}
+		case OP_MOD:
+			reg[i.dst] = OPERAND(i.a) % OPERAND(i.b);
+			break;
+		case OP_POW:
+			reg[i.dst] = OPERAND(i.a) ^ OPERAND(i.b);
+			break;
+		case OP_EQ:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) == OPERAND(i.b));
+			break;
+		case OP_NEQ:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) != OPERAND(i.b));
+			break;
+		case OP_LT:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) < OPERAND(i.b));
+			break;
+		case OP_GT:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) > OPERAND(i.b));
+			break;
+		case OP_LTE:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) <= OPERAND(i.b));
+			break;
+		case OP_GTE:
+			reg[i.dst] = variant::from_bool(OPERAND(i.a) >= OPERAND(i.b));
+			break;
+		case OP_IN:
+		case OP_NOT_IN: {
+			const bool result = i.op == OP_IN;
+			const variant& left = OPERAND(i.a);
+			const variant& right = OPERAND(i.b);
+			if(right.is_list()) {
+				bool found = false;
+				for(int n = 0; n != right.num_elements(); ++n) {
+					if(left == right[n]) {
+						found = true;
+						break;
+					}
+				}
+
+				reg[i.dst] = variant::from_bool(found ? result : !result);
+			} else if(right.is_map()) {
+				reg[i.dst] = variant(right.has_key(left) ? result : !result);
+			} else {
+				ASSERT_LOG(false, "ILLEGAL OPERAND TO 'in': " << right.write_json() << " AT " << sources_[ip - code - 1]->debug_pinpoint_location());
+			}
+			break;
+		}
+		case OP_LIST: {
+			std::vector<variant> items(reg + i.a, reg + i.a + i.b);
+			reg[i.dst] = variant(&items);
+			break;
+		}
+		case OP_JMP:
+			ip = code + i.a;
+			break;
+		case OP_JMP_IF_FALSE:
+			if(!reg[i.dst].as_bool()) {
+				ip = code + i.a;
+			}
+			break;
+		case OP_JMP_IF_TRUE:
+			if(reg[i.dst].as_bool()) {
+				ip = code + i.a;
+			}
+			break;
+		case OP_RETURN:
+			return OPERAND(i.a);
+		default:
+			ASSERT_LOG(false, "ILLEGAL FFL VM INSTRUCTION: " << i.op);
+		}
+	}
+
+#undef OPERAND
+}
+
+namespace {
+std::string operand_str(const std::vector<variant>& constants, int n)
+{
+	std::ostringstream s;
+	if(n >= 0) {
+		s << "r" << n;
+	} else {
+		s << constants[-1 - n].write_json();
+	}
+
+	return s.str();
+}
+}
+
+std::string program::disassemble() const
+{
+	std::ostringstream s;
+	for(int n = 0; n != code_.size(); ++n) {
+		const instruction& i = code_[n];
+		s << n << ": " << OpcodeNames[i.op];
+		switch(i.op) {
+		case OP_LOAD_SLOT:
+			s << " r" << i.dst << " slot " << i.a;
+			break;
+		case OP_EVAL:
+			s << " r" << i.dst << " " << fallbacks_[i.a]->str();
+			break;
+		case OP_MOVE:
+		case OP_NOT:
+		case OP_NEG:
+			s << " r" << i.dst << " " << operand_str(constants_, i.a);
+			break;
+		case OP_LIST:
+			s << " r" << i.dst << " r" << i.a << " x" << i.b;
+			break;
+		case OP_JMP:
+			s << " " << i.a;
+			break;
+		case OP_JMP_IF_FALSE:
+		case OP_JMP_IF_TRUE:
+			s << " r" << i.dst << " " << i.a;
+			break;
+		case OP_RETURN:
+			s << " " << operand_str(constants_, i.a);
+			break;
+		default:
+			s << " r" << i.dst << " " << operand_str(constants_, i.a) << " " << operand_str(constants_, i.b);
+			break;
+		}
+
+		s << "\n";
+	}
+
+	return s.str();
+}
+
+program_builder::program_builder()
+  : program_(new program), next_register_(0), nlowered_(0),
+    current_source_(NULL)
+{}
+
+void program_builder::lower(const formula_expression& expr, int dst)
+{
+	const formula_expression* const parent_source = current_source_;
+	current_source_ = &expr;
+
+	const int mark = register_mark();
+	variant literal;
+	if(expr.is_literal(literal)) {
+		emit(OP_MOVE, dst, add_constant(literal));
+	} else if(expr.compile_vm(*this, dst)) {
+		++nlowered_;
+	} else {
+		program_->fallbacks_.push_back(&expr);
+		emit(OP_EVAL, dst, program_->fallbacks_.size() - 1);
+	}
+
+	release_registers(mark);
+	current_source_ = parent_source;
+}
+
+int program_builder::lower_operand(const formula_expression& expr)
+{
+	variant literal;
+	if(expr.is_literal(literal)) {
+		return add_constant(literal);
+	}
+
+	const int result = allocate_register();
+	lower(expr, result);
+	return result;
+}
+
+int program_builder::add_constant(const variant& v)
+{
+	program_->constants_.push_back(v);
+	return -static_cast<int>(program_->constants_.size());
+}
+
+int program_builder::allocate_register()
+{
+	const int result = next_register_++;
+	ASSERT_LOG(result < 65536, "TOO MANY REGISTERS IN FFL VM PROGRAM");
+	if(next_register_ > program_->nregisters_) {
+		program_->nregisters_ = next_register_;
+	}
+
+	return result;
+}
+
+int program_builder::emit(OPCODE op, int dst, int a, int b)
+{
+	instruction i;
+	i.op = op;
+	i.dst = dst;
+	i.a = a;
+	i.b = b;
+	program_->code_.push_back(i);
+	program_->sources_.push_back(current_source_);
+	return program_->code_.size() - 1;
+}
+
+int program_builder::position() const
+{
+	return program_->code_.size();
+}
+
+void program_builder::patch_jump(int instruction_index, int target)
+{
+	program_->code_[instruction_index].a = target;
+}
+
+const_program_ptr program_builder::build(const formula_expression& expr)
+{
+	program_builder builder;
+	builder.program_->root_.reset(&expr);
+
+	const int result = builder.allocate_register();
+	builder.lower(expr, result);
+	if(builder.nlowered_ == 0) {
+		return const_program_ptr();
+	}
+
+	builder.emit(OP_RETURN, 0, result);
+	return builder.program_;
+}
+
+const_program_ptr compile(const formula_expression* expr)
+{
+	if(expr == NULL || !enabled()) {
+		return const_program_ptr();
+	}
+
+	return program_builder::build(*expr);
+}
+
+bool enabled()
+{
+	return g_ffl_vm != 0;
+}
+
+}
+
+namespace {
+//evaluates the formula with and without the VM and checks the results match.
+void check_vm_matches(const std::string& str)
+{
+	using game_logic::formula;
+
+	const int old_setting = g_ffl_vm;
+	g_ffl_vm = 0;
+	const variant expected = formula(variant(str)).execute();
+	g_ffl_vm = 1;
+	const variant result = formula(variant(str)).execute();
+	g_ffl_vm = old_setting;
+
+	CHECK(result == expected, "FFL VM MISMATCH IN '" << str << "': " << result.write_json() << " VS " << expected.write_json());
+}
+}
+
+UNIT_TEST(formula_vm_matches_tree) {
+	check_vm_matches("def f(n) n*n + 5; f(4)");
+	check_vm_matches("def f(n) -n + (n/2) - n%3 + n^2; f(7)");
+	check_vm_matches("def f(n) n/0; f(7)");
+	check_vm_matches("def f(a,b) [a < b, a > b, a <= b, a >= b, a = b, a != b]; f(3, 4)");
+	check_vm_matches("def f(n) if(n < 2, 'small', n < 5, 'medium', 'big'); map(range(8), f(value))");
+	check_vm_matches("def f(n) if(n < 2, 'small'); map(range(4), f(value))");
+	check_vm_matches("def f(a,b) [a and b, a or b, not a]; [f(0,1), f(1,0), f(1,2), f(0,0)]");
+	check_vm_matches("def f(n) [n in [1,2,3], n not in [1,2,3], n in {2: 1}]; map(range(4), f(value))");
+	check_vm_matches("def fact(n) if(n <= 1, 1, n * fact(n-1)); fact(10)");
+	check_vm_matches("[x*x + 5 | x <- range(10), x%2 = 0]");
+}
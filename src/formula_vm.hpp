@@ -0,0 +1,157 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FORMULA_VM_HPP_INCLUDED
+#define FORMULA_VM_HPP_INCLUDED
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <vector>
+
+#include "reference_counted_object.hpp"
+#include "variant.hpp"
+
+namespace game_logic {
+class formula_callable;
+class formula_expression;
+}
+
+//A compact bytecode representation of formula expressions, run by a
+//register-based interpreter. Expressions lower themselves into bytecode
+//through formula_expression::compile_vm(). Any expression which can't be
+//lowered is embedded as an OP_EVAL instruction which calls back into the
+//tree walker, so any expression tree can be compiled.
+namespace formula_vm
+{
+
+enum OPCODE {
+	//dst = operand a.
+	OP_MOVE,
+
+	//dst = variables.query_value_by_slot(a)
+	OP_LOAD_SLOT,
+
+	//dst = fallback expression a, evaluated using the tree walker.
+	OP_EVAL,
+
+	//dst = unary operation on operand a.
+	OP_NOT, OP_NEG,
+
+	//dst = binary operation on operands a and b.
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+	OP_EQ, OP_NEQ, OP_LT, OP_GT, OP_LTE, OP_GTE,
+	OP_IN, OP_NOT_IN,
+
+	//dst = a list made of the b registers starting at register a.
+	OP_LIST,
+
+	//unconditional jump to instruction a.
+	OP_JMP,
+
+	//jump to instruction a if register dst is false/true.
+	OP_JMP_IF_FALSE, OP_JMP_IF_TRUE,
+
+	//return operand a.
+	OP_RETURN,
+};
+
+//Operands of instructions are 'register or constant' values: an operand
+//n >= 0 refers to register n while n < 0 refers to constant (-1 - n).
+struct instruction {
+	unsigned short op;
+	unsigned short dst;
+	int a, b;
+};
+
+class program;
+typedef boost::intrusive_ptr<const program> const_program_ptr;
+
+class program : public reference_counted_object
+{
+public:
+	variant execute(const game_logic::formula_callable& variables) const;
+
+	//a human readable listing of the bytecode, for debugging.
+	std::string disassemble() const;
+
+	int num_registers() const { return nregisters_; }
+	int num_fallbacks() const { return fallbacks_.size(); }
+private:
+	friend class program_builder;
+	program() : nregisters_(0) {}
+
+	std::vector<instruction> code_;
+
+	//the expression each instruction was generated from, for errors.
+	std::vector<const game_logic::formula_expression*> sources_;
+	std::vector<variant> constants_;
+	std::vector<boost::intrusive_ptr<const game_logic::formula_expression> > fallbacks_;
+	boost::intrusive_ptr<const game_logic::formula_expression> root_;
+	int nregisters_;
+};
+
+//The interface expressions use to emit code into a program.
+class program_builder
+{
+public:
+	program_builder();
+
+	//lowers the given expression, placing its result in register 'dst'.
+	//Falls back to emitting an OP_EVAL if the expression can't be lowered.
+	void lower(const game_logic::formula_expression& expr, int dst);
+
+	//lowers the given expression and returns an operand referring to
+	//its result. Literals are returned as constant operands, anything else
+	//is placed in a newly allocated register.
+	int lower_operand(const game_logic::formula_expression& expr);
+
+	//returns an operand referring to the given constant.
+	int add_constant(const variant& v);
+
+	//registers are allocated in a stack-like manner. A caller may save
+	//the current mark and release all registers allocated after it.
+	int allocate_register();
+	int register_mark() const { return next_register_; }
+	void release_registers(int mark) { next_register_ = mark; }
+
+	int emit(OPCODE op, int dst, int a=0, int b=0);
+
+	//the position of the next instruction, used as a jump target.
+	int position() const;
+
+	//sets the target of a previously emitted jump instruction.
+	void patch_jump(int instruction_index, int target);
+
+	//builds the program for the given expression. Returns NULL if no part
+	//of the expression could be lowered, since then running it through the
+	//VM would only add overhead.
+	static const_program_ptr build(const game_logic::formula_expression& expr);
+
+private:
+	boost::intrusive_ptr<program> program_;
+	int next_register_;
+	int nlowered_;
+	const game_logic::formula_expression* current_source_;
+};
+
+//compiles the expression if the VM is enabled, otherwise returns NULL.
+const_program_ptr compile(const game_logic::formula_expression* expr);
+
+bool enabled();
+
+}
+
+#endif
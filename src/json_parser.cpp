@@ -425,6 +425,11 @@ variant parse_internal(const std::string& doc, const std::string& fname,
 					v = variant(s);
 				}
 
+				if(stack.back().type == VAL_OBJ && !t.translate && v.is_string() && !v.is_interned_string()) {
+					//object keys repeat a lot, so share them.
+					v = variant::create_interned_string(v.as_string());
+				}
+
 				if(t.translate && v.is_string()) {
 					v = variant::create_translated_string(v.as_string());
 				}
@@ -207,6 +207,8 @@ level::level(const std::string& level_cfg, variant node)
 	  x_resolution_(0), y_resolution_(0),
 	  set_screen_resolution_on_entry_(true),
 	  highlight_layer_(INT_MIN),
+	  chars_index_valid_(false),
+	  solid_chars_index_(entity_spatial_index::SOLID_AREA),
 	  num_compiled_tiles_(0),
 	  entered_portal_active_(false), save_point_x_(-1), save_point_y_(-1),
 	  editor_(false), show_foreground_(true), show_background_(true), dark_(false), dark_color_(graphics::color_transform(0, 0, 0, 255)), air_resistance_(0), water_resistance_(7), end_game_(false),
@@ -611,6 +613,7 @@ void level::read_compiled_tiles(variant node, std::vector<level_tile>::iterator&
 
 void level::load_character(variant c)
 {
+	chars_index_valid_ = false;
 	chars_.push_back(entity::build(c));
 	custom_object* co = dynamic_cast<custom_object*>(chars_.back().get());
 	if(co) {
@@ -816,6 +819,7 @@ void level::finish_loading()
 		}
 
 		chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+		chars_index_valid_ = false;
 	}
 
 #if defined(USE_BOX2D)
@@ -2576,6 +2580,35 @@ bool compare_entity_num_parents(const entity_ptr& a, const entity_ptr& b) {
 }
 }
 
+namespace {
+struct entity_in_sorted_list {
+	explicit entity_in_sorted_list(const std::vector<entity_ptr>& v) : v_(v)
+	{}
+
+	bool operator()(const entity_ptr& e) const {
+		return std::binary_search(v_.begin(), v_.end(), e);
+	}
+
+	const std::vector<entity_ptr>& v_;
+};
+}
+
+void level::query_chars_index(const rect& area, std::vector<entity*>* result) const
+{
+	//chars_ can change in ways which don't update the index, in which case
+	//it's rebuilt.
+	if(!chars_index_valid_ || chars_index_.size() != chars_.size()) {
+		chars_index_.clear();
+		foreach(const entity_ptr& e, chars_) {
+			chars_index_.insert(e.get());
+		}
+
+		chars_index_valid_ = true;
+	}
+
+	chars_index_.query(area, result);
+}
+
 void level::set_active_chars()
 {
 	const decimal inverse_zoom_level = zoom_level_ != decimal(0) ? (decimal(1.0)/zoom_level_) : decimal(0);
@@ -2587,7 +2620,21 @@ void level::set_active_chars()
 
 	const rect screen_area(screen_left, screen_top, screen_right - screen_left, screen_bottom - screen_top);
 	active_chars_.clear();
-	foreach(entity_ptr& c, chars_) {
+
+	//only chars which might be active on the screen need to be checked,
+	//except in multiplayer where every object is active.
+	std::vector<entity*> candidates;
+	if(controls::num_players() > 1) {
+		foreach(const entity_ptr& c, chars_) {
+			candidates.push_back(c.get());
+		}
+	} else {
+		query_chars_index(screen_area, &candidates);
+	}
+
+	std::vector<entity_ptr> removed_chars;
+	foreach(entity* candidate, candidates) {
+		const entity_ptr c(candidate);
 		const bool is_active = c->is_active(screen_area) || c->use_absolute_screen_coordinates();
 
 		if(is_active) {
@@ -2605,12 +2652,16 @@ void level::set_active_chars()
 					chars_by_label_.erase(c->label());
 				}
 				
-				c = entity_ptr(); //can't delete it while iterating over the container, so we null it for later removal
+				chars_index_.erase(candidate);
+				removed_chars.push_back(c);
 			}
 		}
 	}
 
-	chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+	if(removed_chars.empty() == false) {
+		std::sort(removed_chars.begin(), removed_chars.end());
+		chars_.erase(std::remove_if(chars_.begin(), chars_.end(), entity_in_sorted_list(removed_chars)), chars_.end());
+	}
 
 	std::sort(active_chars_.begin(), active_chars_.end());
 	active_chars_.erase(std::unique(active_chars_.begin(), active_chars_.end()), active_chars_.end());
@@ -2699,6 +2750,7 @@ void level::erase_char(entity_ptr c)
 		chars_by_label_.erase(c->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), c), chars_.end());
+	chars_index_.erase(c.get());
 	if(c->group() >= 0) {
 		assert(c->group() < groups_.size());
 		entity_group& group = groups_[c->group()];
@@ -2777,6 +2829,31 @@ bool level::is_solid(const level_solid_map& map, const entity& e, const std::vec
 	return false;
 }
 
+bool level::is_solid(const level_solid_map& map, const entity& e, const point& pos, const std::vector<solid_map::span>& spans, const surface_info** surf_info) const
+{
+	const int width = e.current_frame().width();
+	foreach(const solid_map::span& span, spans) {
+		//when facing left a span is mirrored, and its points are in order
+		//from right to left.
+		const tile_solid_info* info = NULL;
+		if(e.face_right()) {
+			info = map.find_solid_in_row(pos.x + span.x1, pos.x + span.x2, pos.y + span.y);
+		} else {
+			info = map.find_solid_in_row(pos.x + width - 1 - span.x2, pos.x + width - 1 - span.x1, pos.y + span.y, true);
+		}
+
+		if(info) {
+			if(surf_info) {
+				*surf_info = &info->info;
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool level::is_solid(const level_solid_map& map, int x, int y, const surface_info** surf_info) const
 {
 	tile_pos pos(x/TileSize, y/TileSize);
@@ -2819,17 +2896,27 @@ bool level::is_solid(const level_solid_map& map, int x, int y, const surface_inf
 
 bool level::standable(const rect& r, const surface_info** info) const
 {
-	const int ybegin = r.y();
-	const int yend = r.y2();
 	const int xbegin = r.x();
-	const int xend = r.x2();
+	const int xend = r.x2() - 1;
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(standable(x, y, info)) {
-				return true;
+	for(int y = r.y(); y < r.y2(); ++y) {
+		const tile_solid_info* solid_info = solid_.find_solid_in_row(xbegin, xend, y);
+		const tile_solid_info* standable_info = standable_.find_solid_in_row(xbegin, xend, y);
+		if(solid_info == NULL && standable_info == NULL) {
+			continue;
+		}
+
+		if(info) {
+			//the surface is the one at the first point which is solid or
+			//standable, preferring solid.
+			for(int x = xbegin; x <= xend; ++x) {
+				if(is_solid(solid_, x, y, info) || is_solid(standable_, x, y, info)) {
+					break;
+				}
 			}
 		}
+
+		return true;
 	}
 
 	return false;
@@ -2864,39 +2951,33 @@ bool level::solid(const entity& e, const std::vector<point>& points, const surfa
 	return is_solid(solid_, e, points, info);
 }
 
+bool level::solid(const entity& e, const std::vector<solid_map::span>& spans, const surface_info** info) const
+{
+	return is_solid(solid_, e, point(e.x(), e.y()), spans, info);
+}
+
+bool level::solid(const entity& e, const point& pos, const std::vector<solid_map::span>& spans, const surface_info** info) const
+{
+	return is_solid(solid_, e, pos, spans, info);
+}
+
 bool level::solid(int xbegin, int ybegin, int w, int h, const surface_info** info) const
 {
-	const int xend = xbegin + w;
-	const int yend = ybegin + h;
+	const tile_solid_info* tile_info = solid_.find_solid_in_rect(xbegin, ybegin, w, h);
+	if(tile_info == NULL) {
+		return false;
+	}
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
-		}
+	if(info) {
+		*info = &tile_info->info;
 	}
 
-	return false;
+	return true;
 }
 
 bool level::solid(const rect& r, const surface_info** info) const
 {
-	//TODO: consider optimizing this function.
-	const int ybegin = r.y();
-	const int yend = r.y2();
-	const int xbegin = r.x();
-	const int xend = r.x2();
-
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
-		}
-	}
-
-	return false;
+	return solid(r.x(), r.y(), r.w(), r.h(), info);
 }
 
 bool level::may_be_solid_in_rect(const rect& r) const
@@ -2930,6 +3011,42 @@ bool level::may_be_solid_in_rect(const rect& r) const
 	return false;
 }
 
+int level::solid_free_distance(const rect& r, MOVE_DIRECTION dir, int max_distance) const
+{
+	if(r.w() <= 0 || r.h() <= 0 || max_distance <= 0) {
+		return std::max(max_distance, 0);
+	}
+
+	const int dx = dir == MOVE_LEFT ? -1 : (dir == MOVE_RIGHT ? 1 : 0);
+	const int dy = dir == MOVE_UP ? -1 : (dir == MOVE_DOWN ? 1 : 0);
+	if(!may_be_solid_in_rect(rect_union(r, rect(r.x() + dx*max_distance, r.y() + dy*max_distance, r.w(), r.h())))) {
+		return max_distance;
+	}
+
+	if(solid(r)) {
+		return 0;
+	}
+
+	//test each row or column as the area moves into it.
+	for(int n = 1; n <= max_distance; ++n) {
+		bool hit = false;
+		switch(dir) {
+		case MOVE_LEFT: hit = solid(r.x() - n, r.y(), 1, r.h()); break;
+		case MOVE_RIGHT: hit = solid(r.x2() - 1 + n, r.y(), 1, r.h()); break;
+		case MOVE_UP: hit = solid(r.x(), r.y() - n, r.w(), 1); break;
+		case MOVE_DOWN: hit = solid(r.x(), r.y2() - 1 + n, r.w(), 1); break;
+		default:
+			ASSERT_LOG(false, "solid_free_distance needs a direction to move in");
+		}
+
+		if(hit) {
+			return n - 1;
+		}
+	}
+
+	return max_distance;
+}
+
 void level::set_solid_area(const rect& r, bool solid)
 {
 	std::string empty_info;
@@ -3348,12 +3465,16 @@ void level::remove_character(entity_ptr e)
 		chars_by_label_.erase(e->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), e), chars_.end());
+	chars_index_.erase(e.get());
 }
 
 std::vector<entity_ptr> level::get_characters_in_rect(const rect& r, int screen_xpos, int screen_ypos) const
 {
+	std::vector<entity*> candidates;
+	query_chars_index(r, &candidates);
+
 	std::vector<entity_ptr> res;
-	foreach(entity_ptr c, chars_) {
+	foreach(entity_ptr c, candidates) {
 		if(object_classification_hidden(*c)) {
 			continue;
 		}
@@ -3373,8 +3494,11 @@ std::vector<entity_ptr> level::get_characters_in_rect(const rect& r, int screen_
 
 std::vector<entity_ptr> level::get_characters_at_point(int x, int y, int screen_xpos, int screen_ypos) const
 {
+	std::vector<entity*> candidates;
+	query_chars_index(rect(x, y, 1, 1), &candidates);
+
 	std::vector<entity_ptr> result;
-	foreach(entity_ptr c, chars_) {
+	foreach(entity_ptr c, candidates) {
 		if(object_classification_hidden(*c)) {
 			continue;
 		}
@@ -3516,6 +3640,7 @@ void level::add_multi_player(entity_ptr p)
 	p->get_player_info()->set_player_slot(players_.size());
 	players_.push_back(p);
 	chars_.push_back(p);
+	chars_index_valid_ = false;
 	if(p->label().empty() == false) {
 		chars_by_label_[p->label()] = p;
 	}
@@ -3524,6 +3649,7 @@ void level::add_multi_player(entity_ptr p)
 
 void level::add_player(entity_ptr p)
 {
+	chars_index_valid_ = false;
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), player_), chars_.end());
 	last_touched_player_ = player_ = p;
 	if(players_.empty()) {
@@ -3567,6 +3693,7 @@ void level::add_character(entity_ptr p)
 {
 	if(solid_chars_.empty() == false && p->solid()) {
 		solid_chars_.push_back(p);
+		solid_chars_index_.insert(p.get());
 	}
 
 	ASSERT_LOG(p->label().empty() == false, "Entity has no label");
@@ -3588,6 +3715,7 @@ void level::add_character(entity_ptr p)
 		add_player(p);
 	} else {
 		chars_.push_back(p);
+		chars_index_.insert(p.get());
 	}
 
 	p->add_to_level();
@@ -4481,11 +4609,33 @@ const std::vector<entity_ptr>& level::get_solid_chars() const
 				solid_chars_.push_back(e);
 			}
 		}
+
+		rebuild_solid_chars_index();
 	}
 
 	return solid_chars_;
 }
 
+void level::get_solid_chars_in_rect(const rect& area, std::vector<entity*>* result) const
+{
+	get_solid_chars();
+
+	//solid_chars_ may have been copied or swapped without the index.
+	if(solid_chars_index_.size() != solid_chars_.size()) {
+		rebuild_solid_chars_index();
+	}
+
+	solid_chars_index_.query(area, result);
+}
+
+void level::rebuild_solid_chars_index() const
+{
+	solid_chars_index_.clear();
+	foreach(const entity_ptr& e, solid_chars_) {
+		solid_chars_index_.insert(e.get());
+	}
+}
+
 void level::begin_movement_script(const std::string& key, entity& e)
 {
 	std::map<std::string, movement_script>::const_iterator itor = movement_scripts_.find(key);
@@ -4643,6 +4793,7 @@ void level::restore_from_backup(backup_snapshot& snapshot)
 	rng::set_seed(snapshot.rng_seed);
 	cycle_ = snapshot.cycle;
 	chars_ = snapshot.chars;
+	chars_index_valid_ = false;
 	players_ = snapshot.players;
 	player_ = snapshot.player;
 	groups_ = snapshot.groups;
@@ -5200,6 +5351,31 @@ BENCHMARK(level_solid)
 	}
 }
 
+BENCHMARK(level_solid_rect)
+{
+	static level* lvl = new level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		lvl->solid(rng::generate()%1000, rng::generate()%1000, 64, 64);
+	}
+}
+
+BENCHMARK(level_process_solid_blocks)
+{
+	//hundreds of solid blocks moving into each other, which tells us how
+	//long collision tests between objects take.
+	static level* lvl = NULL;
+	if(!lvl) {
+		lvl = new level("benchmark_solid_blocks.cfg");
+		static variant v(lvl);
+		lvl->finish_loading();
+		lvl->set_as_current_level();
+	}
+
+	BENCHMARK_LOOP {
+		lvl->process();
+	}
+}
+
 BENCHMARK(load_nene)
 {
 	BENCHMARK_LOOP {
@@ -49,6 +49,7 @@
 #include "level_solid_map.hpp"
 #include "movement_script.hpp"
 #include "raster.hpp"
+#include "solid_map.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
 #include "variant.hpp"
@@ -119,9 +120,17 @@ public:
 	bool standable_tile(int x, int y, const surface_info** info=NULL) const;
 	bool solid(int x, int y, const surface_info** info=NULL) const;
 	bool solid(const entity& e, const std::vector<point>& points, const surface_info** info=NULL) const;
+	bool solid(const entity& e, const std::vector<solid_map::span>& spans, const surface_info** info=NULL) const;
+
+	//as above, but with the entity's frame at pos instead of where it is.
+	bool solid(const entity& e, const point& pos, const std::vector<solid_map::span>& spans, const surface_info** info=NULL) const;
 	bool solid(const rect& r, const surface_info** info=NULL) const;
 	bool solid(int xbegin, int ybegin, int w, int h, const surface_info** info=NULL) const;
 	bool may_be_solid_in_rect(const rect& r) const;
+
+	//finds how many pixels the area can move in the given direction before
+	//it contains a solid pixel, up to max_distance.
+	int solid_free_distance(const rect& r, MOVE_DIRECTION dir, int max_distance) const;
 	void set_solid_area(const rect& r, bool solid);
 	entity_ptr board(int x, int y) const;
 	const rect& boundaries() const { return boundaries_; }
@@ -306,6 +315,10 @@ public:
 	const std::vector<entity_ptr>& get_active_chars() const { return active_chars_; }
 	const std::vector<entity_ptr>& get_chars() const { return chars_; }
 	const std::vector<entity_ptr>& get_solid_chars() const;
+
+	//finds the solid chars whose solid or platform areas may touch the
+	//given area, in the same order as get_solid_chars().
+	void get_solid_chars_in_rect(const rect& area, std::vector<entity*>* result) const;
 	void swap_chars(std::vector<entity_ptr>& v) { chars_.swap(v); solid_chars_.clear(); }
 	int num_active_chars() const { return active_chars_.size(); }
 
@@ -459,6 +472,7 @@ private:
 
 	bool is_solid(const level_solid_map& map, int x, int y, const surface_info** surf_info) const;
 	bool is_solid(const level_solid_map& map, const entity& e, const std::vector<point>& points, const surface_info** surf_info) const;
+	bool is_solid(const level_solid_map& map, const entity& e, const point& pos, const std::vector<solid_map::span>& spans, const surface_info** surf_info) const;
 
 	void set_solid(level_solid_map& map, int x, int y, int friction, int traction, int damage, const std::string& info, bool solid=true);
 
@@ -550,6 +564,18 @@ private:
 	std::vector<entity_ptr> new_chars_;
 	mutable std::vector<entity_ptr> solid_chars_;
 
+	//finds the chars which may be active in or be found in an area. The
+	//index is kept up to date as chars are added, removed or move, and
+	//rebuilt from chars_ when it's been invalidated.
+	void query_chars_index(const rect& area, std::vector<entity*>* result) const;
+	mutable entity_spatial_index chars_index_;
+	mutable bool chars_index_valid_;
+
+	//solid_chars_ indexed by their solid areas. It's rebuilt along with
+	//solid_chars_, once a frame.
+	void rebuild_solid_chars_index() const;
+	mutable entity_spatial_index solid_chars_index_;
+
 	std::vector<entity_ptr> chars_immune_from_time_freeze_;
 
 	std::map<std::string, entity_ptr> chars_by_label_;
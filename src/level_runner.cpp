@@ -37,6 +37,7 @@
 #include "font.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
+#include "formula_pool.hpp"
 #include "formula_profiler.hpp"
 #include "formula_callable.hpp"
 #include "http_client.hpp"
@@ -1604,6 +1605,8 @@ bool level_runner::play_cycle()
 #endif
 
 		performance_data perf(current_fps_, current_cycles_, current_delay_, current_draw_, current_process_, current_flip_, cycle, current_events_, profiling_summary_);
+		perf.allocations = formula_pool::last_frame().allocations;
+		perf.heap_allocations = formula_pool::last_frame().heap_allocations;
 
 #if TARGET_IPHONE_SIMULATOR || TARGET_OS_HARMATTAN || TARGET_OS_IPHONE
 		if( ! is_achievement_displayed() ){
@@ -1661,7 +1664,11 @@ bool level_runner::play_cycle()
 		profiling_summary_ = formula_profiler::get_profile_summary();
 	}
 
+	formula_profiler::mark_frame();
 	formula_profiler::pump();
+	formula_pool::end_frame();
+	current_perf.allocations = formula_pool::last_frame().allocations;
+	current_perf.heap_allocations = formula_pool::last_frame().heap_allocations;
 
 	const int raw_wait_time = desired_end_time - SDL_GetTicks();
 	const int wait_time = std::max<int>(1, desired_end_time - SDL_GetTicks());
@@ -17,10 +17,24 @@
 #include <iostream>
 #include <set>
 
+#include <boost/random/mersenne_twister.hpp>
+
 #include "foreach.hpp"
 #include "level_solid_map.hpp"
+#include "unit_test.hpp"
 
 namespace {
+//splits a pixel coordinate into the tile it's in and its position in it.
+void split_tile_coord(int n, int* tile, int* sub)
+{
+	*tile = n/TileSize;
+	*sub = n%TileSize;
+	if(*sub < 0) {
+		--*tile;
+		*sub += TileSize;
+	}
+}
+
 void merge_surface_info(surface_info& a, const surface_info& b)
 {
 	a.friction = std::max<int>(a.friction, b.friction);
@@ -32,6 +46,47 @@ void merge_surface_info(surface_info& a, const surface_info& b)
 }
 }
 
+void tile_bitmap::set()
+{
+	for(int n = 0; n != TileSize; ++n) {
+		rows_[n] = ~uint32_t(0);
+	}
+}
+
+void tile_bitmap::reset()
+{
+	for(int n = 0; n != TileSize; ++n) {
+		rows_[n] = 0;
+	}
+}
+
+bool tile_bitmap::any() const
+{
+	for(int n = 0; n != TileSize; ++n) {
+		if(rows_[n]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+tile_bitmap& tile_bitmap::operator|=(const tile_bitmap& b)
+{
+	for(int n = 0; n != TileSize; ++n) {
+		rows_[n] |= b.rows_[n];
+	}
+
+	return *this;
+}
+
+tile_bitmap operator|(const tile_bitmap& a, const tile_bitmap& b)
+{
+	tile_bitmap result = a;
+	result |= b;
+	return result;
+}
+
 const std::string* surface_info::get_info_str(const std::string& key)
 {
 	static std::set<std::string> info_set;
@@ -134,6 +189,51 @@ const tile_solid_info* level_solid_map::find(const tile_pos& pos) const
 	}
 }
 
+const tile_solid_info* level_solid_map::find_solid_in_row(int xbegin, int xend, int y, bool right_to_left) const
+{
+	if(xbegin > xend) {
+		return NULL;
+	}
+
+	int tile_y, suby, tile_x1, subx1, tile_x2, subx2;
+	split_tile_coord(y, &tile_y, &suby);
+	split_tile_coord(xbegin, &tile_x1, &subx1);
+	split_tile_coord(xend, &tile_x2, &subx2);
+
+	const int step = right_to_left ? -1 : 1;
+	const int tile_xend = right_to_left ? tile_x1 - 1 : tile_x2 + 1;
+	for(int tile_x = right_to_left ? tile_x2 : tile_x1; tile_x != tile_xend; tile_x += step) {
+		const tile_solid_info* info = find(tile_pos(tile_x, tile_y));
+		if(info == NULL) {
+			continue;
+		}
+
+		const int x1 = tile_x == tile_x1 ? subx1 : 0;
+		const int x2 = tile_x == tile_x2 ? subx2 : TileSize-1;
+		if(info->row(suby)&tile_row_mask(x1, x2)) {
+			return info;
+		}
+	}
+
+	return NULL;
+}
+
+const tile_solid_info* level_solid_map::find_solid_in_rect(int xbegin, int ybegin, int w, int h) const
+{
+	if(w <= 0) {
+		return NULL;
+	}
+
+	for(int y = ybegin; y < ybegin + h; ++y) {
+		const tile_solid_info* info = find_solid_in_row(xbegin, xbegin + w - 1, y);
+		if(info) {
+			return info;
+		}
+	}
+
+	return NULL;
+}
+
 void level_solid_map::erase(const tile_pos& pos)
 {
 	tile_solid_info** info = insert_raw(pos);
@@ -234,3 +334,53 @@ void level_solid_map::merge(const level_solid_map& map, int xoffset, int yoffset
 		}
 	}
 }
+
+namespace {
+const tile_solid_info* find_solid_pixel_by_pixel(const level_solid_map& map, int xbegin, int xend, int y, bool right_to_left)
+{
+	for(int n = 0; n <= xend - xbegin; ++n) {
+		const int x = right_to_left ? xend - n : xbegin + n;
+		int tile_x, subx, tile_y, suby;
+		split_tile_coord(x, &tile_x, &subx);
+		split_tile_coord(y, &tile_y, &suby);
+		const tile_solid_info* info = map.find(tile_pos(tile_x, tile_y));
+		if(info && (info->all_solid || info->bitmap.test(suby*TileSize + subx))) {
+			return info;
+		}
+	}
+
+	return NULL;
+}
+}
+
+UNIT_TEST(level_solid_map_find_solid_in_row)
+{
+	CHECK_EQ(tile_row_mask(0, TileSize-1), ~uint32_t(0));
+	CHECK_EQ(tile_row_mask(3, 3), uint32_t(8));
+	CHECK_EQ(tile_row_mask(1, 2), uint32_t(6));
+
+	//a fixed seed, so a failure can be reproduced.
+	boost::random::mt19937 gen(5489);
+
+	level_solid_map map;
+	for(int n = 0; n != 400; ++n) {
+		const int x = int(gen()%256) - 128;
+		const int y = int(gen()%64) - 32;
+
+		int tile_x, subx, tile_y, suby;
+		split_tile_coord(x, &tile_x, &subx);
+		split_tile_coord(y, &tile_y, &suby);
+		map.insert_or_find(tile_pos(tile_x, tile_y)).bitmap.set(suby*TileSize + subx);
+	}
+
+	map.insert_or_find(tile_pos(2, 0)).all_solid = true;
+
+	for(int n = 0; n != 2000; ++n) {
+		const int xbegin = int(gen()%256) - 128;
+		const int xend = xbegin + int(gen()%100);
+		const int y = int(gen()%64) - 32;
+		const bool right_to_left = (n%2) != 0;
+
+		CHECK_EQ(map.find_solid_in_row(xbegin, xend, y, right_to_left), find_solid_pixel_by_pixel(map, xbegin, xend, y, right_to_left));
+	}
+}
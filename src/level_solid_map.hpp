@@ -17,14 +17,43 @@
 #ifndef LEVEL_SOLID_MAP_HPP_INCLUDED
 #define LEVEL_SOLID_MAP_HPP_INCLUDED
 
-#include <bitset>
+#include <stdint.h>
+
 #include <map>
 #include <vector>
 
 static const int TileSize = 32;
 
 typedef std::pair<int,int> tile_pos;
-typedef std::bitset<TileSize*TileSize> tile_bitmap;
+
+//the solid pixels of a tile. Pixel (x, y) is bit x of row y, so a span
+//of a row can be tested with a single mask.
+class tile_bitmap {
+public:
+	tile_bitmap() { reset(); }
+
+	bool test(int index) const { return (rows_[index/TileSize] >> (index%TileSize))&1; }
+	void set(int index) { rows_[index/TileSize] |= uint32_t(1) << (index%TileSize); }
+	void reset(int index) { rows_[index/TileSize] &= ~(uint32_t(1) << (index%TileSize)); }
+	void set();
+	void reset();
+	bool any() const;
+
+	uint32_t row(int y) const { return rows_[y]; }
+
+	tile_bitmap& operator|=(const tile_bitmap& b);
+private:
+	uint32_t rows_[TileSize];
+};
+
+tile_bitmap operator|(const tile_bitmap& a, const tile_bitmap& b);
+
+//a mask of the pixels from x1 to x2 inclusive in a row of a tile.
+inline uint32_t tile_row_mask(int x1, int x2)
+{
+	const uint32_t upto_x2 = x2 == TileSize-1 ? ~uint32_t(0) : (uint32_t(1) << (x2+1)) - 1;
+	return upto_x2 & ~((uint32_t(1) << x1) - 1);
+}
 
 struct surface_info {
 	surface_info() : friction(0), traction(0), damage(-1), info(0)
@@ -40,6 +69,9 @@ struct tile_solid_info {
 	tile_bitmap bitmap;
 	surface_info info;
 	bool all_solid;
+
+	//the solid pixels in a row of the tile.
+	uint32_t row(int y) const { return all_solid ? ~uint32_t(0) : bitmap.row(y); }
 };
 
 class level_solid_map {
@@ -53,6 +85,14 @@ public:
 	void erase(const tile_pos& pos);
 	void clear();
 
+	//finds the first tile with a solid pixel in the pixels from xbegin to
+	//xend inclusive on row y, searching from xend if right_to_left is set.
+	const tile_solid_info* find_solid_in_row(int xbegin, int xend, int y, bool right_to_left=false) const;
+
+	//finds the first tile with a solid pixel in the area, searching rows
+	//top to bottom and each row left to right.
+	const tile_solid_info* find_solid_in_rect(int xbegin, int ybegin, int w, int h) const;
+
 	void merge(const level_solid_map& m, int xoffset, int yoffset);
 private:
 
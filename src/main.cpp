@@ -48,6 +48,7 @@
 #include "filesystem.hpp"
 #include "font.hpp"
 #include "foreach.hpp"
+#include "formula_allocation_counter.hpp"
 #include "formula_callable_definition.hpp"
 #include "formula_object.hpp"
 #include "formula_profiler.hpp"
@@ -1067,6 +1068,9 @@ extern "C" int main(int argcount, char* argvec[])
 	SDL_Quit();
 	
 	preferences::save_preferences();
+#ifdef FORMULA_ALLOCATION_COUNTING
+	std::cerr << formula_allocation_counter::get_report();
+#endif
 	std::cerr << SDL_GetError() << "\n";
 
 #if !defined(_MSC_VER) && defined(UTILITY_IN_PROC)
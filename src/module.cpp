@@ -24,6 +24,7 @@
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formula_constants.hpp"
+#include "formula_function.hpp"
 #if !defined(NO_TCP)
 #include "http_client.hpp"
 #endif
@@ -306,6 +307,7 @@ void load(const std::string& mod_file_name, bool initial)
 }
 
 void reload(const std::string& name) {
+	game_logic::clear_memo_caches();
 	preferences::set_preferences_path_from_module(name);
 	loaded_paths().clear();
 	loaded_paths().push_back(core);
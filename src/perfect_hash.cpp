@@ -0,0 +1,192 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <map>
+
+#include "asserts.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "perfect_hash.hpp"
+#include "unit_test.hpp"
+
+namespace {
+//how many seeds to try for a bucket before giving up.
+const int MaxDisplacement = 1 << 16;
+
+struct bucket_size_greater {
+	explicit bucket_size_greater(const std::vector<std::vector<int> >& buckets) : buckets_(buckets)
+	{}
+
+	bool operator()(int a, int b) const {
+		return buckets_[a].size() > buckets_[b].size();
+	}
+
+	const std::vector<std::vector<int> >& buckets_;
+};
+}
+
+perfect_hash::perfect_hash()
+{}
+
+bool perfect_hash::build(const std::vector<std::string>& keys, const std::vector<int>& values)
+{
+	ASSERT_EQ(keys.size(), values.size());
+	clear();
+	if(keys.empty()) {
+		return true;
+	}
+
+	const int nkeys = keys.size();
+	keys_.resize(nkeys);
+	values_.resize(nkeys);
+	displacements_.resize(nkeys);
+
+	std::vector<unsigned int> hashes(nkeys);
+	std::vector<std::vector<int> > buckets(nkeys);
+	for(int n = 0; n != nkeys; ++n) {
+		hashes[n] = hash_string(keys[n]);
+		buckets[hashes[n]%nkeys].push_back(n);
+	}
+
+	//place the largest buckets first, while the table is mostly empty.
+	std::vector<int> order(nkeys);
+	for(int n = 0; n != nkeys; ++n) {
+		order[n] = n;
+	}
+
+	std::stable_sort(order.begin(), order.end(), bucket_size_greater(buckets));
+
+	std::vector<bool> used(nkeys, false);
+	std::vector<unsigned int> slots;
+
+	std::vector<int>::const_iterator bucket_itor = order.begin();
+	for(; bucket_itor != order.end() && buckets[*bucket_itor].size() > 1; ++bucket_itor) {
+		const std::vector<int>& bucket = buckets[*bucket_itor];
+
+		int displacement = 0;
+		for(; displacement != MaxDisplacement; ++displacement) {
+			slots.clear();
+			foreach(int key, bucket) {
+				const unsigned int slot = get_slot(hashes[key], displacement);
+				if(used[slot] || std::count(slots.begin(), slots.end(), slot)) {
+					break;
+				}
+
+				slots.push_back(slot);
+			}
+
+			if(slots.size() == bucket.size()) {
+				break;
+			}
+		}
+
+		if(displacement == MaxDisplacement) {
+			clear();
+			return false;
+		}
+
+		displacements_[*bucket_itor] = displacement;
+		for(int n = 0; n != bucket.size(); ++n) {
+			used[slots[n]] = true;
+			keys_[slots[n]] = keys[bucket[n]];
+			values_[slots[n]] = values[bucket[n]];
+		}
+	}
+
+	//the remaining buckets have at most one key, which goes in any free slot.
+	int free_slot = 0;
+	for(; bucket_itor != order.end() && buckets[*bucket_itor].size() == 1; ++bucket_itor) {
+		while(used[free_slot]) {
+			++free_slot;
+		}
+
+		const int key = buckets[*bucket_itor].front();
+		used[free_slot] = true;
+		displacements_[*bucket_itor] = -free_slot - 1;
+		keys_[free_slot] = keys[key];
+		values_[free_slot] = values[key];
+	}
+
+	return true;
+}
+
+void perfect_hash::clear()
+{
+	displacements_.clear();
+	keys_.clear();
+	values_.clear();
+}
+
+UNIT_TEST(perfect_hash)
+{
+	std::vector<std::string> keys;
+	std::vector<int> values;
+	for(int n = 0; n != 1000; ++n) {
+		keys.push_back(formatter() << "key" << n);
+		values.push_back(n*2);
+	}
+
+	perfect_hash table;
+	CHECK_EQ(table.find("key0"), -1);
+	CHECK_EQ(table.build(keys, values), true);
+	CHECK_EQ(table.size(), keys.size());
+
+	for(int n = 0; n != keys.size(); ++n) {
+		CHECK_EQ(table.find(keys[n]), values[n]);
+	}
+
+	CHECK_EQ(table.find("key1000"), -1);
+	CHECK_EQ(table.find(""), -1);
+
+	keys.push_back("key0");
+	values.push_back(0);
+	CHECK_EQ(table.build(keys, values), false);
+	CHECK_EQ(table.empty(), true);
+}
+
+BENCHMARK(perfect_hash_lookup)
+{
+	std::vector<std::string> keys;
+	std::vector<int> values;
+	for(int n = 0; n != 200; ++n) {
+		keys.push_back(formatter() << "property" << n);
+		values.push_back(n);
+	}
+
+	static perfect_hash table;
+	table.build(keys, values);
+
+	int n = 0;
+	BENCHMARK_LOOP {
+		table.find(keys[n++%keys.size()]);
+	}
+}
+
+BENCHMARK(perfect_hash_map_lookup)
+{
+	std::vector<std::string> keys;
+	static std::map<std::string, int> m;
+	for(int n = 0; n != 200; ++n) {
+		keys.push_back(formatter() << "property" << n);
+		m[keys.back()] = n;
+	}
+
+	int n = 0;
+	BENCHMARK_LOOP {
+		m.find(keys[n++%keys.size()]);
+	}
+}
@@ -0,0 +1,83 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PERFECT_HASH_HPP_INCLUDED
+#define PERFECT_HASH_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+//A minimal perfect hash table over a fixed set of string keys, built using
+//the 'hash and displace' method. Keys are split into buckets by their hash,
+//and each bucket stores a displacement which sends its keys to distinct
+//slots. A lookup costs one hash of the key and one string comparison no
+//matter how many keys there are. Keys can't be added once it's built.
+class perfect_hash
+{
+public:
+	perfect_hash();
+
+	//builds a table mapping keys[n] to values[n]. Returns false, leaving the
+	//table empty, if a table can't be built, e.g. if keys are duplicated.
+	bool build(const std::vector<std::string>& keys, const std::vector<int>& values);
+	void clear();
+
+	bool empty() const { return keys_.empty(); }
+	int size() const { return keys_.size(); }
+
+	//returns the value of the given key, or -1 if it's not in the table.
+	int find(const std::string& key) const {
+		if(keys_.empty()) {
+			return -1;
+		}
+
+		const unsigned int h = hash_string(key);
+		const unsigned int slot = get_slot(h, displacements_[h%keys_.size()]);
+		return keys_[slot] == key ? values_[slot] : -1;
+	}
+
+private:
+	static unsigned int hash_string(const std::string& s) {
+		unsigned int h = 2166136261u;
+		for(std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
+			h = (h ^ static_cast<unsigned char>(*i))*16777619u;
+		}
+
+		return h;
+	}
+
+	//buckets with a single key store its slot directly as -(slot+1), other
+	//buckets store a seed used to rehash their keys.
+	unsigned int get_slot(unsigned int h, int displacement) const {
+		if(displacement < 0) {
+			return -displacement - 1;
+		}
+
+		h ^= displacement*0x9e3779b9u;
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h%keys_.size();
+	}
+
+	std::vector<int> displacements_;
+	std::vector<std::string> keys_;
+	std::vector<int> values_;
+};
+
+#endif
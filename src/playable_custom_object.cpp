@@ -17,6 +17,7 @@
 #include "collision_utils.hpp"
 #include "difficulty.hpp"
 #include "formatter.hpp"
+#include "formula.hpp"
 #include "preferences.hpp"
 #include "iphone_controls.hpp"
 #include "joystick.hpp"
@@ -24,12 +25,13 @@
 #include "level_runner.hpp"
 #include "playable_custom_object.hpp"
 #include "string_utils.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 playable_custom_object::playable_custom_object(const custom_object& obj)
   : custom_object(obj), player_info_(*this), difficulty_(0), vertical_look_(0),
     underwater_ctrl_x_(0), underwater_ctrl_y_(0), underwater_controls_(false),
-	can_interact_(0)
+	can_interact_(0), slot_definition_checked_(NULL), slot_definition_usable_(false)
 {
 }
 
@@ -38,7 +40,7 @@ playable_custom_object::playable_custom_object(const playable_custom_object& obj
     difficulty_(obj.difficulty_),
     save_condition_(obj.save_condition_), vertical_look_(0),
     underwater_ctrl_x_(0), underwater_ctrl_y_(0), underwater_controls_(false),
-	can_interact_(0)
+	can_interact_(0), slot_definition_checked_(NULL), slot_definition_usable_(false)
 {
 	player_info_.set_entity(*this);
 }
@@ -48,7 +50,7 @@ playable_custom_object::playable_custom_object(variant node)
     difficulty_(node["difficulty"].as_int(0)),
     vertical_look_(0), underwater_ctrl_x_(0), underwater_ctrl_y_(0),
 	underwater_controls_(node["underwater_controls"].as_bool(false)),
-	can_interact_(0)
+	can_interact_(0), slot_definition_checked_(NULL), slot_definition_usable_(false)
 {
 }
 
@@ -152,10 +154,43 @@ void playable_custom_object::process(level& lvl)
 
 namespace {
 	static const char* ctrl[] = { "ctrl_up", "ctrl_down", "ctrl_left", "ctrl_right", "ctrl_attack", "ctrl_jump", "ctrl_tongue" };
+
+//the keys get_value() answers without passing them to custom_object,
+//other than the controls and those starting with difficulty_.
+const char* const PlayerKeys[] = {
+	"difficulty", "can_interact", "underwater_controls", "ctrl_mod_key",
+	"ctrl_keys", "ctrl_mice", "ctrl_tilt", "ctrl_x", "ctrl_y",
+	"ctrl_reverse_ab", "control_scheme", "player", "vertical_look",
+};
+
+bool is_player_key(const std::string& key)
+{
+	if(key.compare(0, 11, "difficulty_") == 0) {
+		return true;
+	}
+
+	for(int n = 0; n != sizeof(PlayerKeys)/sizeof(*PlayerKeys); ++n) {
+		if(key == PlayerKeys[n]) {
+			return true;
+		}
+	}
+
+	for(int n = 0; n != sizeof(ctrl)/sizeof(*ctrl); ++n) {
+		if(key == ctrl[n]) {
+			return true;
+		}
+	}
+
+	return false;
+}
 }
 
 variant playable_custom_object::get_value(const std::string& key) const
 {
+	if(is_player_key(key)) {
+		note_uncacheable_read();
+	}
+
 	if(key.substr(0, 11) == "difficulty_") {
 		return variant(difficulty::from_string(key.substr(11)));		
 	} else if(key == "difficulty") {
@@ -279,6 +314,50 @@ variant playable_custom_object::get_value(const std::string& key) const
 	return custom_object::get_value(key);
 }
 
+variant playable_custom_object::get_value_by_slot(int slot) const
+{
+	//the controls are given as ints, as get_value() does.
+	if(slot >= CUSTOM_OBJECT_CTRL_UP && slot <= CUSTOM_OBJECT_CTRL_TONGUE) {
+		note_uncacheable_read();
+		return variant(control_status(static_cast<controls::CONTROL_ITEM>(slot - CUSTOM_OBJECT_CTRL_UP)));
+	}
+
+	return custom_object::get_value_by_slot(slot);
+}
+
+namespace {
+bool has_player_key_slot(const game_logic::formula_callable_definition& def)
+{
+	for(int n = 0; n != sizeof(PlayerKeys)/sizeof(*PlayerKeys); ++n) {
+		if(def.get_slot(PlayerKeys[n]) >= 0) {
+			return true;
+		}
+	}
+
+	for(int n = 0; n != def.num_slots(); ++n) {
+		const game_logic::formula_callable_definition::entry* e = def.get_entry(n);
+		if(e && e->id.compare(0, 11, "difficulty_") == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+}
+
+const game_logic::formula_callable_definition* playable_custom_object::get_slot_definition() const
+{
+	//the type's slots give the same values as get_value() unless the
+	//type has a property named after one of the keys answered here.
+	const game_logic::formula_callable_definition* def = type_slot_definition();
+	if(def != slot_definition_checked_) {
+		slot_definition_checked_ = def;
+		slot_definition_usable_ = !has_player_key_slot(*def);
+	}
+
+	return slot_definition_usable_ ? def : NULL;
+}
+
 void playable_custom_object::set_value(const std::string& key, const variant& value)
 {
 	if(key == "difficulty") {
@@ -321,3 +400,34 @@ void playable_custom_object::set_value(const std::string& key, const variant& va
 		custom_object::set_value(key, value);
 	}
 }
+
+UNIT_TEST(playable_custom_object_slot_definition) {
+	custom_object* obj = new custom_object("benchmark_solid_block", 10, 20, true);
+	variant obj_ref(obj);
+	playable_custom_object* player = new playable_custom_object(*obj);
+	variant player_ref(player);
+
+	//players use their type's slots, so the dot operator's inline cache
+	//works for them.
+	const game_logic::formula_callable_definition* def = player->query_slot_definition();
+	CHECK(def != NULL, "players have no slot definition");
+	CHECK(def->get_slot("x") >= 0, "x is not a slot");
+
+	const int ctrl_slot = def->get_slot("ctrl_up");
+	CHECK_EQ(player->query_value_by_slot(ctrl_slot), player->query_value("ctrl_up"));
+
+	game_logic::map_formula_callable* lvl = new game_logic::map_formula_callable;
+	variant lvl_ref(lvl);
+	lvl->add("player", player_ref);
+
+	game_logic::map_formula_callable* callable = new game_logic::map_formula_callable;
+	variant callable_ref(callable);
+	callable->add("level", lvl_ref);
+
+	game_logic::formula f(variant("level.player.x"));
+	CHECK_EQ(f.execute(*callable), player->query_value("x"));
+	CHECK_EQ(f.execute(*callable), variant(10));
+
+	game_logic::formula ctrl(variant("level.player.ctrl_up"));
+	CHECK_EQ(ctrl.execute(*callable), player->query_value("ctrl_up"));
+}
@@ -47,6 +47,7 @@ public:
 	virtual int vertical_look() const { return vertical_look_; }
 
 	virtual bool is_active(const rect& screen_area) const;
+	virtual bool get_index_area(rect* area) const { return false; }
 
 	bool can_interact() const { return can_interact_ != 0; }
 
@@ -59,6 +60,8 @@ private:
 
 	virtual void process(level& lvl);
 	variant get_value(const std::string& key) const;	
+	variant get_value_by_slot(int slot) const;
+	const game_logic::formula_callable_definition* get_slot_definition() const;
 	void set_value(const std::string& key, const variant& value);
 
 	player_info player_info_;
@@ -79,6 +82,11 @@ private:
 
 	boost::scoped_ptr<controls::local_controls_lock> control_lock_;
 
+	//whether the type's definition, last checked for the given one, can
+	//be used as our slot definition.
+	mutable const game_logic::formula_callable_definition* slot_definition_checked_;
+	mutable bool slot_definition_usable_;
+
 	void operator=(const playable_custom_object);
 };
 
@@ -75,6 +75,7 @@ void solid_map::create_object_solid_maps(variant node, std::vector<const_solid_m
 		if(legs_height == 0) {
 			body_map->calculate_side(0, 1, body_map->bottom_);
 		}
+		body_map->calculate_spans();
 		v.push_back(body_map);
 	} else {
 		legs_height = area.h();
@@ -102,6 +103,7 @@ void solid_map::create_object_solid_maps(variant node, std::vector<const_solid_m
 		legs_map->calculate_side(-1, 0, legs_map->left_);
 		legs_map->calculate_side(1, 0, legs_map->right_);
 		legs_map->calculate_side(-10000, 0, legs_map->all_);
+		legs_map->calculate_spans();
 		v.push_back(legs_map);
 	}
 }
@@ -123,6 +125,7 @@ void solid_map::create_object_platform_maps(const rect& area_ref, std::vector<co
 	platform->calculate_side(-1, 0, platform->left_);
 	platform->calculate_side(1, 0, platform->right_);
 	platform->calculate_side(-100000, 0, platform->all_);
+	platform->calculate_spans();
 	v.push_back(platform);
 }
 solid_map_ptr solid_map::create_from_texture(const graphics::texture& t, const rect& area_rect)
@@ -234,6 +237,12 @@ const std::vector<point>& solid_map::dir(MOVE_DIRECTION d) const
 	}
 }
 
+const std::vector<solid_map::span>& solid_map::dir_spans(MOVE_DIRECTION d) const
+{
+	assert(d >= MOVE_LEFT && d <= MOVE_NONE);
+	return spans_[d];
+}
+
 void solid_map::set_solid(int x, int y, bool value)
 {
 	ASSERT_EQ(solid_.size(), area_.w()*area_.h());
@@ -284,6 +293,25 @@ void solid_map::calculate_side(int xdir, int ydir, std::vector<point>& points) c
 	}
 }
 
+void solid_map::calculate_spans()
+{
+	for(int d = MOVE_LEFT; d <= MOVE_NONE; ++d) {
+		std::vector<span>& spans = spans_[d];
+		spans.clear();
+
+		//points are found row by row, left to right, so a run is a
+		//sequence of neighbouring points on the same row.
+		foreach(const point& p, dir(static_cast<MOVE_DIRECTION>(d))) {
+			if(spans.empty() == false && spans.back().y == p.y && spans.back().x2 + 1 == p.x) {
+				spans.back().x2 = p.x;
+			} else {
+				span s = { p.y, p.x, p.x };
+				spans.push_back(s);
+			}
+		}
+	}
+}
+
 const_solid_info_ptr solid_info::create_from_solid_maps(const std::vector<const_solid_map_ptr>& solid)
 {
 	if(solid.empty()) {
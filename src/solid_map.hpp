@@ -49,6 +49,14 @@ public:
 	const std::vector<point>& top() const { return top_; }
 	const std::vector<point>& bottom() const { return bottom_; }
 	const std::vector<point>& all() const { return all_; }
+
+	//a run of solid points on a row, from x1 to x2 inclusive.
+	struct span {
+		int y, x1, x2;
+	};
+
+	//the points in dir(d) as runs along rows, in the same order.
+	const std::vector<span>& dir_spans(MOVE_DIRECTION d) const;
 private:
 	static const_solid_map_ptr create_object_solid_map_from_solid_node(variant node);
 
@@ -57,6 +65,7 @@ private:
 	void set_solid(int x, int y, bool value=true);
 
 	void calculate_side(int xdir, int ydir, std::vector<point>& points) const;
+	void calculate_spans();
 
 	void apply_offsets(const std::vector<int>& offsets);
 
@@ -67,6 +76,9 @@ private:
 
 	//all the solid points that are on the different sides of the solid area.
 	std::vector<point> left_, right_, top_, bottom_, all_;
+
+	//the sides as spans, indexed by MOVE_DIRECTION.
+	std::vector<span> spans_[MOVE_NONE+1];
 };
 
 class solid_info
@@ -14,6 +14,7 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <cmath>
 #include <set>
 #include <stdlib.h>
@@ -24,6 +25,7 @@
 
 #include "boost/algorithm/string/replace.hpp"
 #include "boost/lexical_cast.hpp"
+#include "boost/unordered_set.hpp"
 
 #include "asserts.hpp"
 #include "foreach.hpp"
@@ -33,10 +35,13 @@
 #include "formula_callable_utils.hpp"
 #include "formula_interface.hpp"
 #include "formula_object.hpp"
+#include "formula_pool.hpp"
 
 #include "i18n.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
+#include "variant_hash_map.hpp"
 #include "variant_type.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -153,18 +158,41 @@ type_error::type_error(const std::string& str) : message(str) {
 	std::cerr << output_formula_error_info();
 }
 
+namespace {
+//concatenations producing lists at least this long are done by building a
+//tree of the operands rather than copying them, unless the left operand
+//can be extended in place.
+const size_t ListTreeThreshold = 64;
+
+//concatenations producing strings at least this long are done lazily.
+const size_t StringConcatThreshold = 256;
+
+//leaves of a list tree smaller than this are merged when concatenated, so
+//appending one element at a time doesn't build a tree of single elements.
+const size_t ListTreeChunkSize = 32;
+}
+
 struct variant_list {
+	FORMULA_POOL_ALLOCATED
+
 
 	variant_list() : begin(elements.begin()), end(elements.end()),
-	                 refcount(0), storage(NULL)
+	                 refcount(0), storage(NULL),
+	                 left(NULL), right(NULL), tree_size(0), tree_height(0)
 	{}
 
+	//o must not be a tree, call flatten() on it first.
 	variant_list(const variant_list& o) :
 	   elements(o.begin, o.end), begin(elements.begin()), end(elements.end()),
-	   refcount(1), storage(NULL)
-	{}
+	   refcount(1), storage(NULL),
+	   left(NULL), right(NULL), tree_size(0), tree_height(0)
+	{
+		assert(!o.is_tree());
+	}
 
 	const variant_list& operator=(const variant_list& o) {
+		assert(!o.is_tree());
+		release_tree();
 		elements.assign(o.begin, o.end),
 		begin = elements.begin();
 		end = elements.end();
@@ -176,9 +204,100 @@ struct variant_list {
 		if(storage && --storage->refcount == 0) {
 			delete storage;
 		}
+
+		release_tree();
+	}
+
+	size_t size() const { return left ? tree_size : end - begin; }
+
+	bool is_tree() const { return left != NULL; }
+
+	//element access which works on trees without flattening them.
+	const variant& at(size_t n) const {
+		const variant_list* l = this;
+		while(l->left) {
+			const size_t left_size = l->left->size();
+			if(n < left_size) {
+				l = l->left;
+			} else {
+				n -= left_size;
+				l = l->right;
+			}
+		}
+
+		return l->begin[n];
+	}
+
+	//turns a tree into a flat list, so begin and end are valid.
+	void flatten() {
+		if(left == NULL) {
+			return;
+		}
+
+		std::vector<variant> items;
+		items.reserve(tree_size);
+		append_to(items);
+		release_tree();
+
+		elements.swap(items);
+		begin = elements.begin();
+		end = elements.end();
+	}
+
+	//concatenates two non-empty lists into a height balanced tree. The
+	//result shares the storage of a and b and has a refcount of 0.
+	static variant_list* join(variant_list* a, variant_list* b) {
+		const int ha = height(a), hb = height(b);
+		if(ha > hb + 1 || (hb == 0 && ha > 0 && b->size() < ListTreeChunkSize)) {
+			return balance(a->left, join(a->right, b));
+		} else if(hb > ha + 1 || (ha == 0 && hb > 0 && a->size() < ListTreeChunkSize)) {
+			return balance(join(a, b->left), b->right);
+		} else if(ha == 0 && hb == 0 && a->size() + b->size() <= ListTreeChunkSize) {
+			variant_list* result = new variant_list;
+			result->elements.reserve(a->size() + b->size());
+			result->elements.insert(result->elements.end(), a->begin, a->end);
+			result->elements.insert(result->elements.end(), b->begin, b->end);
+			result->begin = result->elements.begin();
+			result->end = result->elements.end();
+			return result;
+		}
+
+		return make_node(a, b);
 	}
 
-	size_t size() const { return end - begin; }
+	//the elements from begin to end of a list, which may be a tree. Only
+	//the nodes along the edges of the slice are new, the rest are shared
+	//with l. The result has a refcount of 0 unless it's l or part of it.
+	static variant_list* slice(variant_list* l, size_t begin, size_t end) {
+		if(begin == 0 && end == l->size()) {
+			return l;
+		}
+
+		if(l->left == NULL) {
+			variant_list* result = new variant_list;
+			result->begin = l->begin + begin;
+			result->end = l->begin + end;
+			result->storage = l;
+			l->refcount++;
+			return result;
+		}
+
+		const size_t left_size = l->left->size();
+		if(end <= left_size) {
+			return slice(l->left, begin, end);
+		} else if(begin >= left_size) {
+			return slice(l->right, begin - left_size, end - left_size);
+		}
+
+		variant_list* a = slice(l->left, begin, left_size);
+		variant_list* b = slice(l->right, 0, end - left_size);
+		variant_list* result = join(a, b);
+
+		//join() adopts its arguments or copies them.
+		discard(a);
+		discard(b);
+		return result;
+	}
 
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::formula_expression> expression;
@@ -186,26 +305,278 @@ struct variant_list {
 	std::vector<variant>::iterator begin, end;
 	int refcount;
 	variant_list* storage;
+
+	//a large list built by concatenation is a node in a tree of lists
+	//instead, with begin and end unused. The leaves are flat lists, possibly
+	//slices, whose storage is shared with the lists they came from.
+	variant_list* left;
+	variant_list* right;
+	size_t tree_size;
+	int tree_height;
+
+private:
+	static int height(const variant_list* l) { return l->left ? l->tree_height : 0; }
+
+	static variant_list* make_node(variant_list* l, variant_list* r) {
+		variant_list* result = new variant_list;
+		result->left = l;
+		result->right = r;
+		l->refcount++;
+		r->refcount++;
+		result->tree_size = l->size() + r->size();
+		result->tree_height = std::max(height(l), height(r)) + 1;
+		return result;
+	}
+
+	//nodes made during a join which don't end up in the result are freed.
+	static void discard(variant_list* l) {
+		if(l->refcount == 0) {
+			delete l;
+		}
+	}
+
+	//makes a node of l and r, rotating if their heights differ by two.
+	static variant_list* balance(variant_list* l, variant_list* r) {
+		const int hl = height(l), hr = height(r);
+		variant_list* result = NULL;
+		if(hl > hr + 1) {
+			variant_list* lr = l->right;
+			if(height(l->left) >= height(lr)) {
+				result = make_node(l->left, make_node(lr, r));
+			} else {
+				result = make_node(make_node(l->left, lr->left), make_node(lr->right, r));
+			}
+			discard(l);
+		} else if(hr > hl + 1) {
+			variant_list* rl = r->left;
+			if(height(r->right) >= height(rl)) {
+				result = make_node(make_node(l, rl), r->right);
+			} else {
+				result = make_node(make_node(l, rl->left), make_node(rl->right, r->right));
+			}
+			discard(r);
+		} else {
+			result = make_node(l, r);
+		}
+
+		return result;
+	}
+
+	void append_to(std::vector<variant>& v) const {
+		if(left) {
+			left->append_to(v);
+			right->append_to(v);
+		} else {
+			v.insert(v.end(), begin, end);
+		}
+	}
+
+	void release_tree() {
+		if(left == NULL) {
+			return;
+		}
+
+		if(--left->refcount == 0) {
+			delete left;
+		}
+
+		if(--right->refcount == 0) {
+			delete right;
+		}
+
+		left = right = NULL;
+		tree_size = 0;
+		tree_height = 0;
+	}
+};
+
+//the shared contents of interned strings. There is only ever one
+//instance for any given string, so equal interned strings can be
+//compared by pointer.
+struct interned_string {
+	std::string str;
+	size_t hash;
+	int refcount;
+};
+
+namespace {
+struct interned_string_hash {
+	size_t operator()(const interned_string* s) const { return s->hash; }
+	size_t operator()(const std::string& s) const { return boost::hash<std::string>()(s); }
+};
+
+struct interned_string_equal {
+	bool operator()(const interned_string* a, const interned_string* b) const { return a->str == b->str; }
+	bool operator()(const std::string& a, const interned_string* b) const { return a == b->str; }
 };
 
+typedef boost::unordered_set<interned_string*, interned_string_hash, interned_string_equal> interned_string_table;
+
+//the table doesn't hold references; entries are removed when their last
+//reference goes away. Strings are interned while parsing JSON, which also
+//happens on the level loading thread, so the table and the reference counts
+//of its entries are guarded by a mutex.
+interned_string_table& get_interned_strings()
+{
+	static interned_string_table* table = new interned_string_table;
+	return *table;
+}
+
+threading::mutex& get_interned_strings_mutex()
+{
+	static threading::mutex* mutex = new threading::mutex;
+	return *mutex;
+}
+
+interned_string* intern_string(const std::string& str)
+{
+	threading::lock lck(get_interned_strings_mutex());
+	interned_string_table& table = get_interned_strings();
+	interned_string_table::iterator i = table.find(str, interned_string_hash(), interned_string_equal());
+	if(i != table.end()) {
+		++(*i)->refcount;
+		return *i;
+	}
+
+	interned_string* result = new interned_string;
+	result->str = str;
+	result->hash = interned_string_hash()(str);
+	result->refcount = 1;
+	table.insert(result);
+	return result;
+}
+
+void add_interned_string_ref(interned_string* s)
+{
+	threading::lock lck(get_interned_strings_mutex());
+	++s->refcount;
+}
+
+void release_interned_string(interned_string* s)
+{
+	threading::lock lck(get_interned_strings_mutex());
+	if(--s->refcount == 0) {
+		get_interned_strings().erase(s);
+		delete s;
+	}
+}
+}
+
 struct variant_string {
+	FORMULA_POOL_ALLOCATED
+
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::formula_expression> expression;
 
-	variant_string() : refcount(0)
+	variant_string() : interned(NULL), refcount(0), left(NULL), right(NULL), length(0)
 	{}
-	variant_string(const variant_string& o) : str(o.str), translated_from(o.translated_from), refcount(1)
-	{}
-	std::string str, translated_from;
+	variant_string(const variant_string& o) : str(o.left ? o.get() : o.str), translated_from(o.translated_from), interned(o.interned), refcount(1), left(NULL), right(NULL), length(0)
+	{
+		if(interned) {
+			add_interned_string_ref(interned);
+		}
+	}
+
+	~variant_string() {
+		if(interned) {
+			release_interned_string(interned);
+		}
+
+		release_pieces();
+	}
+
+	//interned strings keep their contents in the shared interned_string
+	//rather than in str.
+	const std::string& get() const {
+		if(left) {
+			flatten();
+		}
+
+		return interned ? interned->str : str;
+	}
+
+	size_t size() const { return left ? length : get().size(); }
+
+	//makes a string which is the concatenation of a and b without copying
+	//them. The result has a refcount of 0 and is flattened when first read.
+	static variant_string* concat(variant_string* a, variant_string* b) {
+		variant_string* result = new variant_string;
+		result->left = a;
+		result->right = b;
+		a->refcount++;
+		b->refcount++;
+		result->length = a->size() + b->size();
+		return result;
+	}
+
+	mutable std::string str;
+	std::string translated_from;
+	interned_string* interned;
 	int refcount;
 
 	std::vector<const game_logic::formula*> formulae_using_this;
 
 	private:
 	void operator=(const variant_string&);
+
+	void flatten() const {
+		std::string result;
+		result.reserve(length);
+
+		std::vector<const variant_string*> stack(1, this);
+		while(!stack.empty()) {
+			const variant_string* s = stack.back();
+			stack.pop_back();
+			if(s->left) {
+				stack.push_back(s->right);
+				stack.push_back(s->left);
+			} else {
+				result += s->get();
+			}
+		}
+
+		str.swap(result);
+		release_pieces();
+	}
+
+	//strings built in a loop form a long chain of pieces, so they are
+	//released iteratively rather than through recursive destructors.
+	void release_pieces() const {
+		if(left == NULL) {
+			return;
+		}
+
+		std::vector<variant_string*> pending;
+		pending.push_back(left);
+		pending.push_back(right);
+		left = right = NULL;
+		length = 0;
+
+		while(!pending.empty()) {
+			variant_string* s = pending.back();
+			pending.pop_back();
+			if(--s->refcount == 0) {
+				if(s->left) {
+					pending.push_back(s->left);
+					pending.push_back(s->right);
+					s->left = s->right = NULL;
+				}
+
+				delete s;
+			}
+		}
+	}
+
+	//a string made by concatenation holds its pieces until it's first
+	//read, rather than copying them.
+	mutable variant_string* left;
+	mutable variant_string* right;
+	mutable size_t length;
 };
 
 struct variant_map {
+	FORMULA_POOL_ALLOCATED
+
 	variant::debug_info info;
 	boost::intrusive_ptr<const game_logic::formula_expression> expression;
 
@@ -214,14 +585,14 @@ struct variant_map {
 	variant_map(const variant_map& o) : expression(o.expression), elements(o.elements), refcount(1)
 	{}
 
-	std::map<variant,variant> elements;
+	variant_hash_map elements;
 	int refcount;
 private:
 	void operator=(const variant_map&);
 };
 
 struct variant_fn {
-	variant_fn() : refcount(0)
+	variant_fn() : refcount(0), return_type_proven(false)
 	{}
 
 	std::vector<std::string> arg_names;
@@ -238,6 +609,10 @@ struct variant_fn {
 	int refcount;
 	std::vector<variant_type_ptr> variant_types;
 	variant_type_ptr return_type;
+
+	//set when static analysis proved the function's result always
+	//matches return_type.
+	bool return_type_proven;
 };
 
 struct variant_multi_fn {
@@ -507,6 +882,21 @@ variant::variant(const std::string& str)
 	increment_refcount();
 }
 
+variant variant::create_interned_string(const std::string& str)
+{
+	variant v;
+	v.type_ = VARIANT_TYPE_STRING;
+	v.string_ = new variant_string;
+	v.string_->interned = intern_string(str);
+	v.increment_refcount();
+	return v;
+}
+
+bool variant::is_interned_string() const
+{
+	return type_ == VARIANT_TYPE_STRING && string_->interned != NULL;
+}
+
 variant variant::create_translated_string(const std::string& str)
 {
 	return create_translated_string(str, i18n::tr(str));
@@ -531,11 +921,14 @@ variant::variant(std::map<variant,variant>* map)
 
 	assert(map);
 	map_ = new variant_map;
-	map_->elements.swap(*map);
+	for(std::map<variant, variant>::const_iterator i = map->begin(); i != map->end(); ++i) {
+		map_->elements[i->first] = i->second;
+	}
+	map->clear();
 	increment_refcount();
 }
 
-variant::variant(game_logic::const_formula_ptr fml, const std::vector<std::string>& args, const game_logic::formula_callable& callable, int base_slot, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, const variant_type_ptr& return_type)
+variant::variant(game_logic::const_formula_ptr fml, const std::vector<std::string>& args, const game_logic::formula_callable& callable, int base_slot, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, const variant_type_ptr& return_type, bool return_type_proven)
   : type_(VARIANT_TYPE_FUNCTION)
 {
 	fn_ = new variant_fn;
@@ -549,6 +942,7 @@ variant::variant(game_logic::const_formula_ptr fml, const std::vector<std::strin
 	ASSERT_EQ(fn_->variant_types.size(), fn_->arg_names.size());
 
 	fn_->return_type = return_type;
+	fn_->return_type_proven = return_type_proven;
 	increment_refcount();
 
 	if(fml->str_var().get_debug_info()) {
@@ -585,7 +979,7 @@ const variant& variant::operator[](size_t n) const
 		generate_error(formatter() << "invalid index of " << n << " into " << write_json());
 	}
 
-	return list_->begin[n];
+	return list_->at(n);
 }
 
 const variant& variant::operator[](const variant v) const
@@ -597,8 +991,8 @@ const variant& variant::operator[](const variant v) const
 
 	if(type_ == VARIANT_TYPE_MAP) {
 		assert(map_);
-		std::map<variant,variant>::const_iterator i = map_->elements.find(v);
-		if (i == map_->elements.end())
+		const variant* value = map_->elements.find(v);
+		if(value == NULL)
 		{
 			last_failed_query_map = *this;
 			last_failed_query_key = v;
@@ -607,7 +1001,7 @@ const variant& variant::operator[](const variant v) const
 		}
 
 		last_query_map = *this;
-		return i->second;
+		return *value;
 	} else if(type_ == VARIANT_TYPE_LIST) {
 		return operator[](v.as_int());
 	} else {
@@ -632,8 +1026,8 @@ bool variant::has_key(const variant& key) const
 		return false;
 	}
 
-	std::map<variant,variant>::const_iterator i = map_->elements.find(key);
-	if(i != map_->elements.end() && i->second.is_null() == false) {
+	const variant* value = map_->elements.find(key);
+	if(value != NULL && value->is_null() == false) {
 		return true;
 	} else {
 		return false;
@@ -649,9 +1043,12 @@ variant variant::get_keys() const
 {
 	must_be(VARIANT_TYPE_MAP);
 	assert(map_);
+	std::vector<const variant_hash_map::value_type*> sorted;
+	map_->elements.get_sorted(&sorted);
 	std::vector<variant> tmp;
-	for(std::map<variant,variant>::const_iterator i=map_->elements.begin(); i != map_->elements.end(); ++i) {
-			tmp.push_back(i->first);
+	tmp.reserve(sorted.size());
+	foreach(const variant_hash_map::value_type* item, sorted) {
+		tmp.push_back(item->first);
 	}
 	return variant(&tmp);
 }
@@ -660,9 +1057,12 @@ variant variant::get_values() const
 {
 	must_be(VARIANT_TYPE_MAP);
 	assert(map_);
+	std::vector<const variant_hash_map::value_type*> sorted;
+	map_->elements.get_sorted(&sorted);
 	std::vector<variant> tmp;
-	for(std::map<variant,variant>::const_iterator i=map_->elements.begin(); i != map_->elements.end(); ++i) {
-			tmp.push_back(i->second);
+	tmp.reserve(sorted.size());
+	foreach(const variant_hash_map::value_type* item, sorted) {
+		tmp.push_back(item->second);
 	}
 	return variant(&tmp);
 }
@@ -678,7 +1078,7 @@ size_t variant::num_elements() const
 		return list_->size();
 	} else if (type_ == VARIANT_TYPE_STRING) {
 		assert(string_);
-		return string_->str.size();
+		return string_->size();
 	} else if (type_ == VARIANT_TYPE_MAP) {
 		assert(map_);
 		return map_->elements.size();
@@ -707,6 +1107,14 @@ variant variant::get_list_slice(int begin, int end) const
 		generate_error(formatter() << "ILLEGAL INDEX INTO LIST WHEN SLICING: " << begin << ", " << end << " / " << list_->size());
 	}
 
+	if(list_->is_tree()) {
+		result = variant();
+		result.type_ = VARIANT_TYPE_LIST;
+		result.list_ = variant_list::slice(list_, begin, end);
+		result.increment_refcount();
+		return result;
+	}
+
 	result.list_->begin = list_->begin + begin;
 	result.list_->end = list_->begin + end;
 	result.list_->storage = list_;
@@ -772,6 +1180,12 @@ bool variant::function_call_valid(const std::vector<variant>& passed_args, std::
 }
 
 variant variant::operator()(const std::vector<variant>& passed_args) const
+{
+	static const std::vector<variant_type_ptr> no_proven_types;
+	return call_with_proven_types(passed_args, no_proven_types);
+}
+
+variant variant::call_with_proven_types(const std::vector<variant>& passed_args, const std::vector<variant_type_ptr>& proven_types) const
 {
 	if(type_ == VARIANT_TYPE_MULTI_FUNCTION) {
 		foreach(const variant& v, multi_fn_->functions) {
@@ -816,8 +1230,14 @@ variant variant::operator()(const std::vector<variant>& passed_args) const
 		generate_error(formatter() << "Function passed " << args->size() << " arguments, between " <<  min_args << " and " << max_args << " expected (" << str.str() << ")");
 	}
 
+	const int nbound_args = fn_->bound_args.size();
 	for(size_t n = 0; n != args->size(); ++n) {
-		if(n < fn_->variant_types.size() && fn_->variant_types[n]) {
+		//proven types are indexed by the arguments passed at the call site,
+		//which come after any bound arguments.
+		const int proven_index = static_cast<int>(n) - nbound_args;
+		const variant_type_ptr proven_type = proven_index >= 0 && proven_index < static_cast<int>(proven_types.size()) ? proven_types[proven_index] : variant_type_ptr();
+
+		if(n < fn_->variant_types.size() && fn_->variant_types[n] && (!proven_type || (proven_type != fn_->variant_types[n] && !proven_type->is_equal(*fn_->variant_types[n])))) {
 	//		if((*args)[n].is_map() && fn_->variant_types[n]->is_class(NULL))
 			if(fn_->variant_types[n]->match((*args)[n]) == false) {
 				std::string class_name;
@@ -859,7 +1279,7 @@ variant variant::operator()(const std::vector<variant>& passed_args) const
 	}
 
 	const variant result = fn_->fn->execute(*callable);
-	if(fn_->return_type && !fn_->return_type->match(result)) {
+	if(fn_->return_type && !fn_->return_type_proven && !fn_->return_type->match(result)) {
 		call_stack_manager scope(fn_->fn->expr().get(), callable.get());
 		generate_error(formatter() << "Function returned incorrect type, expecting " << fn_->return_type->to_string() << " but found " << result.write_json() << " (type: " << get_variant_type_from_value(result)->to_string() << ") FOR " << fn_->fn->str());
 	}
@@ -912,7 +1332,7 @@ bool variant::as_bool() const
 	case VARIANT_TYPE_MAP:
 		return !map_->elements.empty();
 	case VARIANT_TYPE_STRING:
-		return !string_->str.empty();
+		return !string_->get().empty();
 	case VARIANT_TYPE_FUNCTION:
 		return true;
 	default:
@@ -924,6 +1344,7 @@ bool variant::as_bool() const
 std::vector<variant> variant::as_list() const
 {
 	if(is_list()) {
+		list_->flatten();
 		if(list_->elements.empty() == false) {
 			return list_->elements;
 		} else {
@@ -942,6 +1363,7 @@ std::vector<std::string> variant::as_list_string() const
 {
 	std::vector<std::string> result;
 	must_be(VARIANT_TYPE_LIST);
+	list_->flatten();
 	result.reserve(list_->size());
 	for(int n = 0; n != list_->size(); ++n) {
 		list_->begin[n].must_be(VARIANT_TYPE_STRING);
@@ -964,6 +1386,7 @@ std::vector<int> variant::as_list_int() const
 {
 	std::vector<int> result;
 	must_be(VARIANT_TYPE_LIST);
+	list_->flatten();
 	result.reserve(list_->size());
 	for(int n = 0; n != list_->size(); ++n) {
 		result.push_back(list_->begin[n].as_int());
@@ -976,6 +1399,7 @@ std::vector<decimal> variant::as_list_decimal() const
 {
 	std::vector<decimal> result;
 	must_be(VARIANT_TYPE_LIST);
+	list_->flatten();
 	result.reserve(list_->size());
 	for(int n = 0; n != list_->size(); ++n) {
 		result.push_back(list_->begin[n].as_decimal());
@@ -984,12 +1408,21 @@ std::vector<decimal> variant::as_list_decimal() const
 	return result;
 }
 
-const std::map<variant,variant>& variant::as_map() const
+std::map<variant,variant> variant::as_map() const
+{
+	if(is_map()) {
+		return std::map<variant,variant>(map_->elements.begin(), map_->elements.end());
+	} else {
+		return std::map<variant,variant>();
+	}
+}
+
+const variant_hash_map& variant::as_hash_map() const
 {
 	if(is_map()) {
 		return map_->elements;
 	} else {
-		static std::map<variant,variant> EmptyMap;
+		static variant_hash_map EmptyMap;
 		return EmptyMap;
 	}
 }
@@ -1049,10 +1482,7 @@ void variant::remove_attr_mutation(variant key)
 variant* variant::get_attr_mutable(variant key)
 {
 	if(is_map()) {
-		std::map<variant,variant>::iterator i = map_->elements.find(key);
-		if(i != map_->elements.end()) {
-			return &i->second;
-		}
+		return map_->elements.find(key);
 	}
 
 	return NULL;
@@ -1062,6 +1492,7 @@ variant* variant::get_index_mutable(int index)
 {
 	if(is_list()) {
 		if(index >= 0 && index < list_->size()) {
+			list_->flatten();
 			return &list_->begin[index];
 		}
 	}
@@ -1160,7 +1591,7 @@ const std::string& variant::as_string() const
 {
 	must_be(VARIANT_TYPE_STRING);
 	assert(string_);
-	return string_->str;
+	return string_->get();
 }
 
 variant variant::operator+(const variant& v) const
@@ -1171,22 +1602,33 @@ variant variant::operator+(const variant& v) const
 		return variant(int_value_ + v.int_value_);
 	}
 
-	if(type_ == VARIANT_TYPE_STRING) {
-		if(v.type_ == VARIANT_TYPE_MAP) {
-			return variant(as_string() + v.as_string());
-		} else if(v.type_ == VARIANT_TYPE_STRING) {
-			return variant(as_string() + v.as_string());
+	if(type_ == VARIANT_TYPE_STRING || v.type_ == VARIANT_TYPE_STRING) {
+		variant lhs = *this, rhs = v;
+		if(lhs.type_ != VARIANT_TYPE_STRING) {
+			std::string s;
+			serialize_to_string(s);
+			lhs = variant(s);
 		}
 
-		std::string s;
-		v.serialize_to_string(s);
-		return variant(as_string() + s);
-	}
+		if(rhs.type_ == VARIANT_TYPE_MAP) {
+			rhs = variant(v.as_string());
+		} else if(rhs.type_ != VARIANT_TYPE_STRING) {
+			std::string s;
+			v.serialize_to_string(s);
+			rhs = variant(s);
+		}
+
+		if(lhs.string_->size() + rhs.string_->size() < StringConcatThreshold) {
+			return variant(lhs.string_->get() + rhs.string_->get());
+		}
 
-	if(v.type_ == VARIANT_TYPE_STRING) {
-		std::string s;
-		serialize_to_string(s);
-		return variant(s + v.as_string());
+		//long strings are joined lazily, so building a string with
+		//repeated + doesn't copy it every time.
+		variant result;
+		result.type_ = VARIANT_TYPE_STRING;
+		result.string_ = variant_string::concat(lhs.string_, rhs.string_);
+		result.increment_refcount();
+		return result;
 	}
 	if(type_ == VARIANT_TYPE_DECIMAL || v.type_ == VARIANT_TYPE_DECIMAL) {
 		return variant(as_decimal() + v.as_decimal());
@@ -1209,11 +1651,30 @@ variant variant::operator+(const variant& v) const
 	if(type_ == VARIANT_TYPE_LIST) {
 		if(v.type_ == VARIANT_TYPE_LIST) {
 			const size_t new_size = list_->size() + v.list_->size();
+			const bool can_extend = new_size <= list_->elements.capacity() && list_->storage == NULL && !list_->is_tree();
+
+			//trees can't be copied element by element below, but adding an
+			//empty list to one gives the same list.
+			if(v.list_->size() == 0 && list_->is_tree()) {
+				return *this;
+			} else if(list_->size() == 0 && v.list_->is_tree()) {
+				return v;
+			}
+
+			//large lists which can't be extended in place are joined into
+			//a tree which shares the storage of both operands.
+			if(list_->size() > 0 && v.list_->size() > 0 && (list_->is_tree() || v.list_->is_tree() || (new_size >= ListTreeThreshold && !can_extend))) {
+				variant result;
+				result.type_ = VARIANT_TYPE_LIST;
+				result.list_ = variant_list::join(list_, v.list_);
+				result.increment_refcount();
+				return result;
+			}
 
 			bool adopt_list = false;
 
 			std::vector<variant> res;
-			if(new_size <= list_->elements.capacity() && list_->storage == NULL) {
+			if(can_extend) {
 				res.swap(list_->elements);
 				adopt_list = true;
 			} else {
@@ -1239,13 +1700,17 @@ variant variant::operator+(const variant& v) const
 	}
 	if(type_ == VARIANT_TYPE_MAP) {
 		if(v.type_ == VARIANT_TYPE_MAP) {
-			std::map<variant,variant> res(map_->elements);
-
-			for(std::map<variant,variant>::const_iterator i = v.map_->elements.begin(); i != v.map_->elements.end(); ++i) {
-				res[i->first] = i->second;
+			variant result;
+			result.type_ = VARIANT_TYPE_MAP;
+			result.map_ = new variant_map;
+			result.map_->elements = map_->elements;
+			result.increment_refcount();
+
+			for(variant_hash_map::const_iterator i = v.map_->elements.begin(); i != v.map_->elements.end(); ++i) {
+				result.map_->elements[i->first] = i->second;
 			}
 
-			return variant(&res);
+			return result;
 		}
 	}
 
@@ -1289,6 +1754,7 @@ variant variant::operator*(const variant& v) const
 		if(ncopies < 0) {
 			ncopies *= -1;
 		}
+		list_->flatten();
 		std::vector<variant> res;
 		res.reserve(list_->size()*ncopies);
 		for(int n = 0; n != ncopies; ++n) {
@@ -1378,7 +1844,11 @@ bool variant::operator==(const variant& v) const
 	}
 
 	case VARIANT_TYPE_STRING: {
-		return string_->str == v.string_->str;
+		if(string_->interned && v.string_->interned) {
+			return string_->interned == v.string_->interned;
+		}
+
+		return string_->get() == v.string_->get();
 	}
 
 	case VARIANT_TYPE_BOOL: {
@@ -1433,6 +1903,64 @@ bool variant::operator==(const variant& v) const
 	return false;
 }
 
+size_t variant::hash() const
+{
+	switch(type_) {
+	case VARIANT_TYPE_NULL:
+	case VARIANT_TYPE_INT:
+	case VARIANT_TYPE_DECIMAL: {
+		//ints and decimals compare equal to each other, as does null to
+		//a zero decimal, so they all hash by their decimal value.
+		const int64_t value = type_ == VARIANT_TYPE_DECIMAL ? decimal_value_ : int64_t(type_ == VARIANT_TYPE_INT ? int_value_ : 0)*VARIANT_DECIMAL_PRECISION;
+		return boost::hash<int64_t>()(value);
+	}
+
+	case VARIANT_TYPE_BOOL:
+		return bool_value_ ? 0x9e3779b9 : 0x7f4a7c15;
+
+	case VARIANT_TYPE_STRING:
+		if(string_->interned) {
+			return string_->interned->hash;
+		}
+
+		return interned_string_hash()(string_->get());
+
+	case VARIANT_TYPE_LIST: {
+		list_->flatten();
+		size_t result = list_->size();
+		for(size_t n = 0; n != list_->size(); ++n) {
+			boost::hash_combine(result, list_->begin[n].hash());
+		}
+
+		return result;
+	}
+
+	case VARIANT_TYPE_MAP: {
+		//map equality doesn't depend on order, so neither can the hash.
+		size_t result = map_->elements.size();
+		for(variant_hash_map::const_iterator i = map_->elements.begin(); i != map_->elements.end(); ++i) {
+			size_t item = i->first.hash();
+			boost::hash_combine(item, i->second.hash());
+			result += item;
+		}
+
+		return result;
+	}
+
+	case VARIANT_TYPE_FUNCTION:
+		return boost::hash<const void*>()(fn_);
+
+	case VARIANT_TYPE_MULTI_FUNCTION:
+		return boost::hash<const void*>()(multi_fn_);
+
+	case VARIANT_TYPE_CALLABLE:
+		return callable_->hash();
+
+	default:
+		return type_;
+	}
+}
+
 bool variant::operator!=(const variant& v) const
 {
 	return !operator==(v);
@@ -1454,7 +1982,11 @@ bool variant::operator<=(const variant& v) const
 	}
 
 	case VARIANT_TYPE_STRING: {
-		return string_->str <= v.string_->str;
+		if(string_->interned && string_->interned == v.string_->interned) {
+			return true;
+		}
+
+		return string_->get() <= v.string_->get();
 	}
 
 	case VARIANT_TYPE_BOOL: {
@@ -1534,7 +2066,7 @@ void variant::throw_type_error(variant::TYPE t) const
 	}
 
 	if(last_query_map.is_map() && last_query_map.get_debug_info()) {
-		for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
+		for(variant_hash_map::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
 			if(this == &i->second) {
 				const debug_info* info = i->first.get_debug_info();
 				if(info == NULL) {
@@ -1545,7 +2077,7 @@ void variant::throw_type_error(variant::TYPE t) const
 			}
 		}
 	} else if(last_query_map.is_map() && last_query_map.get_source_expression()) {
-		for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
+		for(variant_hash_map::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
 			if(this == &i->second) {
 				generate_error(formatter() << "Map object generated in FFL was expected to have key '" << last_failed_query_key << "' of type " << variant_type_to_string(t) << " but this key was of type " << variant_type_to_string(i->second.type_) << " instead. The map was generated by this expression:\n" << last_failed_query_map.get_source_expression()->debug_pinpoint_location());
 			}
@@ -1609,6 +2141,7 @@ void variant::serialize_to_string(std::string& str) const
 		break;
 	}
 	case VARIANT_TYPE_LIST: {
+		list_->flatten();
 		str += "[";
 		bool first_time = true;
 		for(size_t i=0; i < list_->size(); ++i) {
@@ -1625,7 +2158,10 @@ void variant::serialize_to_string(std::string& str) const
 	case VARIANT_TYPE_MAP: {
 		str += "{";
 		bool first_time = true;
-		for(std::map<variant,variant>::const_iterator i=map_->elements.begin(); i != map_->elements.end(); ++i) {
+		std::vector<const variant_hash_map::value_type*> items;
+		map_->elements.get_sorted(&items);
+		for(int n = 0; n != items.size(); ++n) {
+			const variant_hash_map::value_type* i = items[n];
 			if(!first_time) {
 				str += ",";
 			}
@@ -1638,17 +2174,17 @@ void variant::serialize_to_string(std::string& str) const
 		break;
 	}
 	case VARIANT_TYPE_STRING: {
-		if( !string_->str.empty() ) {
-			if(string_->str[0] == '~' && string_->str[string_->str.length()-1] == '~') {
-				str += string_->str;
+		if( !string_->get().empty() ) {
+			if(string_->get()[0] == '~' && string_->get()[string_->get().length()-1] == '~') {
+				str += string_->get();
 			} else {
 				const char* delim = "'";
-				if(strchr(string_->str.c_str(), '\'')) {
+				if(strchr(string_->get().c_str(), '\'')) {
 					delim = "~";
 				}
 
 				str += delim;
-				str += string_->str;
+				str += string_->get();
 				str += delim;
 			}
 		}
@@ -1713,6 +2249,7 @@ void variant::make_unique()
 
 	switch(type_) {
 	case VARIANT_TYPE_LIST: {
+		list_->flatten();
 		list_->refcount--;
 		list_ = new variant_list(*list_);
 		foreach(variant& v, list_->elements) {
@@ -1726,8 +2263,8 @@ void variant::make_unique()
 		string_->refcount = 1;
 		break;
 	case VARIANT_TYPE_MAP: {
-		std::map<variant,variant> m;
-		for(std::map<variant,variant>::const_iterator i = map_->elements.begin(); i != map_->elements.end(); ++i) {
+		variant_hash_map m;
+		for(variant_hash_map::const_iterator i = map_->elements.begin(); i != map_->elements.end(); ++i) {
 			variant key = i->first;
 			variant value = i->second;
 			key.make_unique();
@@ -1740,7 +2277,7 @@ void variant::make_unique()
 		variant_map* vm = new variant_map;
 		vm->info = map_->info;
 		vm->refcount = 1;
-		vm->elements.swap(m);
+		vm->elements = m;
 		map_ = vm;
 		break;
 	}
@@ -1768,6 +2305,7 @@ std::string variant::string_cast() const
 	case VARIANT_TYPE_CALLABLE:
 		return "(object)";
 	case VARIANT_TYPE_LIST: {
+		list_->flatten();
 		std::string res = "";
 		for(size_t i=0; i < list_->size(); ++i) {
 			const variant& var = list_->begin[i];
@@ -1782,7 +2320,10 @@ std::string variant::string_cast() const
 	}
 	case VARIANT_TYPE_MAP: {
 		std::string res = "";
-		for(std::map<variant,variant>::const_iterator i=map_->elements.begin(); i != map_->elements.end(); ++i) {
+		std::vector<const variant_hash_map::value_type*> items;
+		map_->elements.get_sorted(&items);
+		for(int n = 0; n != items.size(); ++n) {
+			const variant_hash_map::value_type* i = items[n];
 			if(!res.empty()) {
 				res += ",";
 			}
@@ -1794,7 +2335,7 @@ std::string variant::string_cast() const
 	}
 
 	case VARIANT_TYPE_STRING:
-		return string_->str;
+		return string_->get();
 	default:
 		assert(false);
 		return "invalid";
@@ -1895,7 +2436,10 @@ std::string variant::to_debug_string(std::vector<const game_logic::formula_calla
 	case VARIANT_TYPE_MAP: {
 		s << "{";
 		bool first_time = true;
-		for(std::map<variant,variant>::const_iterator i=map_->elements.begin(); i != map_->elements.end(); ++i) {
+		std::vector<const variant_hash_map::value_type*> items;
+		map_->elements.get_sorted(&items);
+		for(int n = 0; n != items.size(); ++n) {
+			const variant_hash_map::value_type* i = items[n];
 			if(!first_time) {
 				s << ",";
 			}
@@ -1908,7 +2452,7 @@ std::string variant::to_debug_string(std::vector<const game_logic::formula_calla
 		break;
 	}
 	case VARIANT_TYPE_STRING: {
-		s << "'" << string_->str << "'";
+		s << "'" << string_->get() << "'";
 		break;
 	}
 	case VARIANT_TYPE_INVALID: {
@@ -1952,8 +2496,11 @@ void variant::write_json(std::ostream& s, write_flags flags) const
 	}
 	case VARIANT_TYPE_MAP: {
 		s << "{";
-		for(std::map<variant,variant>::const_iterator i = map_->elements.begin(); i != map_->elements.end(); ++i) {
-			if(i != map_->elements.begin()) {
+		std::vector<const variant_hash_map::value_type*> items;
+		map_->elements.get_sorted(&items);
+		for(int n = 0; n != items.size(); ++n) {
+			const variant_hash_map::value_type* i = items[n];
+			if(n != 0) {
 				s << ',';
 			}
 
@@ -1972,6 +2519,7 @@ void variant::write_json(std::ostream& s, write_flags flags) const
 		return;
 	}
 	case VARIANT_TYPE_LIST: {
+		list_->flatten();
 		s << "[";
 
 		for(std::vector<variant>::const_iterator i = list_->begin;
@@ -1987,7 +2535,7 @@ void variant::write_json(std::ostream& s, write_flags flags) const
 		return;
 	}
 	case VARIANT_TYPE_STRING: {
-		const std::string& str = string_->translated_from.empty() ? string_->str : string_->translated_from;
+		const std::string& str = string_->translated_from.empty() ? string_->get() : string_->translated_from;
 		const char delim = string_->translated_from.empty() ? '"' : '~';
 		if(std::count(str.begin(), str.end(), '\\') 
 			|| std::count(str.begin(), str.end(), delim) 
@@ -2007,7 +2555,7 @@ void variant::write_json(std::ostream& s, write_flags flags) const
 			}
 			s << delim;
 		} else {
-			s << delim << string_->str << delim;
+			s << delim << string_->get() << delim;
 		}
 		return;
 	}
@@ -2083,8 +2631,11 @@ void variant::write_json_pretty(std::ostream& s, std::string indent, write_flags
 	case VARIANT_TYPE_MAP: {
 		s << "{";
 		indent += "\t";
-		for(std::map<variant,variant>::const_iterator i = map_->elements.begin(); i != map_->elements.end(); ++i) {
-			if(i != map_->elements.begin()) {
+		std::vector<const variant_hash_map::value_type*> items;
+		map_->elements.get_sorted(&items);
+		for(int n = 0; n != items.size(); ++n) {
+			const variant_hash_map::value_type* i = items[n];
+			if(n != 0) {
 				s << ',';
 			}
 
@@ -2107,6 +2658,7 @@ void variant::write_json_pretty(std::ostream& s, std::string indent, write_flags
 		return;
 	}
 	case VARIANT_TYPE_LIST: {
+		list_->flatten();
 		bool found_non_scalar = false;
 		for(std::vector<variant>::const_iterator i = list_->begin;
 		    i != list_->end; ++i) {
@@ -2192,6 +2744,7 @@ std::ostream& operator<<(std::ostream& os, const variant& v)
 std::pair<variant*,variant*> variant::range() const
 {
 	if(type_ == VARIANT_TYPE_LIST) {
+		list_->flatten();
 		return std::pair<variant*,variant*>(&(*list_->begin), &(*list_->end));
 	}
 	variant v;
@@ -2208,6 +2761,128 @@ UNIT_TEST(variant_decimal)
 	CHECK_EQ((d + d2).as_decimal().value(), 9880000);
 }
 
+UNIT_TEST(variant_interned_string)
+{
+	const variant a = variant::create_interned_string("abc");
+	const variant b = variant::create_interned_string("abc");
+	const variant c = variant::create_interned_string("abd");
+	CHECK_EQ(a.is_interned_string(), true);
+	CHECK_EQ(a, b);
+	CHECK_EQ(a, variant("abc"));
+	CHECK_EQ(a == c, false);
+	CHECK_EQ(a < c, true);
+	CHECK_EQ(c < a, false);
+	CHECK_EQ(a < b, false);
+	CHECK_EQ(a.as_string(), "abc");
+
+	std::map<variant, variant> m;
+	m[variant("abc")] = variant(1);
+	CHECK_EQ(m.count(a), 1);
+	CHECK_EQ(m.count(c), 0);
+}
+
+UNIT_TEST(variant_list_concat_tree)
+{
+	//prepending and appending to slices can't extend the list in place,
+	//so these build trees.
+	std::vector<variant> items;
+	variant list(&items);
+	for(int n = 0; n != 500; ++n) {
+		std::vector<variant> front, back;
+		front.push_back(variant(-n));
+		back.push_back(variant(n));
+		list = variant(&front) + list.get_list_slice(0, list.num_elements()) + variant(&back);
+	}
+
+	CHECK_EQ(list.num_elements(), 1000);
+	for(int n = 0; n != 500; ++n) {
+		CHECK_EQ(list[n].as_int(), n - 499);
+		CHECK_EQ(list[500 + n].as_int(), n);
+	}
+
+	const variant slice = list.get_list_slice(100, 900);
+	CHECK_EQ(slice.num_elements(), 800);
+	CHECK_EQ(slice[0].as_int(), -399);
+
+	//slices of a tree are trees sharing its nodes.
+	for(int begin = 0; begin < 1000; begin += 37) {
+		for(int end = begin + 1; end <= 1000; end += 53) {
+			const variant s = list.get_list_slice(begin, end);
+			CHECK_EQ(s.num_elements(), end - begin);
+			CHECK_EQ(s[0].as_int(), list[begin].as_int());
+			CHECK_EQ(s[end - begin - 1].as_int(), list[end - 1].as_int());
+
+			const variant inner = s.get_list_slice(0, s.num_elements()/2);
+			CHECK_EQ(inner.num_elements(), (end - begin)/2);
+		}
+	}
+
+	std::vector<variant> empty_items;
+	const variant empty(&empty_items);
+	const variant appended_empty = list + empty;
+	const variant prepended_empty = empty + list;
+	CHECK_EQ(appended_empty.num_elements(), 1000);
+	CHECK_EQ(prepended_empty.num_elements(), 1000);
+	CHECK_EQ(appended_empty[999].as_int(), 499);
+	CHECK_EQ(prepended_empty[0].as_int(), -499);
+	CHECK_EQ(appended_empty == list, true);
+	CHECK_EQ(prepended_empty == list, true);
+
+	const variant doubled = list + list;
+	CHECK_EQ(doubled.num_elements(), 2000);
+	CHECK_EQ(doubled[1999].as_int(), 499);
+
+	int index = 0;
+	foreach(const variant& v, list.range()) {
+		CHECK_EQ(v.as_int(), index < 500 ? index - 499 : index - 500);
+		++index;
+	}
+}
+
+BENCHMARK(variant_list_append)
+{
+	BENCHMARK_LOOP {
+		std::vector<variant> items;
+		variant list(&items);
+		for(int n = 0; n != 1000; ++n) {
+			std::vector<variant> item(1, variant(n));
+			list = list.get_list_slice(0, list.num_elements()) + variant(&item);
+		}
+	}
+}
+
+UNIT_TEST(variant_string_concat)
+{
+	variant str("");
+	std::string expected;
+	for(int n = 0; n != 1000; ++n) {
+		const std::string piece = boost::lexical_cast<std::string>(n);
+		str = str + variant(piece);
+		expected += piece;
+		if(n%100 == 0) {
+			CHECK_EQ(str.as_string(), expected);
+		}
+	}
+
+	CHECK_EQ(str.num_elements(), expected.size());
+	CHECK_EQ((str + variant(5)).as_string(), expected + "5");
+	CHECK_EQ((variant(5) + str).as_string(), "5" + expected);
+	CHECK_EQ(str.as_string(), expected);
+}
+
+BENCHMARK(variant_string_concat)
+{
+	const variant piece("abcdefghijklmnopqrstuvwxyz");
+	BENCHMARK_LOOP {
+		variant str("");
+		for(int n = 0; n != 1000; ++n) {
+			str = str + piece;
+		}
+
+		str.as_string();
+	}
+}
+
 BENCHMARK(variant_assign)
 {
 	variant v(4);
@@ -37,6 +37,7 @@ class formula_callable;
 class formula_expression;
 }
 
+class variant_hash_map;
 class variant_type;
 typedef boost::shared_ptr<const variant_type> variant_type_ptr;
 typedef boost::shared_ptr<const variant_type> const_variant_type_ptr;
@@ -103,10 +104,15 @@ public:
 	explicit variant(std::vector<variant>* array);
 	explicit variant(const char* str);
 	explicit variant(const std::string& str);
+	//creates a string whose contents are shared with all equal interned
+	//strings, so they take less memory and compare by pointer.
+	static variant create_interned_string(const std::string& str);
+	bool is_interned_string() const;
+
 	static variant create_translated_string(const std::string& str);
 	static variant create_translated_string(const std::string& str, const std::string& translation);
 	explicit variant(std::map<variant,variant>* map);
-	variant(game_logic::const_formula_ptr, const std::vector<std::string>& args, const game_logic::formula_callable& callable, int base_slot, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, const variant_type_ptr& return_type);
+	variant(game_logic::const_formula_ptr, const std::vector<std::string>& args, const game_logic::formula_callable& callable, int base_slot, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, const variant_type_ptr& return_type, bool return_type_proven=false);
 
 	static variant create_variant_under_construction(intptr_t id);
 
@@ -137,6 +143,11 @@ public:
 	bool function_call_valid(const std::vector<variant>& args, std::string* message=NULL, bool allow_partial=false) const;
 	variant operator()(const std::vector<variant>& args) const;
 
+	//calls the function, skipping the runtime type check of arguments the
+	//caller has statically proven. proven_types[n] is the parameter type
+	//argument n was proven to match, or NULL if it wasn't proven.
+	variant call_with_proven_types(const std::vector<variant>& args, const std::vector<variant_type_ptr>& proven_types) const;
+
 	variant get_member(const std::string& str) const;
 
 	//unsafe function which is called on an integer variant and returns
@@ -160,7 +171,12 @@ public:
 	bool is_list() const { return type_ == VARIANT_TYPE_LIST; }
 
 	std::vector<variant> as_list() const;
-	const std::map<variant,variant>& as_map() const;
+	std::map<variant,variant> as_map() const;
+
+	//maps are stored in a variant_hash_map. as_map() builds a sorted copy
+	//each time it's called, so code that doesn't need sorted iteration
+	//should prefer this.
+	const variant_hash_map& as_hash_map() const;
 
 	typedef std::pair<variant,variant> map_pair;
 
@@ -246,6 +262,9 @@ public:
 	variant operator-() const;
 
 	bool operator==(const variant&) const;
+
+	//a hash consistent with operator==.
+	size_t hash() const;
 	bool operator!=(const variant&) const;
 	bool operator<(const variant&) const;
 	bool operator>(const variant&) const;
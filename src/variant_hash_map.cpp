@@ -0,0 +1,275 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+
+#include "unit_test.hpp"
+#include "variant_hash_map.hpp"
+
+namespace {
+//maps with no more entries than this are searched linearly.
+const size_t MaxUnindexedSize = 8;
+
+const int EmptySlot = -1;
+const int ErasedSlot = -2;
+
+bool compare_entries_by_key(const variant_hash_map::value_type* a, const variant_hash_map::value_type* b)
+{
+	return a->first < b->first;
+}
+}
+
+variant_hash_map::variant_hash_map() : size_(0), index_used_(0)
+{}
+
+int variant_hash_map::find_entry(const variant& key, size_t hash) const
+{
+	if(index_.empty()) {
+		for(size_t n = 0; n != entries_.size(); ++n) {
+			const entry& e = entries_[n];
+			if(!e.erased && e.hash == hash && e.kv.first == key) {
+				return n;
+			}
+		}
+
+		return -1;
+	}
+
+	const size_t mask = index_.size() - 1;
+	for(size_t pos = hash&mask; ; pos = (pos+1)&mask) {
+		const int n = index_[pos];
+		if(n == EmptySlot) {
+			return -1;
+		}
+
+		if(n >= 0) {
+			const entry& e = entries_[n];
+			if(e.hash == hash && e.kv.first == key) {
+				return n;
+			}
+		}
+	}
+}
+
+const variant* variant_hash_map::find(const variant& key) const
+{
+	const int n = find_entry(key, key.hash());
+	return n == -1 ? NULL : &entries_[n].kv.second;
+}
+
+variant* variant_hash_map::find(const variant& key)
+{
+	const int n = find_entry(key, key.hash());
+	return n == -1 ? NULL : &entries_[n].kv.second;
+}
+
+variant& variant_hash_map::operator[](const variant& key)
+{
+	const size_t hash = key.hash();
+	const int n = find_entry(key, hash);
+	if(n != -1) {
+		return entries_[n].kv.second;
+	}
+
+	entry e;
+	e.kv.first = key;
+	e.hash = hash;
+	e.erased = false;
+	entries_.push_back(e);
+	++size_;
+
+	if(index_.empty()) {
+		if(entries_.size() > MaxUnindexedSize) {
+			rebuild_index();
+		}
+	} else if((index_used_+1)*2 > index_.size()) {
+		rebuild_index();
+	} else {
+		add_to_index(entries_.size() - 1);
+	}
+
+	return entries_.back().kv.second;
+}
+
+bool variant_hash_map::erase(const variant& key)
+{
+	const size_t hash = key.hash();
+	const int n = find_entry(key, hash);
+	if(n == -1) {
+		return false;
+	}
+
+	if(index_.empty() == false) {
+		const size_t mask = index_.size() - 1;
+		size_t pos = hash&mask;
+		while(index_[pos] != n) {
+			pos = (pos+1)&mask;
+		}
+
+		index_[pos] = ErasedSlot;
+	}
+
+	entry& e = entries_[n];
+	e.kv = value_type();
+	e.erased = true;
+	--size_;
+
+	if(entries_.size() - size_ > std::max(size_, MaxUnindexedSize)) {
+		compact();
+	}
+
+	return true;
+}
+
+void variant_hash_map::clear()
+{
+	entries_.clear();
+	index_.clear();
+	size_ = 0;
+	index_used_ = 0;
+}
+
+void variant_hash_map::get_sorted(std::vector<const value_type*>* result) const
+{
+	result->clear();
+	result->reserve(size_);
+	for(const_iterator i = begin(); i != end(); ++i) {
+		result->push_back(&*i);
+	}
+
+	std::sort(result->begin(), result->end(), compare_entries_by_key);
+}
+
+bool variant_hash_map::operator==(const variant_hash_map& o) const
+{
+	if(size_ != o.size_) {
+		return false;
+	}
+
+	for(const_iterator i = begin(); i != end(); ++i) {
+		const variant* value = o.find(i->first);
+		if(value == NULL || *value != i->second) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool variant_hash_map::operator<=(const variant_hash_map& o) const
+{
+	std::vector<const value_type*> a, b;
+	get_sorted(&a);
+	o.get_sorted(&b);
+
+	//lexicographic comparison of the (key, value) pairs.
+	for(size_t n = 0; n != a.size() && n != b.size(); ++n) {
+		if(*a[n] < *b[n]) {
+			return true;
+		} else if(*b[n] < *a[n]) {
+			return false;
+		}
+	}
+
+	return a.size() <= b.size();
+}
+
+void variant_hash_map::add_to_index(int entry_index)
+{
+	const size_t mask = index_.size() - 1;
+	size_t pos = entries_[entry_index].hash&mask;
+	while(index_[pos] >= 0) {
+		pos = (pos+1)&mask;
+	}
+
+	if(index_[pos] == EmptySlot) {
+		++index_used_;
+	}
+
+	index_[pos] = entry_index;
+}
+
+void variant_hash_map::rebuild_index()
+{
+	if(size_ <= MaxUnindexedSize) {
+		index_.clear();
+		index_used_ = 0;
+		return;
+	}
+
+	//keep the table at most half full.
+	size_t capacity = 16;
+	while(capacity < size_*4) {
+		capacity *= 2;
+	}
+
+	index_.assign(capacity, EmptySlot);
+	index_used_ = 0;
+	for(size_t n = 0; n != entries_.size(); ++n) {
+		if(!entries_[n].erased) {
+			add_to_index(n);
+		}
+	}
+}
+
+void variant_hash_map::compact()
+{
+	std::deque<entry> entries;
+	for(size_t n = 0; n != entries_.size(); ++n) {
+		if(!entries_[n].erased) {
+			entries.push_back(entries_[n]);
+		}
+	}
+
+	entries_.swap(entries);
+	rebuild_index();
+}
+
+UNIT_TEST(variant_hash_map) {
+	variant_hash_map m;
+	for(int n = 0; n != 100; ++n) {
+		m[variant(n)] = variant(n*2);
+	}
+
+	CHECK_EQ(m.size(), 100);
+	CHECK_EQ(*m.find(variant(7)), variant(14));
+	CHECK_EQ(*m.find(variant(decimal::from_int(7))), variant(14));
+	CHECK(m.find(variant(100)) == NULL, "test failed");
+
+	for(int n = 0; n < 100; n += 2) {
+		CHECK_EQ(m.erase(variant(n)), true);
+	}
+
+	CHECK_EQ(m.size(), 50);
+	CHECK(m.find(variant(8)) == NULL, "test failed");
+	CHECK_EQ(*m.find(variant(9)), variant(18));
+
+	//iteration is in insertion order.
+	int expected = 1;
+	for(variant_hash_map::const_iterator i = m.begin(); i != m.end(); ++i) {
+		CHECK_EQ(i->first, variant(expected));
+		expected += 2;
+	}
+
+	variant_hash_map m2;
+	m2[variant("b")] = variant(2);
+	m2[variant("a")] = variant(1);
+	std::vector<const variant_hash_map::value_type*> sorted;
+	m2.get_sorted(&sorted);
+	CHECK_EQ(sorted.size(), 2);
+	CHECK_EQ(sorted[0]->first, variant("a"));
+	CHECK_EQ(sorted[1]->first, variant("b"));
+}
@@ -0,0 +1,117 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+	
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VARIANT_HASH_MAP_HPP_INCLUDED
+#define VARIANT_HASH_MAP_HPP_INCLUDED
+
+#include <deque>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "variant.hpp"
+
+//An open addressing hash map from variant to variant, used as the storage
+//of FFL maps. Entries are kept in insertion order so iteration is
+//deterministic, and are stored in a deque so references to values remain
+//valid when new keys are added. Small maps don't build a hash index at
+//all and are searched linearly, comparing cached hashes first.
+class variant_hash_map
+{
+public:
+	typedef std::pair<variant, variant> value_type;
+
+private:
+	struct entry {
+		value_type kv;
+		size_t hash;
+		bool erased;
+	};
+
+public:
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef variant_hash_map::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const value_type* pointer;
+		typedef const value_type& reference;
+
+		const_iterator() : entries_(NULL), pos_(0) {}
+		const_iterator(const std::deque<entry>* entries, size_t pos) : entries_(entries), pos_(pos) { skip_erased(); }
+
+		const value_type& operator*() const { return (*entries_)[pos_].kv; }
+		const value_type* operator->() const { return &(*entries_)[pos_].kv; }
+		const_iterator& operator++() { ++pos_; skip_erased(); return *this; }
+		bool operator==(const const_iterator& o) const { return pos_ == o.pos_; }
+		bool operator!=(const const_iterator& o) const { return pos_ != o.pos_; }
+	private:
+		void skip_erased() {
+			while(pos_ < entries_->size() && (*entries_)[pos_].erased) {
+				++pos_;
+			}
+		}
+
+		const std::deque<entry>* entries_;
+		size_t pos_;
+	};
+
+	variant_hash_map();
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	//iteration is in insertion order.
+	const_iterator begin() const { return const_iterator(&entries_, 0); }
+	const_iterator end() const { return const_iterator(&entries_, entries_.size()); }
+
+	//returns NULL if the key isn't in the map.
+	const variant* find(const variant& key) const;
+	variant* find(const variant& key);
+
+	//returns the value for the key, inserting null if it isn't present.
+	variant& operator[](const variant& key);
+
+	//returns true if the key was present.
+	bool erase(const variant& key);
+
+	void clear();
+
+	//gets pointers to the entries ordered by key, for code that needs the
+	//same order std::map<variant,variant> would give.
+	void get_sorted(std::vector<const value_type*>* result) const;
+
+	bool operator==(const variant_hash_map& o) const;
+	bool operator!=(const variant_hash_map& o) const { return !(*this == o); }
+
+	//compares the maps the way std::map<variant,variant> would.
+	bool operator<=(const variant_hash_map& o) const;
+
+private:
+	int find_entry(const variant& key, size_t hash) const;
+	void add_to_index(int entry_index);
+	void rebuild_index();
+	void compact();
+
+	std::deque<entry> entries_;
+
+	//open addressing table of entry indexes. Empty for small maps.
+	std::vector<int> index_;
+	size_t size_;
+	size_t index_used_;
+};
+
+#endif
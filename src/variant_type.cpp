@@ -30,6 +30,7 @@
 #include "module.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant_hash_map.hpp"
 #include "variant_type.hpp"
 
 variant_type::variant_type()
@@ -841,7 +842,7 @@ public:
 			return false;
 		}
 
-		foreach(const variant::map_pair& p, v.as_map()) {
+		foreach(const variant_hash_map::value_type& p, v.as_hash_map()) {
 			if(!key_type_->match(p.first) || !value_type_->match(p.second)) {
 				return false;
 			}
@@ -921,7 +922,8 @@ public:
 			return false;
 		}
 
-		foreach(const variant::map_pair& p, v.as_map()) {
+		const variant_hash_map& m = v.as_hash_map();
+		foreach(const variant_hash_map::value_type& p, m) {
 			std::map<variant, variant_type_ptr>::const_iterator itor = type_map_.find(p.first);
 			if(itor == type_map_.end()) {
 				return false;
@@ -933,7 +935,7 @@ public:
 		}
 
 		foreach(const variant& k, must_have_keys_) {
-			if(v.as_map().count(k) == 0) {
+			if(m.find(k) == NULL) {
 				return false;
 			}
 		}
@@ -1281,7 +1283,7 @@ variant_type_ptr get_variant_type_from_value(const variant& value) {
 	} else if(value.is_map()) {
 
 		bool all_string_keys = true;
-		foreach(const variant::map_pair& p, value.as_map()) {
+		foreach(const variant_hash_map::value_type& p, value.as_hash_map()) {
 			if(p.first.is_string() == false) {
 				all_string_keys = false;
 				break;
@@ -1290,7 +1292,7 @@ variant_type_ptr get_variant_type_from_value(const variant& value) {
 
 		if(all_string_keys) {
 			std::map<variant, variant_type_ptr> type_map;
-			foreach(const variant::map_pair& p, value.as_map()) {
+			foreach(const variant_hash_map::value_type& p, value.as_hash_map()) {
 				type_map[p.first] = get_variant_type_from_value(p.second);
 			}
 
@@ -1427,6 +1429,70 @@ bool variant_types_might_match(variant_type_ptr to, variant_type_ptr from)
 	return to->is_compatible(from) || from->is_compatible(to) || from->maybe_convertible_to(to);
 }
 
+namespace {
+//class and interface types convert values such as maps at call time,
+//so values passed for them must always be checked.
+bool type_may_convert_values(variant_type_ptr type)
+{
+	if(type->is_class() || type->is_interface()) {
+		return true;
+	}
+
+	if(const std::vector<variant_type_ptr>* items = type->is_union()) {
+		foreach(variant_type_ptr item, *items) {
+			if(type_may_convert_values(item)) {
+				return true;
+			}
+		}
+	}
+
+	if(const std::vector<variant_type_ptr>* items = type->is_specific_list()) {
+		foreach(variant_type_ptr item, *items) {
+			if(type_may_convert_values(item)) {
+				return true;
+			}
+		}
+	}
+
+	if(const std::map<variant, variant_type_ptr>* items = type->is_specific_map()) {
+		for(std::map<variant, variant_type_ptr>::const_iterator i = items->begin(); i != items->end(); ++i) {
+			if(type_may_convert_values(i->second)) {
+				return true;
+			}
+		}
+	}
+
+	variant_type_ptr list_type = type->is_list_of();
+	if(list_type && type_may_convert_values(list_type)) {
+		return true;
+	}
+
+	std::pair<variant_type_ptr, variant_type_ptr> map_type = type->is_map_of();
+	if(map_type.first && (type_may_convert_values(map_type.first) || type_may_convert_values(map_type.second))) {
+		return true;
+	}
+
+	return false;
+}
+}
+
+bool variant_types_proven_match(variant_type_ptr to, variant_type_ptr from)
+{
+	if(!to || !from) {
+		return false;
+	}
+
+	if(to->is_any()) {
+		return true;
+	}
+
+	if(from->is_any() || type_may_convert_values(to)) {
+		return false;
+	}
+
+	return variant_types_compatible(to, from);
+}
+
 variant_type_ptr parse_variant_type(const variant& original_str,
                                     const formula_tokenizer::token*& i1,
                                     const formula_tokenizer::token* i2,
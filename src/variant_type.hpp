@@ -118,6 +118,10 @@ std::string variant_type_is_class_or_null(variant_type_ptr type);
 bool variant_types_compatible(variant_type_ptr to, variant_type_ptr from);
 bool variant_types_might_match(variant_type_ptr to, variant_type_ptr from);
 
+//true if every value of type 'from' is known to match 'to' without any
+//conversion, meaning a runtime match() check can be skipped.
+bool variant_types_proven_match(variant_type_ptr to, variant_type_ptr from);
+
 variant_type_ptr parse_variant_type(const variant& original_str,
                                     const formula_tokenizer::token*& i1,
                                     const formula_tokenizer::token* i2,